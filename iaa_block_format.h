@@ -0,0 +1,33 @@
+// Copyright (C) 2022 Intel Corporation
+
+// SPDX-License-Identifier: Apache-2.0
+
+#pragma once
+
+#include <cstdint>
+
+#include "rocksdb/rocksdb_namespace.h"
+
+namespace ROCKSDB_NAMESPACE {
+
+// Block format: a varint header followed by the compressed payload. The lower
+// 32 bits of the header hold the uncompressed size (max size of a RocksDB block
+// is 4GiB). Blocks using an encoding other than plain deflate also set flags
+// in the upper 32 bits. Plain deflate blocks have no flags, so their header is
+// a varint32 and they remain readable by earlier releases of the plugin.
+enum BlockFlags : uint32_t {
+  kZeroCompress16 = 1 << 0,
+  kZeroCompress32 = 1 << 1,
+  // Zero-compressed payload is deflated. The header is followed by a varint32
+  // with the size of the zero-compressed stream.
+  kZeroDeflate = 1 << 2,
+  // The header is followed by a fixed32 checksum of the uncompressed data:
+  // the CRC32 computed by QPL for deflate blocks, CRC32C for zero-compressed
+  // blocks.
+  kChecksum = 1 << 3,
+};
+
+constexpr uint32_t kSupportedBlockFlags =
+    kZeroCompress16 | kZeroCompress32 | kZeroDeflate | kChecksum;
+
+}  // namespace ROCKSDB_NAMESPACE
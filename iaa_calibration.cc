@@ -0,0 +1,299 @@
+// Copyright (C) 2022 Intel Corporation
+
+// SPDX-License-Identifier: Apache-2.0
+
+#include "iaa_calibration.h"
+
+#include <dirent.h>
+
+#include <algorithm>
+#include <cinttypes>
+#include <cstdio>
+#include <fstream>
+#include <memory>
+#include <sstream>
+#include <vector>
+
+#include "iaa_compressor.h"
+#include "iaa_sample_data.h"
+#include "iaa_stats.h"
+#include "rocksdb/compressor.h"
+#include "rocksdb/convenience.h"
+
+namespace ROCKSDB_NAMESPACE {
+
+static const char* kModeNames[] = {"dynamic", "fixed"};
+
+// Block sizes measured by calibration
+static const uint32_t kCalibrationSizes[] = {512,   1024,  2048,  4096,
+                                             8192,  16384, 32768, 65536,
+                                             131072};
+
+Status IAACalibrationProfile::Save(const std::string& path,
+                                   const std::string& comment) const {
+  std::unique_ptr<FILE, int (*)(FILE*)> file(fopen(path.c_str(), "w"),
+                                             &fclose);
+  if (file == nullptr) {
+    return Status::IOError("cannot open " + path);
+  }
+  std::stringstream lines(comment);
+  std::string line;
+  while (std::getline(lines, line)) {
+    fprintf(file.get(), "# %s\n", line.c_str());
+  }
+  fprintf(file.get(), "fingerprint=%s\n", fingerprint.c_str());
+  for (int mode = 0; mode < 2; mode++) {
+    fprintf(file.get(), "compress_hw_min_size.%s=%u\n", kModeNames[mode],
+            compress_hw_min_size[mode]);
+  }
+  fprintf(file.get(), "uncompress_hw_min_size=%u\n", uncompress_hw_min_size);
+  if (ferror(file.get())) {
+    return Status::IOError("cannot write " + path);
+  }
+  return Status::OK();
+}
+
+Status IAACalibrationProfile::Load(const std::string& path) {
+  std::ifstream file(path);
+  if (!file) {
+    return Status::NotFound("cannot open " + path);
+  }
+  std::string line;
+  while (std::getline(file, line)) {
+    if (line.empty() || line[0] == '#') {
+      continue;
+    }
+    size_t equals = line.find('=');
+    if (equals == std::string::npos) {
+      return Status::Corruption("invalid line in calibration profile", line);
+    }
+    std::string name = line.substr(0, equals);
+    std::string value = line.substr(equals + 1);
+    uint32_t* threshold = nullptr;
+    if (name == "fingerprint") {
+      fingerprint = value;
+      continue;
+    } else if (name == "compress_hw_min_size.dynamic") {
+      threshold = &compress_hw_min_size[0];
+    } else if (name == "compress_hw_min_size.fixed") {
+      threshold = &compress_hw_min_size[1];
+    } else if (name == "uncompress_hw_min_size") {
+      threshold = &uncompress_hw_min_size;
+    } else {
+      return Status::Corruption("unknown name in calibration profile", name);
+    }
+    char* end = nullptr;
+    unsigned long long parsed = strtoull(value.c_str(), &end, 10);
+    if (value.empty() || *end != '\0' || parsed > kNever) {
+      return Status::Corruption("invalid value in calibration profile", line);
+    }
+    *threshold = static_cast<uint32_t>(parsed);
+  }
+  if (fingerprint.empty()) {
+    return Status::Corruption("calibration profile has no fingerprint");
+  }
+  return Status::OK();
+}
+
+static std::string ReadSysfs(const std::string& path) {
+  std::ifstream file(path);
+  std::string value;
+  std::getline(file, value);
+  return value;
+}
+
+std::string GetIAAHardwareFingerprint() {
+  std::string cpu = "unknown";
+  std::ifstream cpuinfo("/proc/cpuinfo");
+  std::string line;
+  while (std::getline(cpuinfo, line)) {
+    if (line.compare(0, 10, "model name") == 0) {
+      size_t colon = line.find(':');
+      if (colon != std::string::npos && colon + 2 <= line.size()) {
+        cpu = line.substr(colon + 2);
+      }
+      break;
+    }
+  }
+
+  // IAA devices (iaxN) and their enabled work queues (wqN.M), as configured
+  // with accel-config
+  std::vector<std::string> devices;
+  std::vector<std::string> wqs;
+  const std::string sysfs = "/sys/bus/dsa/devices/";
+  std::unique_ptr<DIR, int (*)(DIR*)> dir(opendir(sysfs.c_str()), &closedir);
+  if (dir != nullptr) {
+    std::vector<std::string> names;
+    while (struct dirent* entry = readdir(dir.get())) {
+      names.push_back(entry->d_name);
+    }
+    for (const std::string& name : names) {
+      if (name.compare(0, 3, "iax") == 0) {
+        devices.push_back(name.substr(3));
+      }
+    }
+    for (const std::string& name : names) {
+      size_t dot = name.find('.');
+      if (name.compare(0, 2, "wq") != 0 || dot == std::string::npos ||
+          std::find(devices.begin(), devices.end(), name.substr(2, dot - 2)) ==
+              devices.end() ||
+          ReadSysfs(sysfs + name + "/state") != "enabled") {
+        continue;
+      }
+      wqs.push_back(name + ":" + ReadSysfs(sysfs + name + "/mode") + ":" +
+                    ReadSysfs(sysfs + name + "/size"));
+    }
+  }
+  std::sort(wqs.begin(), wqs.end());
+  std::string fingerprint =
+      "cpu=" + cpu + ",iax=" + std::to_string(devices.size()) + ",wqs=";
+  for (size_t i = 0; i < wqs.size(); i++) {
+    fingerprint += (i > 0 ? "+" : "") + wqs[i];
+  }
+  return fingerprint;
+}
+
+// Median latencies of Compress and Uncompress on one block size
+struct CalibrationPoint {
+  uint64_t compress_nanos = 0;
+  uint64_t uncompress_nanos = 0;
+};
+
+static Status Measure(const std::string& options, const std::string& block,
+                      uint32_t iterations, CalibrationPoint* point) {
+  std::shared_ptr<Compressor> compressor;
+  ConfigOptions config_options;
+  Status s = Compressor::CreateFromString(
+      config_options, "id=com.intel.iaa_compressor_rocksdb;" + options,
+      &compressor);
+  if (!s.ok()) {
+    return s;
+  }
+  CompressionInfo compr_info(CompressionDict::GetEmptyDict());
+  UncompressionInfo uncompr_info(UncompressionDict::GetEmptyDict());
+  std::vector<uint64_t> compress_nanos;
+  std::vector<uint64_t> uncompress_nanos;
+  // The first call of each operation initializes the jobs and is not counted
+  for (uint32_t i = 0; i <= iterations; i++) {
+    std::string compressed;
+    uint64_t start = NowNanos();
+    s = compressor->Compress(compr_info, block, &compressed);
+    uint64_t compressed_at = NowNanos();
+    if (!s.ok()) {
+      return s;
+    }
+    char* uncompressed = nullptr;
+    size_t uncompressed_length = 0;
+    s = compressor->Uncompress(uncompr_info, compressed.data(),
+                               compressed.size(), &uncompressed,
+                               &uncompressed_length);
+    uint64_t end = NowNanos();
+    std::unique_ptr<char[]> output(uncompressed);
+    if (!s.ok()) {
+      return s;
+    }
+    if (i > 0) {
+      compress_nanos.push_back(compressed_at - start);
+      uncompress_nanos.push_back(end - compressed_at);
+    }
+  }
+  auto median = [](std::vector<uint64_t>* values) {
+    std::nth_element(values->begin(), values->begin() + values->size() / 2,
+                     values->end());
+    return (*values)[values->size() / 2];
+  };
+  point->compress_nanos = median(&compress_nanos);
+  point->uncompress_nanos = median(&uncompress_nanos);
+  return Status::OK();
+}
+
+// Smallest size from which the hardware path is at least as fast as the
+// software path for all larger sizes
+static uint32_t Threshold(const std::vector<uint64_t>& sw,
+                          const std::vector<uint64_t>& hw) {
+  uint32_t threshold = IAACalibrationProfile::kNever;
+  for (size_t i = sw.size(); i > 0; i--) {
+    if (hw[i - 1] > sw[i - 1]) {
+      break;
+    }
+    threshold = i == 1 ? 0 : kCalibrationSizes[i - 1];
+  }
+  return threshold;
+}
+
+Status CalibrateIAA(const std::string& path, const std::string& options,
+                    uint32_t iterations, std::string* report) {
+  if (iterations == 0) {
+    return Status::InvalidArgument("iterations must be greater than 0");
+  }
+  IAACalibrationProfile profile;
+  profile.fingerprint = GetIAAHardwareFingerprint();
+
+  // Without a usable hardware path (e.g., no IAA device or no enabled WQ),
+  // the profile keeps all deflate jobs on the software path
+  CalibrationPoint probe;
+  Status hw_status =
+      Measure("execution_path=hw;" + options,
+              GenerateIAASampleText(kCalibrationSizes[0]), 1, &probe);
+  if (!hw_status.ok()) {
+    profile.compress_hw_min_size[0] = IAACalibrationProfile::kNever;
+    profile.compress_hw_min_size[1] = IAACalibrationProfile::kNever;
+    profile.uncompress_hw_min_size = IAACalibrationProfile::kNever;
+    std::string note = "Hardware path unavailable (" + hw_status.ToString() +
+                       "): software path only\n";
+    if (report != nullptr) {
+      report->append(note);
+    }
+    return profile.Save(path, "IAA calibration profile\n" + note);
+  }
+
+  std::string table = "Median latency in microseconds\n";
+  char line[128];
+  snprintf(line, sizeof(line), "%-8s %8s %10s %10s %10s %10s\n", "mode",
+           "size", "c_sw", "c_hw", "u_sw", "u_hw");
+  table += line;
+  std::vector<uint64_t> uncompress_sw;
+  std::vector<uint64_t> uncompress_hw;
+  for (int mode = 0; mode < 2; mode++) {
+    std::vector<uint64_t> compress_sw;
+    std::vector<uint64_t> compress_hw;
+    for (uint32_t size : kCalibrationSizes) {
+      std::string block = GenerateIAASampleText(size);
+      CalibrationPoint sw;
+      CalibrationPoint hw;
+      std::string mode_options =
+          std::string(";compression_mode=") + kModeNames[mode] + ";" + options;
+      Status s = Measure("execution_path=sw" + mode_options, block, iterations,
+                         &sw);
+      if (s.ok()) {
+        s = Measure("execution_path=hw" + mode_options, block, iterations,
+                    &hw);
+      }
+      if (!s.ok()) {
+        return s;
+      }
+      compress_sw.push_back(sw.compress_nanos);
+      compress_hw.push_back(hw.compress_nanos);
+      // Decompression does not depend on the mode: measure it on dynamic
+      // Huffman blocks
+      if (mode == 0) {
+        uncompress_sw.push_back(sw.uncompress_nanos);
+        uncompress_hw.push_back(hw.uncompress_nanos);
+      }
+      snprintf(line, sizeof(line), "%-8s %8u %10.1f %10.1f %10.1f %10.1f\n",
+               kModeNames[mode], size, sw.compress_nanos / 1e3,
+               hw.compress_nanos / 1e3, sw.uncompress_nanos / 1e3,
+               hw.uncompress_nanos / 1e3);
+      table += line;
+    }
+    profile.compress_hw_min_size[mode] = Threshold(compress_sw, compress_hw);
+  }
+  profile.uncompress_hw_min_size = Threshold(uncompress_sw, uncompress_hw);
+
+  if (report != nullptr) {
+    report->append(table);
+  }
+  return profile.Save(path, "IAA calibration profile\n" + table);
+}
+
+}  // namespace ROCKSDB_NAMESPACE
@@ -0,0 +1,38 @@
+// Copyright (C) 2022 Intel Corporation
+
+// SPDX-License-Identifier: Apache-2.0
+
+#pragma once
+
+#include <cstdint>
+#include <limits>
+#include <string>
+
+#include "rocksdb/rocksdb_namespace.h"
+#include "rocksdb/status.h"
+
+namespace ROCKSDB_NAMESPACE {
+
+// Offload thresholds measured by CalibrateIAA on one machine configuration,
+// identified by GetIAAHardwareFingerprint().
+//
+// File format: one name=value pair per line. Lines starting with # are
+// comments (the calibration report).
+struct IAACalibrationProfile {
+  // Threshold meaning that the software path is always faster
+  static constexpr uint32_t kNever = std::numeric_limits<uint32_t>::max();
+
+  std::string fingerprint;
+  // Deflate jobs on the auto path smaller than these sizes (of uncompressed
+  // data) complete faster on the software path. Compression thresholds are
+  // indexed by compression mode (dynamic, fixed).
+  uint32_t compress_hw_min_size[2] = {0, 0};
+  uint32_t uncompress_hw_min_size = 0;
+
+  // Writes the profile, with comment lines (each prefixed with #)
+  Status Save(const std::string& path, const std::string& comment) const;
+  // Returns NotFound if the file does not exist
+  Status Load(const std::string& path);
+};
+
+}  // namespace ROCKSDB_NAMESPACE
@@ -0,0 +1,566 @@
+// Copyright (C) 2022 Intel Corporation
+
+// SPDX-License-Identifier: Apache-2.0
+
+#include "iaa_compression_manager.h"
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <limits>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "iaa_block_format.h"
+#include "iaa_executor.h"
+#include "qpl/qpl.h"
+#include "rocksdb/utilities/object_registry.h"
+#include "rocksdb/utilities/options_type.h"
+#include "util/coding.h"
+
+namespace ROCKSDB_NAMESPACE {
+
+#define JOB_INIT_ERROR "job init error"
+#define QPL_STATUS(status) "QPL status " + std::to_string(status)
+
+// FDICT bit of the zlib header: the stream needs a preset dictionary
+constexpr uint32_t kZlibPresetDictionary = 0x20;
+
+extern "C" FactoryFunc<CompressionManager> iaa_compression_manager_reg;
+
+FactoryFunc<CompressionManager> iaa_compression_manager_reg =
+    ObjectLibrary::Default()->AddFactory<CompressionManager>(
+        "com.intel.iaa_compression_manager",
+        [](const std::string& /* uri */,
+           std::unique_ptr<CompressionManager>* manager,
+           std::string* /* errmsg */) {
+          *manager = NewIAACompressionManager();
+          return manager->get();
+        });
+
+static std::unordered_map<std::string, qpl_path_t> execution_paths{
+    {"auto", qpl_path_auto},
+    {"hw", qpl_path_hardware},
+    {"sw", qpl_path_software}};
+
+enum qpl_compression_mode { dynamic_mode, fixed_mode };
+
+static std::unordered_map<std::string, qpl_compression_mode>
+    compression_modes{{"dynamic", dynamic_mode}, {"fixed", fixed_mode}};
+
+enum integrity_mode { integrity_none, integrity_crc };
+
+static std::unordered_map<std::string, integrity_mode> integrity_modes{
+    {"none", integrity_none}, {"crc", integrity_crc}};
+
+// Subset of the options of the IAA compressor. The compression level is the
+// level of the CompressionOptions of the column family.
+struct IAACompressionManagerOptions {
+  static const char* kName() { return "IAACompressionManagerOptions"; };
+  qpl_path_t execution_path = qpl_path_auto;
+  qpl_compression_mode compression_mode = dynamic_mode;
+  integrity_mode integrity = integrity_none;
+  std::shared_ptr<IAAExecutor> executor;
+  bool zlib_offload = true;
+};
+
+static std::unordered_map<std::string, OptionTypeInfo>
+    iaa_compression_manager_type_info = {
+        {"execution_path",
+         OptionTypeInfo::Enum(
+             offsetof(struct IAACompressionManagerOptions, execution_path),
+             &execution_paths)},
+        {"compression_mode",
+         OptionTypeInfo::Enum(
+             offsetof(struct IAACompressionManagerOptions, compression_mode),
+             &compression_modes)},
+        {"integrity",
+         OptionTypeInfo::Enum(
+             offsetof(struct IAACompressionManagerOptions, integrity),
+             &integrity_modes)},
+        {"executor",
+         OptionTypeInfo::AsCustomSharedPtr<IAAExecutor>(
+             offsetof(struct IAACompressionManagerOptions, executor),
+             OptionVerificationType::kByNameAllowNull,
+             OptionTypeFlags::kAllowNull)},
+        {"zlib_offload",
+         {offsetof(struct IAACompressionManagerOptions, zlib_offload),
+          OptionType::kBoolean, OptionVerificationType::kNormal,
+          OptionTypeFlags::kNone}}};
+
+// QPL jobs of one caller, one per execution path. Each job is initialized on
+// first use. Compression and decompression write directly to the buffers of
+// the caller, so no scratch buffer is needed.
+class IAAWorkingArea : public Compressor::WorkingArea {
+ public:
+  ~IAAWorkingArea() {
+    for (qpl_job* job : jobs_) {
+      if (job != nullptr) {
+        qpl_fini_job(job);
+        delete[] reinterpret_cast<char*>(job);
+      }
+    }
+  }
+
+  // Returns nullptr if the job struct cannot be initialized
+  qpl_job* GetJob(qpl_path_t execution_path) {
+    if (!initialized_[execution_path]) {
+      initialized_[execution_path] = true;
+      jobs_[execution_path] = InitJob(execution_path);
+    }
+    return jobs_[execution_path];
+  }
+
+ private:
+  static qpl_job* InitJob(qpl_path_t execution_path) {
+    uint32_t size = 0;
+    if (qpl_get_job_size(execution_path, &size) != QPL_STS_OK) {
+      return nullptr;
+    }
+    qpl_job* job =
+        reinterpret_cast<qpl_job*>(new (std::nothrow) char[size]);
+    if (job != nullptr && qpl_init_job(execution_path, job) != QPL_STS_OK) {
+      delete[] reinterpret_cast<char*>(job);
+      job = nullptr;
+    }
+    return job;
+  }
+
+  qpl_job* jobs_[3] = {nullptr, nullptr, nullptr};
+  bool initialized_[3] = {false, false, false};
+};
+
+// Working areas released by callers, handed out again by ObtainWorkingArea.
+// Shared by the compressors and decompressors of a manager. Calls made
+// without a working area of their own borrow one for their duration.
+class IAAWorkingAreaPool {
+ public:
+  std::unique_ptr<IAAWorkingArea> Get() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (areas_.empty()) {
+      return std::unique_ptr<IAAWorkingArea>(new IAAWorkingArea());
+    }
+    std::unique_ptr<IAAWorkingArea> area = std::move(areas_.back());
+    areas_.pop_back();
+    return area;
+  }
+
+  void Put(std::unique_ptr<IAAWorkingArea> area) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (areas_.size() < kMaxPooledAreas) {
+      areas_.push_back(std::move(area));
+    }
+  }
+
+ private:
+  // Beyond this, released working areas are freed
+  static constexpr size_t kMaxPooledAreas = 1024;
+
+  std::mutex mutex_;
+  std::vector<std::unique_ptr<IAAWorkingArea>> areas_;
+};
+
+// Working area of a call: the caller's one, if obtained from the object
+// making the call, otherwise one borrowed from the pool
+class CallArea {
+ public:
+  CallArea(IAAWorkingAreaPool* pool, Compressor::WorkingArea* owned)
+      : pool_(pool), area_(static_cast<IAAWorkingArea*>(owned)) {
+    if (area_ == nullptr) {
+      borrowed_ = pool_->Get();
+      area_ = borrowed_.get();
+    }
+  }
+
+  ~CallArea() {
+    if (borrowed_ != nullptr) {
+      pool_->Put(std::move(borrowed_));
+    }
+  }
+
+  IAAWorkingArea* operator->() const { return area_; }
+
+ private:
+  IAAWorkingAreaPool* pool_;
+  IAAWorkingArea* area_;
+  std::unique_ptr<IAAWorkingArea> borrowed_;
+};
+
+static qpl_status ExecuteJob(IAAExecutor* executor, qpl_job* job,
+                             qpl_path_t execution_path) {
+  qpl_status status = executor->Submit(job, execution_path);
+  while (status == QPL_STS_QUEUES_ARE_BUSY_ERR) {
+    status = executor->Submit(job, execution_path);
+  }
+  if (status == QPL_STS_OK) {
+    status = executor->Wait(job, execution_path);
+  }
+  return status;
+}
+
+// Statuses of jobs that did not run on their path (hardware unavailable, mode
+// not supported, job not submitted), as opposed to errors in the data
+static bool JobNotRun(qpl_status status) {
+  switch (status) {
+    case QPL_STS_INIT_HW_NOT_SUPPORTED:
+    case QPL_STS_INIT_LIBACCEL_NOT_FOUND:
+    case QPL_STS_INIT_LIBACCEL_ERROR:
+    case QPL_STS_INIT_WORK_QUEUES_NOT_AVAILABLE:
+    case QPL_STS_NOT_SUPPORTED_MODE_ERR:
+    case QPL_STS_QUEUES_ARE_BUSY_ERR:
+    case QPL_STS_JOB_NOT_SUBMITTED:
+    case QPL_STS_LIBRARY_INTERNAL_ERR:
+      return true;
+    default:
+      return false;
+  }
+}
+
+static IAAExecutor* GetExecutor(const IAACompressionManagerOptions& options) {
+  return options.executor != nullptr ? options.executor.get()
+                                     : IAAExecutor::Default();
+}
+
+class IAABlockCompressor : public Compressor {
+ public:
+  IAABlockCompressor(const IAACompressionManagerOptions& options, int level,
+                     std::shared_ptr<IAAWorkingAreaPool> pool)
+      : options_(options),
+        level_(level == 0 ||
+                       level == CompressionOptions::kDefaultCompressionLevel
+                   ? qpl_default_level
+                   : qpl_high_level),
+        pool_(std::move(pool)) {}
+
+  const char* Name() const override { return "IAABlockCompressor"; }
+
+  CompressionType GetPreferredCompressionType() const override {
+    return kIAACompressionType;
+  }
+
+  ManagedWorkingArea ObtainWorkingArea() override {
+    return ManagedWorkingArea(pool_->Get().release(), this);
+  }
+
+  void ReleaseWorkingArea(WorkingArea* area) override {
+    pool_->Put(
+        std::unique_ptr<IAAWorkingArea>(static_cast<IAAWorkingArea*>(area)));
+  }
+
+  // Blocks whose compressed size exceeds compressed_output_size are rejected
+  // (left uncompressed)
+  Status CompressBlock(Slice uncompressed_data, char* compressed_output,
+                       size_t* compressed_output_size,
+                       CompressionType* out_compression_type,
+                       ManagedWorkingArea* working_area) override {
+    size_t capacity = *compressed_output_size;
+    *out_compression_type = kNoCompression;
+    if (uncompressed_data.size() > std::numeric_limits<uint32_t>::max()) {
+      return Status::OK();
+    }
+    uint32_t length = static_cast<uint32_t>(uncompressed_data.size());
+    uint32_t flags = 0;
+    if (options_.integrity == integrity_crc) {
+      flags |= kChecksum;
+    }
+    char header[16];
+    char* header_end =
+        flags == 0
+            ? EncodeVarint32(header, length)
+            : EncodeVarint64(header, (static_cast<uint64_t>(flags) << 32) |
+                                         length);
+    size_t header_length = header_end - header;
+    size_t payload_offset =
+        header_length + ((flags & kChecksum) ? sizeof(uint32_t) : 0);
+    if (capacity <= payload_offset) {
+      return Status::OK();
+    }
+
+    qpl_path_t execution_path = options_.execution_path;
+    // High levels are only supported by the software path
+    if (level_ == qpl_high_level && execution_path == qpl_path_hardware) {
+      execution_path = qpl_path_software;
+    }
+    IAAExecutor* executor = GetExecutor(options_);
+    CallArea area(pool_.get(), working_area != nullptr &&
+                                       working_area->owner() == this
+                                   ? working_area->get()
+                                   : nullptr);
+    qpl_job* job = area->GetJob(executor->JobPath(execution_path));
+    if (job == nullptr) {
+      return Status::Corruption(JOB_INIT_ERROR);
+    }
+    job->next_in_ptr =
+        reinterpret_cast<uint8_t*>(const_cast<char*>(uncompressed_data.data()));
+    job->available_in = length;
+    job->next_out_ptr =
+        reinterpret_cast<uint8_t*>(compressed_output + payload_offset);
+    job->available_out = static_cast<uint32_t>(
+        std::min<size_t>(capacity - payload_offset,
+                         std::numeric_limits<uint32_t>::max()));
+    job->level = level_;
+    job->op = qpl_op_compress;
+    job->flags = QPL_FLAG_FIRST | QPL_FLAG_LAST | QPL_FLAG_OMIT_VERIFY;
+    if (options_.compression_mode == dynamic_mode) {
+      job->flags |= QPL_FLAG_DYNAMIC_HUFFMAN;
+    }
+    job->huffman_table = nullptr;
+    job->dictionary = nullptr;
+
+    qpl_status status = ExecuteJob(executor, job, execution_path);
+    if (status == QPL_STS_MORE_OUTPUT_NEEDED ||
+        status == QPL_STS_DST_IS_SHORT_ERR) {
+      // Does not fit in the output: reject the block
+      return Status::OK();
+    } else if (status != QPL_STS_OK) {
+      return Status::Corruption(QPL_STATUS(status));
+    }
+    memcpy(compressed_output, header, header_length);
+    if (flags & kChecksum) {
+      EncodeFixed32(compressed_output + header_length, job->crc);
+    }
+    *compressed_output_size = payload_offset + job->total_out;
+    *out_compression_type = kIAACompressionType;
+    return Status::OK();
+  }
+
+ private:
+  const IAACompressionManagerOptions options_;
+  const qpl_compression_levels level_;
+  std::shared_ptr<IAAWorkingAreaPool> pool_;
+};
+
+// Decompress-only object: it holds no compression state. With zlib_offload,
+// it also decompresses kZlibCompression blocks written by RocksDB. Blocks of
+// other compression types are passed to the built-in decompressor.
+class IAADecompressor : public Decompressor {
+ public:
+  IAADecompressor(const IAACompressionManagerOptions& options,
+                  std::shared_ptr<IAAWorkingAreaPool> pool,
+                  std::shared_ptr<Decompressor> builtin)
+      : options_(options),
+        pool_(std::move(pool)),
+        builtin_(std::move(builtin)) {}
+
+  const char* Name() const override { return "IAADecompressor"; }
+
+  ManagedWorkingArea ObtainWorkingArea(CompressionType preferred) override {
+    if (!Handles(preferred)) {
+      return builtin_->ObtainWorkingArea(preferred);
+    }
+    return ManagedWorkingArea(pool_->Get().release(), this);
+  }
+
+  void ReleaseWorkingArea(WorkingArea* area) override {
+    pool_->Put(
+        std::unique_ptr<IAAWorkingArea>(static_cast<IAAWorkingArea*>(area)));
+  }
+
+  // The compressed data keeps the header, which DecompressBlock decodes again
+  // for the block flags
+  Status ExtractUncompressedSize(Args& args) override {
+    if (!Handles(args.compression_type)) {
+      return builtin_->ExtractUncompressedSize(args);
+    }
+    if (args.compression_type == kZlibCompression) {
+      // Like the built-in decompressor, skip the size prefix
+      uint32_t length = 0;
+      if (!GetVarint32(&args.compressed_data, &length)) {
+        return Status::Corruption("size decoding error");
+      }
+      args.uncompressed_size = length;
+      return Status::OK();
+    }
+    Slice payload = args.compressed_data;
+    uint32_t length = 0;
+    uint32_t flags = 0;
+    if (!DecodeHeader(&payload, &length, &flags)) {
+      return Status::Corruption("size decoding error");
+    }
+    args.uncompressed_size = length;
+    return Status::OK();
+  }
+
+  Status DecompressBlock(const Args& args, char* uncompressed_output) override {
+    if (!Handles(args.compression_type)) {
+      return builtin_->DecompressBlock(args, uncompressed_output);
+    }
+    if (args.compression_type == kZlibCompression) {
+      return DecompressZlib(args, uncompressed_output);
+    }
+    Slice payload = args.compressed_data;
+    uint32_t length = 0;
+    uint32_t flags = 0;
+    if (!DecodeHeader(&payload, &length, &flags)) {
+      return Status::Corruption("size decoding error");
+    }
+    if (flags & ~kSupportedBlockFlags) {
+      return Status::Corruption("unsupported block flags");
+    }
+    if (flags & ~kChecksum) {
+      return Status::NotSupported(
+          "zero-compressed blocks require the Compressor build of the plugin");
+    }
+    uint32_t checksum = 0;
+    if (flags & kChecksum) {
+      if (payload.size() < sizeof(uint32_t)) {
+        return Status::Corruption("checksum decoding error");
+      }
+      checksum = DecodeFixed32(payload.data());
+      payload.remove_prefix(sizeof(uint32_t));
+    }
+    uint32_t crc = 0;
+    Status s = Inflate(args, payload, 0, uncompressed_output, length, &crc);
+    if (s.ok() && (flags & kChecksum) && crc != checksum) {
+      s = Status::Corruption("checksum mismatch");
+    }
+    return s;
+  }
+
+ private:
+  bool Handles(CompressionType type) const {
+    return type == kIAACompressionType ||
+           (type == kZlibCompression && options_.zlib_offload);
+  }
+
+  // RocksDB compresses zlib blocks as raw deflate by default (negative
+  // window_bits), or with a zlib header. Deflate windows of up to 32KB are
+  // supported. Blocks that QPL cannot decompress (zlib header with a preset
+  // dictionary, or a job that could not run) are passed to the built-in
+  // decompressor. Corrupt blocks fail with the QPL status.
+  Status DecompressZlib(const Args& args, char* uncompressed_output) {
+    const Slice& payload = args.compressed_data;
+    uint32_t mode = 0;
+    bool supported = true;
+    // zlib header: deflate method, and a check value making it a multiple of
+    // 31
+    if (payload.size() >= 2 && (payload[0] & 0x0f) == 8) {
+      uint32_t header = (static_cast<uint8_t>(payload[0]) << 8) |
+                        static_cast<uint8_t>(payload[1]);
+      if (header % 31 == 0) {
+        mode = QPL_FLAG_ZLIB_MODE;
+        supported = (header & kZlibPresetDictionary) == 0;
+      }
+    }
+    qpl_status status = QPL_STS_OK;
+    if (supported) {
+      uint32_t crc = 0;
+      Status s = Inflate(args, payload, mode, uncompressed_output,
+                         static_cast<uint32_t>(args.uncompressed_size), &crc,
+                         &status);
+      if (s.ok() || !JobNotRun(status)) {
+        return s;
+      }
+    }
+    // The working area of the call, if any, is not the built-in one
+    Args builtin_args = args;
+    builtin_args.working_area = nullptr;
+    return builtin_->DecompressBlock(builtin_args, uncompressed_output);
+  }
+
+  // Decompresses a deflate stream of exactly length bytes. status, if not
+  // null, is set to the status of the job (QPL_STS_JOB_NOT_SUBMITTED if no
+  // job struct is available).
+  Status Inflate(const Args& args, const Slice& payload, uint32_t mode,
+                 char* output, uint32_t length, uint32_t* crc,
+                 qpl_status* status = nullptr) {
+    IAAExecutor* executor = GetExecutor(options_);
+    CallArea area(pool_.get(), args.working_area != nullptr &&
+                                       args.working_area->owner() == this
+                                   ? args.working_area->get()
+                                   : nullptr);
+    qpl_job* job = area->GetJob(executor->JobPath(options_.execution_path));
+    if (job == nullptr) {
+      if (status != nullptr) {
+        *status = QPL_STS_JOB_NOT_SUBMITTED;
+      }
+      return Status::Corruption(JOB_INIT_ERROR);
+    }
+    job->next_in_ptr =
+        reinterpret_cast<uint8_t*>(const_cast<char*>(payload.data()));
+    job->available_in = static_cast<uint32_t>(payload.size());
+    job->next_out_ptr = reinterpret_cast<uint8_t*>(output);
+    job->available_out = length;
+    job->op = qpl_op_decompress;
+    job->huffman_table = nullptr;
+    job->flags = QPL_FLAG_FIRST | QPL_FLAG_LAST | mode;
+
+    qpl_status job_status =
+        ExecuteJob(executor, job, options_.execution_path);
+    if (status != nullptr) {
+      *status = job_status;
+    }
+    if (job_status != QPL_STS_OK) {
+      return Status::Corruption(QPL_STATUS(job_status));
+    }
+    if (job->total_out != length) {
+      return Status::Corruption("size mismatch");
+    }
+    *crc = job->crc;
+    return Status::OK();
+  }
+
+  static bool DecodeHeader(Slice* input, uint32_t* length, uint32_t* flags) {
+    uint64_t header = 0;
+    if (!GetVarint64(input, &header)) {
+      return false;
+    }
+    *length = static_cast<uint32_t>(header);
+    *flags = static_cast<uint32_t>(header >> 32);
+    return true;
+  }
+
+  const IAACompressionManagerOptions options_;
+  std::shared_ptr<IAAWorkingAreaPool> pool_;
+  std::shared_ptr<Decompressor> builtin_;
+};
+
+class IAACompressionManager : public CompressionManager {
+ public:
+  IAACompressionManager() : pool_(std::make_shared<IAAWorkingAreaPool>()) {
+    RegisterOptions(&options_, &iaa_compression_manager_type_info);
+  }
+
+  static const char* kClassName() {
+    return "com.intel.iaa_compression_manager";
+  }
+
+  const char* Name() const override { return kClassName(); }
+
+  const char* CompatibilityName() const override { return "IAA"; }
+
+  bool SupportsCompressionType(CompressionType type) const override {
+    return type == kIAACompressionType ||
+           GetBuiltinV2CompressionManager()->SupportsCompressionType(type);
+  }
+
+  // Compressors and decompressors copy the options when they are created
+  std::unique_ptr<Compressor> GetCompressor(const CompressionOptions& opts,
+                                            CompressionType type) override {
+    if (type == kNoCompression) {
+      return nullptr;
+    }
+    return std::unique_ptr<Compressor>(
+        new IAABlockCompressor(options_, opts.level, pool_));
+  }
+
+  std::shared_ptr<Decompressor> GetDecompressor() override {
+    return std::make_shared<IAADecompressor>(
+        options_, pool_, GetBuiltinV2CompressionManager()->GetDecompressor());
+  }
+
+ private:
+  IAACompressionManagerOptions options_;
+  std::shared_ptr<IAAWorkingAreaPool> pool_;
+};
+
+std::unique_ptr<CompressionManager> NewIAACompressionManager() {
+  return std::unique_ptr<CompressionManager>(new IAACompressionManager());
+}
+
+}  // namespace ROCKSDB_NAMESPACE
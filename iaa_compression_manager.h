@@ -0,0 +1,24 @@
+// Copyright (C) 2022 Intel Corporation
+
+// SPDX-License-Identifier: Apache-2.0
+
+#pragma once
+
+#include <rocksdb/advanced_compression.h>
+
+namespace ROCKSDB_NAMESPACE {
+
+// Compression type of the blocks compressed by the IAA compression manager
+// (the first custom compression type)
+constexpr CompressionType kIAACompressionType =
+    static_cast<CompressionType>(0x80);
+
+// CompressionManager for the Compressor/Decompressor API of RocksDB 10 and
+// later (id com.intel.iaa_compression_manager), built with
+// IAA_COMPRESSION_MANAGER instead of the Compressor of the pluggable
+// compression fork. Blocks of every compressed type are compressed with IAA
+// and use the block format of the plugin; blocks of built-in compression
+// types are decompressed by the built-in decompressor.
+std::unique_ptr<CompressionManager> NewIAACompressionManager();
+
+}  // namespace ROCKSDB_NAMESPACE
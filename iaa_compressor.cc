@@ -4,22 +4,42 @@
 
 #include "iaa_compressor.h"
 
+#include <algorithm>
 #include <atomic>
+#include <cctype>
 #include <cstddef>
 #include <cstdint>
+#include <cstdlib>
+#include <cstring>
 #include <functional>
+#include <limits>
 #include <list>
 #include <memory>
+#include <mutex>
+#include <new>
+#include <sstream>
 #include <string>
+#include <thread>
 #include <vector>
 
+#include "iaa_block_format.h"
+#include "iaa_calibration.h"
+#include "iaa_controller.h"
+#include "iaa_executor.h"
+#include "iaa_flight_recorder.h"
+#include "iaa_listener.h"
+#include "iaa_stats.h"
+#include "iaa_trace.h"
 #include "logging/logging.h"
 #include "qpl/qpl.h"
 #include "rocksdb/compressor.h"
 #include "rocksdb/configurable.h"
 #include "rocksdb/env.h"
+#include "rocksdb/perf_level.h"
 #include "rocksdb/utilities/options_type.h"
 #include "util/coding.h"
+#include "util/crc32c.h"
+#include "util/thread_local.h"
 
 namespace ROCKSDB_NAMESPACE {
 
@@ -49,6 +69,34 @@ enum qpl_compression_mode { dynamic_mode, fixed_mode };
 std::unordered_map<std::string, qpl_compression_mode> compression_modes{
     {"dynamic", dynamic_mode}, {"fixed", fixed_mode}};
 
+enum zero_compress_mode { zero_none, zero_16, zero_32, zero_auto };
+
+std::unordered_map<std::string, zero_compress_mode> zero_compress_modes{
+    {"none", zero_none},
+    {"z16", zero_16},
+    {"z32", zero_32},
+    {"auto", zero_auto}};
+
+enum integrity_mode { integrity_none, integrity_crc };
+
+std::unordered_map<std::string, integrity_mode> integrity_modes{
+    {"none", integrity_none}, {"crc", integrity_crc}};
+
+enum controller_mode { controller_none, controller_throughput };
+
+std::unordered_map<std::string, controller_mode> controller_modes{
+    {"none", controller_none}, {"throughput", controller_throughput}};
+
+enum output_buffer_mode { output_scratch, output_resize };
+
+std::unordered_map<std::string, output_buffer_mode> output_buffer_modes{
+    {"scratch", output_scratch}, {"resize", output_resize}};
+
+// Zero compression is applied to the largest prefix of the block that is a
+// multiple of this size. The remaining bytes are stored as they are after the
+// payload.
+constexpr size_t kZeroCompressAlignment = 128;
+
 struct IAACompressorOptions {
   static const char* kName() { return "IAACompressorOptions"; };
   qpl_path_t execution_path = qpl_path_auto;
@@ -56,6 +104,23 @@ struct IAACompressorOptions {
   bool verify = false;
   int level = 0;
   uint32_t parallel_threads = 1;
+  zero_compress_mode zero_compress = zero_none;
+  bool zero_compress_deflate = false;
+  integrity_mode integrity = integrity_none;
+  uint32_t verify_one_in = 0;
+  bool flight_recorder = false;
+  uint64_t flight_recorder_threshold_us = 0;
+  std::string flight_recorder_path = "/tmp/iaa_flight_recorder.txt";
+  std::shared_ptr<IAAExecutor> executor;
+  uint32_t warm_up_jobs = 0;
+  bool warm_up_async = false;
+  std::string calibration_profile;
+  controller_mode controller = controller_none;
+  uint32_t target_mbps = 100;
+  uint32_t cpu_budget_ns_per_kb = 0;
+  uint32_t controller_window_ms = 100;
+  std::string policies;
+  output_buffer_mode output_buffer = output_scratch;
 };
 
 static std::unordered_map<std::string, OptionTypeInfo>
@@ -77,16 +142,282 @@ static std::unordered_map<std::string, OptionTypeInfo>
         {"parallel_threads",
          {offsetof(struct IAACompressorOptions, parallel_threads),
           OptionType::kUInt32T, OptionVerificationType::kNormal,
-          OptionTypeFlags::kNone}}};
+          OptionTypeFlags::kNone}},
+        {"zero_compress",
+         OptionTypeInfo::Enum(
+             offsetof(struct IAACompressorOptions, zero_compress),
+             &zero_compress_modes)},
+        {"zero_compress_deflate",
+         {offsetof(struct IAACompressorOptions, zero_compress_deflate),
+          OptionType::kBoolean, OptionVerificationType::kNormal,
+          OptionTypeFlags::kNone}},
+        {"integrity",
+         OptionTypeInfo::Enum(offsetof(struct IAACompressorOptions, integrity),
+                              &integrity_modes)},
+        {"verify_one_in",
+         {offsetof(struct IAACompressorOptions, verify_one_in),
+          OptionType::kUInt32T, OptionVerificationType::kNormal,
+          OptionTypeFlags::kNone}},
+        {"flight_recorder",
+         {offsetof(struct IAACompressorOptions, flight_recorder),
+          OptionType::kBoolean, OptionVerificationType::kNormal,
+          OptionTypeFlags::kNone}},
+        {"flight_recorder_threshold_us",
+         {offsetof(struct IAACompressorOptions, flight_recorder_threshold_us),
+          OptionType::kUInt64T, OptionVerificationType::kNormal,
+          OptionTypeFlags::kNone}},
+        {"flight_recorder_path",
+         {offsetof(struct IAACompressorOptions, flight_recorder_path),
+          OptionType::kString, OptionVerificationType::kNormal,
+          OptionTypeFlags::kNone}},
+        {"executor",
+         OptionTypeInfo::AsCustomSharedPtr<IAAExecutor>(
+             offsetof(struct IAACompressorOptions, executor),
+             OptionVerificationType::kByNameAllowNull,
+             OptionTypeFlags::kAllowNull)},
+        {"warm_up_jobs",
+         {offsetof(struct IAACompressorOptions, warm_up_jobs),
+          OptionType::kUInt32T, OptionVerificationType::kNormal,
+          OptionTypeFlags::kNone}},
+        {"warm_up_async",
+         {offsetof(struct IAACompressorOptions, warm_up_async),
+          OptionType::kBoolean, OptionVerificationType::kNormal,
+          OptionTypeFlags::kNone}},
+        {"calibration_profile",
+         {offsetof(struct IAACompressorOptions, calibration_profile),
+          OptionType::kString, OptionVerificationType::kNormal,
+          OptionTypeFlags::kNone}},
+        {"controller",
+         OptionTypeInfo::Enum(offsetof(struct IAACompressorOptions, controller),
+                              &controller_modes)},
+        {"target_mbps",
+         {offsetof(struct IAACompressorOptions, target_mbps),
+          OptionType::kUInt32T, OptionVerificationType::kNormal,
+          OptionTypeFlags::kNone}},
+        {"cpu_budget_ns_per_kb",
+         {offsetof(struct IAACompressorOptions, cpu_budget_ns_per_kb),
+          OptionType::kUInt32T, OptionVerificationType::kNormal,
+          OptionTypeFlags::kNone}},
+        {"controller_window_ms",
+         {offsetof(struct IAACompressorOptions, controller_window_ms),
+          OptionType::kUInt32T, OptionVerificationType::kNormal,
+          OptionTypeFlags::kNone}},
+        {"policies",
+         {offsetof(struct IAACompressorOptions, policies), OptionType::kString,
+          OptionVerificationType::kNormal, OptionTypeFlags::kNone}},
+        {"output_buffer",
+         OptionTypeInfo::Enum(
+             offsetof(struct IAACompressorOptions, output_buffer),
+             &output_buffer_modes)}};
 
-class IAAJob {
+// Path, mode and level of the blocks compressed for a range of output levels
+struct LevelPolicy {
+  int min_level = 0;
+  int max_level = std::numeric_limits<int>::max();
+  qpl_path_t execution_path = qpl_path_auto;
+  qpl_compression_mode compression_mode = dynamic_mode;
+  int level = 0;
+};
+
+// Parses L<min>, L<min>-<max> or L<min>- (all levels from min)
+static bool ParseLevelRange(const std::string& range, LevelPolicy* policy) {
+  if (range.size() < 2 || range[0] != 'L' || !isdigit(range[1])) {
+    return false;
+  }
+  char* end = nullptr;
+  policy->min_level = static_cast<int>(strtol(range.c_str() + 1, &end, 10));
+  policy->max_level = policy->min_level;
+  if (*end == '-') {
+    if (*(end + 1) == '\0') {
+      policy->max_level = std::numeric_limits<int>::max();
+      return true;
+    }
+    if (!isdigit(*(end + 1))) {
+      return false;
+    }
+    policy->max_level = static_cast<int>(strtol(end + 1, &end, 10));
+  }
+  return *end == '\0' && policy->min_level <= policy->max_level;
+}
+
+// Parses the policies option: comma-separated entries of the form
+// <levels>:<execution_path>:<compression_mode>[:<level>]
+static Status ParsePolicies(const std::string& value,
+                            std::vector<LevelPolicy>* policies) {
+  std::stringstream entries(value);
+  std::string entry;
+  while (std::getline(entries, entry, ',')) {
+    std::vector<std::string> fields;
+    std::stringstream entry_fields(entry);
+    std::string field;
+    while (std::getline(entry_fields, field, ':')) {
+      fields.push_back(field);
+    }
+    LevelPolicy policy;
+    bool valid = (fields.size() == 3 || fields.size() == 4) &&
+                 ParseLevelRange(fields[0], &policy) &&
+                 ParseEnum(execution_paths, fields[1],
+                           &policy.execution_path) &&
+                 ParseEnum(compression_modes, fields[2],
+                           &policy.compression_mode);
+    if (valid && fields.size() == 4) {
+      char* end = nullptr;
+      policy.level = static_cast<int>(strtol(fields[3].c_str(), &end, 10));
+      valid = !fields[3].empty() && *end == '\0';
+    }
+    if (!valid) {
+      return Status::InvalidArgument("invalid compression policy", entry);
+    }
+    policies->push_back(policy);
+  }
+  return Status::OK();
+}
+
+// Output level set with SetIAAThreadOutputLevel, or -1
+thread_local int thread_output_level = -1;
+
+void SetIAAThreadOutputLevel(int level) { thread_output_level = level; }
+
+// Returns the output level of the blocks compressed by this thread, or -1 if
+// unknown: the level set for the thread, otherwise the level of the flush or
+// compaction running on it, if the output level listener is installed
+static int GetThreadOutputLevel() {
+  if (thread_output_level >= 0) {
+    return thread_output_level;
+  }
+  return GetIAAJobOutputLevel();
+}
+
+// Immutable copy of the options, and of the calibration profile they load,
+// read by calls
+struct IAAOptionsSnapshot {
+  IAACompressorOptions options;
+  bool use_profile = false;
+  IAACalibrationProfile profile;
+  // Parsed policies option, in priority order
+  std::vector<LevelPolicy> policies;
+};
+
+// Buffer that grows as needed and is reused across calls. Its contents are
+// left uninitialized, so growing it does not touch memory. A buffer grown for
+// a few large blocks is freed once kTrimInterval calls in a row needed less
+// than half of it, so that a thread does not keep it for its lifetime.
+class ScratchBuffer {
  public:
-  IAAJob() : jobs_(3, nullptr) {
-    InitJob(qpl_path_hardware);
-    InitJob(qpl_path_software);
-    InitJob(qpl_path_auto);
+  // Returns nullptr if the buffer cannot be grown to size
+  uint8_t* Get(size_t size) {
+    high_water_ = std::max(high_water_, size);
+    if (++calls_ == kTrimInterval) {
+      if (capacity_ > kMinTrimSize && high_water_ < capacity_ / 2) {
+        data_.reset();
+        capacity_ = 0;
+      }
+      calls_ = 0;
+      high_water_ = size;
+    }
+    if (capacity_ < size) {
+      data_.reset(new (std::nothrow) uint8_t[size]);
+      capacity_ = data_ ? size : 0;
+    }
+    return data_.get();
   }
 
+  void Reset() {
+    data_.reset();
+    capacity_ = 0;
+    high_water_ = 0;
+    calls_ = 0;
+  }
+
+ private:
+  static constexpr uint32_t kTrimInterval = 1024;
+  // Smaller buffers are kept: they cost little, and are needed again soon
+  static constexpr size_t kMinTrimSize = 256 << 10;
+
+  std::unique_ptr<uint8_t[]> data_;
+  size_t capacity_ = 0;
+  // Largest size requested since the last trim check
+  size_t high_water_ = 0;
+  uint32_t calls_ = 0;
+};
+
+// Statistics are exposed as a read-only option
+static std::unordered_map<std::string, OptionTypeInfo>
+    iaa_compressor_stats_type_info = {
+        {"stats",
+         {0, OptionType::kUnknown, OptionVerificationType::kNormal,
+          OptionTypeFlags::kDontSerialize | OptionTypeFlags::kCompareNever,
+          [](const ConfigOptions& /* opts */, const std::string& /* name */,
+             const std::string& /* value */, void* /* addr */) {
+            return Status::NotSupported("stats is read-only");
+          },
+          [](const ConfigOptions& /* opts */, const std::string& /* name */,
+             const void* addr, std::string* value) {
+            *value = static_cast<const IAAStats*>(addr)->ToString();
+            return Status::OK();
+          },
+          nullptr}}};
+
+// Timestamps of the QPL jobs run by one Compress or Uncompress call
+struct CallTrace {
+  void Start(uint64_t now) {
+    start = now;
+    first_submit = 0;
+    last_completion = 0;
+    last_status = QPL_STS_OK;
+    submit_nanos = 0;
+    execute_nanos = 0;
+    busy_retries = 0;
+  }
+
+  uint64_t start = 0;
+  uint64_t first_submit = 0;
+  uint64_t last_completion = 0;
+  uint64_t submit_nanos = 0;
+  uint64_t execute_nanos = 0;
+  uint64_t busy_retries = 0;
+  qpl_status last_status = QPL_STS_OK;
+  // Execution path, compression mode and level of the block being compressed
+  qpl_path_t execution_path = qpl_path_auto;
+  qpl_compression_mode compression_mode = dynamic_mode;
+  int level = 0;
+};
+
+thread_local IAAPerfContext iaa_perf_context;
+
+IAAPerfContext* GetIAAPerfContext() { return &iaa_perf_context; }
+
+void IAAPerfContext::Reset() { *this = IAAPerfContext(); }
+
+std::string IAAPerfContext::ToString() const {
+  std::string result;
+  auto append = [&result](const char* name, uint64_t value) {
+    if (!result.empty()) {
+      result.append(", ");
+    }
+    result.append(name).append(" = ").append(std::to_string(value));
+  };
+  append("compress_count", compress_count);
+  append("compress_setup_nanos", compress_setup_nanos);
+  append("compress_submit_nanos", compress_submit_nanos);
+  append("compress_execute_nanos", compress_execute_nanos);
+  append("compress_completion_nanos", compress_completion_nanos);
+  append("uncompress_count", uncompress_count);
+  append("uncompress_setup_nanos", uncompress_setup_nanos);
+  append("uncompress_submit_nanos", uncompress_submit_nanos);
+  append("uncompress_execute_nanos", uncompress_execute_nanos);
+  append("uncompress_completion_nanos", uncompress_completion_nanos);
+  append("busy_retry_count", busy_retry_count);
+  return result;
+}
+
+// QPL job structs (one per execution path: hw, sw, auto) and buffers used by
+// the calls of one thread. Each job struct is initialized on first use, so
+// that threads only open the hardware if their execution path needs it.
+class IAAJob {
+ public:
+  IAAJob() : jobs_(3, nullptr), initialized_(3, false) {}
+
   ~IAAJob() {
     for (qpl_job* job : jobs_) {
       if (job != nullptr) {
@@ -96,7 +427,31 @@ class IAAJob {
     }
   }
 
-  qpl_job* GetJob(qpl_path_t execution_path) { return jobs_[execution_path]; }
+  // Returns nullptr if the job struct cannot be initialized
+  qpl_job* GetJob(qpl_path_t execution_path) {
+    if (!initialized_[execution_path]) {
+      InitJob(execution_path);
+      initialized_[execution_path] = true;
+    }
+    return jobs_[execution_path];
+  }
+
+  CallTrace& GetTrace() { return trace_; }
+
+  // Intermediate buffer for multi-stage encodings
+  uint8_t* GetScratch(size_t size) { return scratch_.Get(size); }
+
+  // With output_buffer=scratch, compression output is written here and then
+  // copied, at its exact size, to the output string. This avoids resizing
+  // (and zero-filling) the output string to the worst-case compressed size
+  // for every block.
+  uint8_t* GetOutputBuffer(size_t size) { return output_.Get(size); }
+
+  // Frees the buffers, keeping the initialized job structs
+  void ReleaseBuffers() {
+    scratch_.Reset();
+    output_.Reset();
+  }
 
  private:
   void InitJob(qpl_path_t execution_path) {
@@ -114,17 +469,89 @@ class IAAJob {
     }
     status = qpl_init_job(execution_path, jobs_[execution_path]);
     if (status != QPL_STS_OK) {
+      delete[] reinterpret_cast<char*>(jobs_[execution_path]);
       jobs_[execution_path] = nullptr;
     }
   }
 
   std::vector<qpl_job*> jobs_;
+  std::vector<bool> initialized_;
+  ScratchBuffer scratch_;
+  ScratchBuffer output_;
+  CallTrace trace_;
+};
+
+// Jobs ready to be used by threads that have none yet. Warm-up fills it ahead
+// of the first calls, and threads return their job when they exit, so that new
+// threads do not initialize job structs (and open the hardware) on the
+// critical path of their first call.
+class IAAJobPool {
+ public:
+  static IAAJobPool& Instance() {
+    // Never destroyed, so that threads exiting late can return their job
+    static IAAJobPool* instance = new IAAJobPool();
+    return *instance;
+  }
+
+  std::unique_ptr<IAAJob> Acquire() {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      if (!jobs_.empty()) {
+        std::unique_ptr<IAAJob> job = std::move(jobs_.back());
+        jobs_.pop_back();
+        return job;
+      }
+    }
+    return std::unique_ptr<IAAJob>(new IAAJob());
+  }
+
+  // Pooled jobs keep their job structs, but not their buffers, which may have
+  // grown to several MiB for the thread that used them
+  void Release(std::unique_ptr<IAAJob> job) {
+    job->ReleaseBuffers();
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (jobs_.size() < kMaxPooledJobs) {
+      jobs_.push_back(std::move(job));
+    }
+  }
+
+ private:
+  static constexpr size_t kMaxPooledJobs = 1024;
+
+  std::mutex mutex_;
+  std::vector<std::unique_ptr<IAAJob>> jobs_;
+};
+
+// Job of the calling thread, taken from the pool on first use and returned to
+// it when the thread exits
+class ThreadJob {
+ public:
+  ~ThreadJob() {
+    if (job_ != nullptr) {
+      IAAJobPool::Instance().Release(std::move(job_));
+    }
+  }
+
+  IAAJob* operator->() {
+    if (job_ == nullptr) {
+      job_ = IAAJobPool::Instance().Acquire();
+    }
+    return job_.get();
+  }
+
+  // Exchanges the job of the thread with the given one
+  void Swap(std::unique_ptr<IAAJob>* job) { job_.swap(*job); }
+
+ private:
+  std::unique_ptr<IAAJob> job_;
 };
 
 class IAACompressor : public Compressor {
  public:
   IAACompressor() {
     RegisterOptions(&options_, &iaa_compressor_type_info);
+    RegisterOptions("IAACompressorStats", &stats_,
+                    &iaa_compressor_stats_type_info);
 
 #ifndef NDEBUG
     Status s =
@@ -133,95 +560,538 @@ class IAACompressor : public Compressor {
       logger_->SetInfoLogLevel(DEBUG_LEVEL);
     }
 #endif
+    PublishOptions().PermitUncheckedError();
   };
 
+  ~IAACompressor() override {
+    if (warm_up_thread_.joinable()) {
+      warm_up_thread_.join();
+    }
+  }
+
   static const char* kClassName() { return "com.intel.iaa_compressor_rocksdb"; }
 
   const char* Name() const override { return kClassName(); }
 
   bool DictCompressionSupported() const override { return false; }
 
+  Status PrepareOptions(const ConfigOptions& config_options) override {
+    if (options_.controller == controller_throughput &&
+        (options_.target_mbps == 0 || options_.controller_window_ms == 0)) {
+      return Status::InvalidArgument(
+          "target_mbps and controller_window_ms must be greater than 0");
+    }
+    Status s = Compressor::PrepareOptions(config_options);
+    if (s.ok()) {
+      s = PublishOptions();
+    }
+    if (!s.ok() || options_.warm_up_jobs == 0 ||
+        warmed_up_.exchange(true, std::memory_order_relaxed)) {
+      return s;
+    }
+    if (options_.warm_up_async) {
+      warm_up_thread_ =
+          std::thread([this]() { WarmUp().PermitUncheckedError(); });
+      return s;
+    }
+    return WarmUp();
+  }
+
+  void SetPressure(bool backlog) {
+    if (backlog) {
+      stats_.RecordTick(kBacklogs);
+    }
+    controller_.SetPressure(backlog ? IAAController::Pressure::kBacklog
+                                    : IAAController::Pressure::kAuto);
+  }
+
   uint32_t GetParallelThreads() const override {
-    return options_.parallel_threads;
+    SnapshotPin pin(this);
+    return Options().parallel_threads;
   };
 
   Status Compress(const CompressionInfo& /* info */, const Slice& input,
                   std::string* output) override {
-    // Max size of a RocksDB block is 4GiB
-    uint32_t output_header_length = EncodeSize(input.size(), output);
-
-    // If data is incompressible, QPL returns stored blocks
-    // A stored block is at most 2^16-1 bytes in size and it has a 5-byte header
-    // So, in the worst case, data grows by 5*ceil(input.size()/65535)
-    size_t input_length = input.size();
-    size_t output_length =
-        output_header_length + input_length +
-        (input_length / 65535 + (input_length % 65535 != 0)) * 5;
-    if (output_length > std::numeric_limits<uint32_t>::max()) {
-      // Attempt compression with largest possible buffer. QPL will return an
-      // error if not sufficient.
-      output_length = std::numeric_limits<uint32_t>::max();
+    SnapshotPin pin(this);
+    uint64_t start = NowNanos();
+    CallTrace& trace = job_->GetTrace();
+    trace.Start(start);
+    IAAController::Setting setting = SelectCompression(&trace);
+    // Thread CPU time is only read for a CPU budget of the controller
+    uint32_t cpu_budget = setting != IAAController::kNumSettings
+                              ? Options().cpu_budget_ns_per_kb
+                              : 0;
+    uint64_t cpu_start = cpu_budget > 0 ? ThreadCpuNanos() : 0;
+    IAA_TRACE3(compress_start, input.size(),
+               static_cast<int>(trace.execution_path), trace.compression_mode);
+    size_t output_offset = output->size();
+    Status s = CompressBlock(input, output);
+    uint64_t end = NowNanos();
+    IAA_TRACE5(compress_end, input.size(),
+               s.ok() ? output->size() - output_offset : 0,
+               static_cast<int>(trace.execution_path),
+               TraceStatus(s, job_->GetTrace()), end - start);
+    stats_.RecordLatency(kCompressLatency, end - start);
+    RecordFlight(FlightEvent::kCompress, input.size(),
+                 s.ok() ? output->size() - output_offset : 0, s, end - start);
+    RecordPhases(/* compress */ true, job_->GetTrace(), end);
+    stats_.RecordTick(kCompressCalls);
+    if (s.ok()) {
+      stats_.RecordTick(kCompressBytesIn, input.size());
+      stats_.RecordTick(kCompressBytesOut, output->size() - output_offset);
+      // Blocks compressed with a level policy are not the controller's
+      if (setting != IAAController::kNumSettings) {
+        // Block counters follow the order of the settings
+        stats_.RecordTick(
+            static_cast<IAATicker>(kControllerFixedBlocks + setting));
+        uint64_t cpu_nanos = cpu_budget > 0 ? ThreadCpuNanos() - cpu_start : 0;
+        controller_.Record(setting, input.size(), end - start, end,
+                           Options().target_mbps,
+                           Options().controller_window_ms * 1000000ull,
+                           cpu_nanos, cpu_budget);
+      }
+    } else {
+      stats_.RecordTick(kCompressErrors);
     }
-    output->resize(output_length);
+    return s;
+  }
 
-    qpl_status status;
-    qpl_compression_levels level = GetQplLevel(options_.level);
-    qpl_path_t execution_path = options_.execution_path;
+  Status Uncompress(const UncompressionInfo& info, const char* input,
+                    size_t input_length, char** output,
+                    size_t* output_length) override {
+    SnapshotPin pin(this);
+    uint64_t start = NowNanos();
+    job_->GetTrace().Start(start);
+    IAA_TRACE2(decompress_start, input_length,
+               static_cast<int>(Options().execution_path));
+    Status s =
+        UncompressBlock(info, input, input_length, output, output_length);
+    uint64_t end = NowNanos();
+    IAA_TRACE5(decompress_end, input_length, s.ok() ? *output_length : 0,
+               static_cast<int>(Options().execution_path),
+               TraceStatus(s, job_->GetTrace()), end - start);
+    stats_.RecordLatency(kUncompressLatency, end - start);
+    RecordFlight(FlightEvent::kUncompress, input_length,
+                 s.ok() ? *output_length : 0, s, end - start);
+    RecordPhases(/* compress */ false, job_->GetTrace(), end);
+    stats_.RecordTick(kUncompressCalls);
+    if (s.ok()) {
+      stats_.RecordTick(kUncompressBytesIn, input_length);
+      stats_.RecordTick(kUncompressBytesOut, *output_length);
+    } else {
+      stats_.RecordTick(kUncompressErrors);
+    }
+    return s;
+  }
 
-    if (level == qpl_high_level && execution_path == qpl_path_hardware) {
-      execution_path = qpl_path_software;
+  bool IsDictEnabled() const override { return false; }
+
+  std::string GetPrintableOptions() const override {
+    ConfigOptions config_options;
+    config_options.delimiter = "\n  ";
+    std::string options;
+    GetOptionString(config_options, &options).PermitUncheckedError();
+    return "  " + options + "\n  " + stats_.ToString("\n  ") + "\n";
+  }
+
+  Status Scan(const char* input, size_t input_length,
+              const IAAColumnLayout& layout, const IAAScanPredicate& predicate,
+              IAAScanOutput output_type, std::string* output,
+              uint32_t* count) {
+    SnapshotPin pin(this);
+    if (layout.bit_width == 0 || layout.bit_width > 32) {
+      return Status::InvalidArgument("bit_width must be between 1 and 32");
+    }
+    const char* payload = input;
+    size_t payload_length = input_length;
+    uint32_t uncompressed_length = 0;
+    uint32_t flags = 0;
+    if (!DecodeHeader(&payload, &payload_length, &uncompressed_length,
+                      &flags)) {
+      return Status::Corruption("size decoding error");
+    }
+    uint64_t num_values = layout.num_values;
+    if (num_values == 0) {
+      num_values = uint64_t{uncompressed_length} * 8 / layout.bit_width;
+    } else if (num_values * layout.bit_width >
+               uint64_t{uncompressed_length} * 8) {
+      return Status::InvalidArgument("layout exceeds block size");
+    }
+
+    // Only plain deflate blocks can be decompressed by analytics operations.
+    // Blocks with a checksum are uncompressed so that it can be verified.
+    std::unique_ptr<char[]> uncompressed;
+    uint32_t decompress_flag = QPL_FLAG_DECOMPRESS_ENABLE;
+    if (flags != 0) {
+      char* buf = nullptr;
+      size_t buf_length = 0;
+      UncompressionInfo info(UncompressionDict::GetEmptyDict());
+      Status s = Uncompress(info, input, input_length, &buf, &buf_length);
+      if (!s.ok()) {
+        return s;
+      }
+      uncompressed.reset(buf);
+      payload = buf;
+      payload_length = buf_length;
+      decompress_flag = 0;
     }
+    const uint8_t* source = reinterpret_cast<const uint8_t*>(payload);
 
-    qpl_job* job = job_.GetJob(execution_path);
+    // The bit vector is the result of the scan, and the mask for select
+    size_t bit_vector_length = (num_values + 7) / 8;
+    std::string bit_vector;
+    std::string* scan_output =
+        output_type == IAAScanOutput::kBitVector ? output : &bit_vector;
+    scan_output->resize(bit_vector_length);
+    Status s = RunScanJob(GetScanOperation(predicate.op), source,
+                          payload_length, decompress_flag, layout.bit_width,
+                          static_cast<uint32_t>(num_values), predicate,
+                          reinterpret_cast<uint8_t*>(&(*scan_output)[0]),
+                          bit_vector_length);
+    if (!s.ok()) {
+      return s;
+    }
+    if (output_type == IAAScanOutput::kBitVector) {
+      *count = static_cast<uint32_t>(num_values);
+      return Status::OK();
+    }
+
+    qpl_out_format out_format = qpl_ow_32;
+    size_t value_size = sizeof(uint32_t);
+    if (layout.bit_width <= 8) {
+      out_format = qpl_ow_8;
+      value_size = sizeof(uint8_t);
+    } else if (layout.bit_width <= 16) {
+      out_format = qpl_ow_16;
+      value_size = sizeof(uint16_t);
+    }
+    qpl_path_t execution_path = JobPath(/* compress */ false);
+    qpl_job* job = AcquireJob(execution_path);
     if (job == nullptr) {
       return Status::Corruption(JOB_INIT_ERROR);
     }
+    output->resize(num_values * value_size);
+    job->op = qpl_op_select;
+    job->next_in_ptr = const_cast<uint8_t*>(source);
+    job->available_in = static_cast<uint32_t>(payload_length);
+    job->next_out_ptr = reinterpret_cast<uint8_t*>(&(*output)[0]);
+    job->available_out = static_cast<uint32_t>(output->size());
+    job->flags = QPL_FLAG_FIRST | QPL_FLAG_LAST | decompress_flag;
+    job->parser = qpl_p_le_packed_array;
+    job->src1_bit_width = layout.bit_width;
+    job->num_input_elements = static_cast<uint32_t>(num_values);
+    job->next_src2_ptr = reinterpret_cast<uint8_t*>(&bit_vector[0]);
+    job->available_src2 = static_cast<uint32_t>(bit_vector_length);
+    job->src2_bit_width = 1;
+    job->out_bit_width = out_format;
+    job->initial_output_index = 0;
+    job->drop_initial_bytes = 0;
 
-    uint8_t* source =
-        const_cast<uint8_t*>(reinterpret_cast<const uint8_t*>(input.data()));
-    uint8_t* destination =
-        reinterpret_cast<uint8_t*>(&(*output)[0] + output_header_length);
+    qpl_status status = ExecuteJob(job, execution_path);
+    if (status != QPL_STS_OK) {
+      return Status::Corruption(QPL_STATUS(status));
+    }
+    output->resize(job->total_out);
+    *count = static_cast<uint32_t>(job->total_out / value_size);
+    return Status::OK();
+  }
 
-    job->next_in_ptr = source;
-    job->available_in = input.size();
-    job->next_out_ptr = destination;
-    job->available_out = output_length - output_header_length;
-    job->level = level;
-    job->op = qpl_op_compress;
-    job->flags = QPL_FLAG_FIRST | QPL_FLAG_LAST;
-    if (!options_.verify) {
-      job->flags |= QPL_FLAG_OMIT_VERIFY;
+ protected:
+  // Options changed with ConfigureFromString or ConfigureFromMap (e.g., by
+  // SetOptions) take effect once published, which PrepareOptions does unless
+  // it is not invoked
+  Status ConfigureOptions(
+      const ConfigOptions& config_options,
+      const std::unordered_map<std::string, std::string>& opts_map,
+      std::unordered_map<std::string, std::string>* unused) override {
+    Status s = Compressor::ConfigureOptions(config_options, opts_map, unused);
+    if (s.ok() && !config_options.invoke_prepare_options) {
+      s = PublishOptions();
     }
-    job->huffman_table = nullptr;
-    job->dictionary = nullptr;
+    return s;
+  }
 
-    if (options_.compression_mode == dynamic_mode) {
-      job->flags |= QPL_FLAG_DYNAMIC_HUFFMAN;
+ private:
+  // Pins the published options for a call on this thread. Calls may nest
+  // (Scan calls Uncompress): nested calls keep the snapshot of the outer one.
+  // The pinned snapshot is recorded in a slot of the thread (a hazard
+  // pointer), which PublishOptions checks before freeing a snapshot.
+  class SnapshotPin {
+   public:
+    explicit SnapshotPin(const IAACompressor* compressor)
+        : compressor_(compressor), previous_(call_snapshot_) {
+      auto pinned =
+          static_cast<const IAAOptionsSnapshot*>(compressor_->pins_.Get());
+      nested_ = pinned != nullptr;
+      if (!nested_) {
+        pinned = compressor_->snapshot_.load(std::memory_order_acquire);
+        const IAAOptionsSnapshot* published;
+        // Once the slot is visible, the snapshot cannot be freed unless it
+        // was retired before, i.e., unless it is no longer the published one
+        while (true) {
+          compressor_->pins_.Reset(const_cast<IAAOptionsSnapshot*>(pinned));
+          std::atomic_thread_fence(std::memory_order_seq_cst);
+          published = compressor_->snapshot_.load(std::memory_order_acquire);
+          if (published == pinned) {
+            break;
+          }
+          pinned = published;
+        }
+      }
+      call_snapshot_ = pinned;
     }
 
-    status = QPL_STS_QUEUES_ARE_BUSY_ERR;
-    while (status == QPL_STS_QUEUES_ARE_BUSY_ERR) {
-      status = qpl_execute_job(job);
+    ~SnapshotPin() {
+      if (!nested_) {
+        compressor_->pins_.Reset(nullptr);
+      }
+      call_snapshot_ = previous_;
     }
 
-    if (status != QPL_STS_OK) {
-      return Status::Corruption(QPL_STATUS(status));
+   private:
+    const IAACompressor* compressor_;
+    const IAAOptionsSnapshot* previous_;
+    bool nested_;
+  };
+
+  // Options set through the Configurable interface. Calls never read them:
+  // they read the snapshot published from them.
+  IAACompressorOptions options_;
+  // Latest published snapshot. Snapshots are immutable, so a call can read
+  // the one it pinned without locking while options are changed. Retired
+  // snapshots are freed by the next PublishOptions that finds them unpinned.
+  std::atomic<const IAAOptionsSnapshot*> snapshot_{nullptr};
+  // Snapshot pinned by the call in progress on each thread, if any
+  mutable ThreadLocalPtr pins_;
+  std::mutex publish_mutex_;
+  // Published snapshot, followed by the retired ones that were pinned
+  std::vector<std::unique_ptr<IAAOptionsSnapshot>> snapshots_;
+  static thread_local const IAAOptionsSnapshot* call_snapshot_;
+  static thread_local ThreadJob job_;
+  std::shared_ptr<Logger> logger_;
+  std::atomic<uint64_t> deflate_count_{0};
+  // NowNanos of the last dump triggered by flight_recorder_threshold_us
+  std::atomic<uint64_t> last_flight_dump_{0};
+  // Size of the block compressed by warm-up canaries
+  static constexpr size_t kCanarySize = 4096;
+  std::atomic<bool> warmed_up_{false};
+  std::thread warm_up_thread_;
+  IAAStats stats_;
+  IAAController controller_{&stats_};
+
+  // Sets the execution path, compression mode and level of the block being
+  // compressed: the policy of its output level if there is one, otherwise
+  // the setting chosen by the controller, if enabled, or the options. Returns
+  // the setting of the controller (kNumSettings if it is not used).
+  IAAController::Setting SelectCompression(CallTrace* trace) {
+    const IAACompressorOptions& options = Options();
+    trace->execution_path = options.execution_path;
+    const std::vector<LevelPolicy>& policies = call_snapshot_->policies;
+    if (!policies.empty()) {
+      int output_level = GetThreadOutputLevel();
+      for (const LevelPolicy& policy : policies) {
+        if (output_level >= policy.min_level &&
+            output_level <= policy.max_level) {
+          trace->execution_path = policy.execution_path;
+          trace->compression_mode = policy.compression_mode;
+          trace->level = policy.level;
+          stats_.RecordTick(kPolicyBlocks);
+          return IAAController::kNumSettings;
+        }
+      }
     }
-    output->resize(output_header_length + job->total_out);
-    Debug(logger_, "Compress - input size: %lu - output size: %u\n",
-          input.size(), job->total_out);
+    if (options.controller == controller_none) {
+      trace->compression_mode = options.compression_mode;
+      trace->level = options.level;
+      return IAAController::kNumSettings;
+    }
+    IAAController::Setting setting = controller_.Current();
+    trace->compression_mode =
+        setting == IAAController::kFixed ? fixed_mode : dynamic_mode;
+    trace->level = setting == IAAController::kHighLevel ? 1 : 0;
+    return setting;
+  }
+
+  // Options of the call in progress on this thread
+  const IAACompressorOptions& Options() const {
+    return call_snapshot_->options;
+  }
 
+  Status PublishOptions() {
+    std::lock_guard<std::mutex> lock(publish_mutex_);
+    std::unique_ptr<IAAOptionsSnapshot> snapshot(new IAAOptionsSnapshot());
+    snapshot->options = options_;
+    Status s = ParsePolicies(options_.policies, &snapshot->policies);
+    if (s.ok()) {
+      s = LoadProfile(snapshot.get());
+    }
+    if (!s.ok()) {
+      return s;
+    }
+    snapshot_.store(snapshot.get(), std::memory_order_release);
+    snapshots_.insert(snapshots_.begin(), std::move(snapshot));
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+
+    // Free the retired snapshots that no call pinned before the store above.
+    // Calls pinning later find the new snapshot.
+    std::vector<const void*> pinned;
+    pins_.Fold(
+        [](void* entry, void* res) {
+          if (entry != nullptr) {
+            static_cast<std::vector<const void*>*>(res)->push_back(entry);
+          }
+        },
+        &pinned);
+    auto retired = std::remove_if(
+        snapshots_.begin() + 1, snapshots_.end(),
+        [&pinned](const std::unique_ptr<IAAOptionsSnapshot>& entry) {
+          return std::find(pinned.begin(), pinned.end(), entry.get()) ==
+                 pinned.end();
+        });
+    snapshots_.erase(retired, snapshots_.end());
     return Status::OK();
   }
 
-  Status Uncompress(const UncompressionInfo& info, const char* input,
-                    size_t input_length, char** output,
-                    size_t* output_length) override {
-    // Extract uncompressed size
+  // The profile is read when calibration_profile is set or changed; other
+  // option changes reuse the one of the published snapshot. A missing
+  // profile (not calibrated yet) or one calibrated on a different machine
+  // configuration is ignored.
+  Status LoadProfile(IAAOptionsSnapshot* snapshot) {
+    if (snapshot->options.calibration_profile.empty()) {
+      return Status::OK();
+    }
+    if (!snapshots_.empty() &&
+        snapshots_.front()->options.calibration_profile ==
+            snapshot->options.calibration_profile) {
+      snapshot->use_profile = snapshots_.front()->use_profile;
+      snapshot->profile = snapshots_.front()->profile;
+      return Status::OK();
+    }
+    IAACalibrationProfile profile;
+    Status s = profile.Load(snapshot->options.calibration_profile);
+    if (s.IsNotFound()) {
+      Debug(logger_, "No calibration profile: %s\n", s.ToString().c_str());
+      return Status::OK();
+    } else if (!s.ok()) {
+      return s;
+    }
+    if (profile.fingerprint != GetIAAHardwareFingerprint()) {
+      Debug(logger_, "Calibration profile is for %s\n",
+            profile.fingerprint.c_str());
+      return Status::OK();
+    }
+    snapshot->profile = profile;
+    snapshot->use_profile = true;
+    return Status::OK();
+  }
+
+  // Jobs of a compression run on the path selected for the block (by a
+  // policy, or the options), and other jobs (decompression, scans) on the
+  // path of the options
+  qpl_path_t JobPath(bool compress) const {
+    return compress ? job_->GetTrace().execution_path
+                    : Options().execution_path;
+  }
+
+  // Path of deflate jobs. With a calibration profile, deflate jobs on the auto
+  // path run on the software path if they are smaller than the threshold of
+  // the profile.
+  qpl_path_t DeflatePath(size_t length, bool compress) const {
+    const IAAOptionsSnapshot& snapshot = *call_snapshot_;
+    qpl_path_t execution_path = JobPath(compress);
+    if (!snapshot.use_profile || execution_path != qpl_path_auto) {
+      return execution_path;
+    }
+    const IAACalibrationProfile& profile = snapshot.profile;
+    uint32_t threshold =
+        compress
+            ? profile.compress_hw_min_size[job_->GetTrace().compression_mode]
+            : profile.uncompress_hw_min_size;
+    return length < threshold ? qpl_path_software : qpl_path_auto;
+  }
+
+  // Creates warm_up_jobs jobs and runs a canary compression and decompression
+  // on each, which initializes the job structs of the execution path and opens
+  // the hardware. The jobs are then left in the pool
+  // for the first calls of new threads. Stops at the first failing canary,
+  // e.g., if the hardware is not available.
+  Status WarmUp() {
+    SnapshotPin pin(this);
+    for (uint32_t i = 0; i < Options().warm_up_jobs; i++) {
+      std::unique_ptr<IAAJob> job(new IAAJob());
+      // Run the canary with the new job as the job of this thread
+      job_.Swap(&job);
+      Status s = RunCanary();
+      job_.Swap(&job);
+      if (!s.ok()) {
+        stats_.RecordTick(kWarmUpErrors);
+        Debug(logger_, "Warm-up canary failed: %s\n", s.ToString().c_str());
+        return s;
+      }
+      stats_.RecordTick(kWarmUpJobs);
+      IAAJobPool::Instance().Release(std::move(job));
+    }
+    return Status::OK();
+  }
+
+  Status RunCanary() {
+    std::string block;
+    while (block.size() < kCanarySize) {
+      block.append("IAA warm-up canary " + std::to_string(block.size()) + " ");
+    }
+    block.resize(kCanarySize);
+    std::string compressed;
+    job_->GetTrace().Start(NowNanos());
+    SelectCompression(&job_->GetTrace());
+    Status s = CompressBlock(block, &compressed);
+    if (!s.ok()) {
+      return s;
+    }
+    char* uncompressed = nullptr;
+    size_t uncompressed_length = 0;
+    UncompressionInfo info(UncompressionDict::GetEmptyDict());
+    s = UncompressBlock(info, compressed.data(), compressed.size(),
+                        &uncompressed, &uncompressed_length);
+    std::unique_ptr<char[]> output(uncompressed);
+    if (s.ok() && (uncompressed_length != block.size() ||
+                   memcmp(uncompressed, block.data(), block.size()) != 0)) {
+      s = Status::Corruption("warm-up canary mismatch");
+    }
+    return s;
+  }
+
+  Status CompressBlock(const Slice& input, std::string* output) {
+    uint32_t flags = SelectZeroCompress(input);
+    if (Options().integrity == integrity_crc) {
+      flags |= kChecksum;
+    }
+    if ((flags & ~kChecksum) == 0) {
+      return CompressDeflate(input, flags, output);
+    }
+    return CompressZero(input, flags, output);
+  }
+
+  Status UncompressBlock(const UncompressionInfo& info, const char* input,
+                         size_t input_length, char** output,
+                         size_t* output_length) {
+    // Extract uncompressed size and block flags
     uint32_t encoded_output_length = 0;
-    if (!DecodeSize(&input, &input_length, &encoded_output_length)) {
+    uint32_t flags = 0;
+    if (!DecodeHeader(&input, &input_length, &encoded_output_length, &flags)) {
       return Status::Corruption("size decoding error");
     }
+    if ((flags & ~kSupportedBlockFlags) != 0) {
+      return Status::Corruption("unsupported block format");
+    }
+    uint32_t checksum = 0;
+    if (flags & kChecksum) {
+      if (input_length < sizeof(uint32_t)) {
+        return Status::Corruption("size decoding error");
+      }
+      checksum = DecodeFixed32(input);
+      input += sizeof(uint32_t);
+      input_length -= sizeof(uint32_t);
+    }
 
     // Memory allocator may return null pointer or throw bad_alloc exception
     try {
@@ -233,66 +1103,608 @@ class IAACompressor : public Compressor {
       return Status::Corruption(MEMORY_ALLOCATION_ERROR);
     }
 
-    qpl_status status;
-    qpl_job* job = job_.GetJob(options_.execution_path);
+    const uint8_t* source = reinterpret_cast<const uint8_t*>(input);
+    uint8_t* destination = reinterpret_cast<uint8_t*>(*output);
+    Status s;
+    if ((flags & ~kChecksum) == 0) {
+      uint32_t total_out = 0;
+      uint32_t crc = 0;
+      s = Inflate(source, input_length, destination, encoded_output_length,
+                  &total_out, &crc);
+      if (s.ok() && total_out != encoded_output_length) {
+        s = Status::Corruption("size mismatch");
+      }
+      if (s.ok() && (flags & kChecksum) && crc != checksum) {
+        s = Status::Corruption("checksum mismatch");
+      }
+    } else {
+      s = UncompressZero(source, input_length, flags, destination,
+                         encoded_output_length);
+      if (s.ok() && (flags & kChecksum) &&
+          crc32c::Value(*output, encoded_output_length) != checksum) {
+        s = Status::Corruption("checksum mismatch");
+      }
+    }
+    if (!s.ok()) {
+      return s;
+    }
+    *output_length = encoded_output_length;
+    Debug(logger_, "Uncompress - input size: %lu - output size: %u\n",
+          input_length, encoded_output_length);
+
+    return Status::OK();
+  }
+
+  void EncodeHeader(size_t length, uint32_t flags, std::string* output) {
+    if (flags == 0) {
+      PutVarint32(output, static_cast<uint32_t>(length));
+    } else {
+      PutVarint64(output, (static_cast<uint64_t>(flags) << 32) | length);
+    }
+  }
+
+  bool DecodeHeader(const char** input, size_t* input_length,
+                    uint32_t* output_length, uint32_t* flags) {
+    uint64_t header = 0;
+    auto new_input = GetVarint64Ptr(*input, *input + *input_length, &header);
+    if (new_input == nullptr) {
+      return false;
+    }
+    *output_length = static_cast<uint32_t>(header);
+    *flags = static_cast<uint32_t>(header >> 32);
+    *input_length -= (new_input - *input);
+    *input = new_input;
+    return true;
+  }
+
+  // If data is incompressible, QPL returns stored blocks
+  // A stored block is at most 2^16-1 bytes in size and it has a 5-byte header
+  // So, in the worst case, data grows by 5*ceil(length/65535)
+  static size_t MaxDeflateLength(size_t length) {
+    return length + (length / 65535 + (length % 65535 != 0)) * 5;
+  }
+
+  // Zero compression emits a 32-bit tag for every 32 words (16-bit) or
+  // dwords (32-bit), followed by the non-zero ones.
+  static size_t MaxZeroCompressLength(size_t length) {
+    return length + length / 16;
+  }
+
+  IAAExecutor* GetExecutor() const {
+    return Options().executor != nullptr ? Options().executor.get()
+                                        : IAAExecutor::Default();
+  }
+
+  qpl_job* AcquireJob(qpl_path_t execution_path) {
+    qpl_job* job = job_->GetJob(GetExecutor()->JobPath(execution_path));
+    IAA_TRACE2(job_acquire, static_cast<int>(execution_path),
+               static_cast<int>(job != nullptr));
+    return job;
+  }
+
+  // Runs a job to completion, resubmitting while the device queues are busy.
+  // Submission and completion are timed separately for the current call trace.
+  qpl_status ExecuteJob(qpl_job* job, qpl_path_t execution_path) {
+    stats_.RecordTick(execution_path == qpl_path_hardware ? kHardwarePathJobs
+                      : execution_path == qpl_path_software
+                          ? kSoftwarePathJobs
+                          : kAutoPathJobs);
+    CallTrace& trace = job_->GetTrace();
+    uint64_t submit = NowNanos();
+    if (trace.first_submit == 0) {
+      trace.first_submit = submit;
+    }
+    IAAExecutor* executor = GetExecutor();
+    qpl_status status = executor->Submit(job, execution_path);
+    while (status == QPL_STS_QUEUES_ARE_BUSY_ERR) {
+      stats_.RecordTick(kBusyRetries);
+      trace.busy_retries++;
+      IAA_TRACE2(busy_retry, static_cast<int>(execution_path),
+                 trace.busy_retries);
+      status = executor->Submit(job, execution_path);
+    }
+    uint64_t accepted = NowNanos();
+    if (status == QPL_STS_OK) {
+      status = executor->Wait(job, execution_path);
+    }
+    uint64_t completed = NowNanos();
+    if (execution_path == qpl_path_software) {
+      // The software path runs the job within Submit
+      trace.execute_nanos += completed - submit;
+    } else {
+      trace.submit_nanos += accepted - submit;
+      trace.execute_nanos += completed - accepted;
+    }
+    trace.last_completion = completed;
+    trace.last_status = status;
+    IAA_TRACE2(job_release, static_cast<int>(execution_path),
+               static_cast<int>(job->op));
+
+    if (status != QPL_STS_OK) {
+      stats_.RecordStatus(status);
+    }
+    return status;
+  }
+
+  static int TraceStatus(const Status& s, const CallTrace& trace) {
+    if (trace.last_status != QPL_STS_OK) {
+      return static_cast<int>(trace.last_status);
+    }
+    return s.ok() ? 0 : -1;
+  }
+
+  void RecordFlight(FlightEvent::Op op, size_t input_size, size_t output_size,
+                    const Status& s, uint64_t latency) {
+    if (!Options().flight_recorder) {
+      return;
+    }
+    FlightEvent event;
+    event.timestamp_us = Env::Default()->NowMicros();
+    event.latency_ns = latency;
+    event.input_size = static_cast<uint32_t>(input_size);
+    event.output_size = static_cast<uint32_t>(output_size);
+    event.status = TraceStatus(s, job_->GetTrace());
+    event.op = op;
+    event.path = static_cast<uint8_t>(op == FlightEvent::kCompress
+                                          ? job_->GetTrace().execution_path
+                                          : Options().execution_path);
+    event.mode = static_cast<uint8_t>(op == FlightEvent::kCompress
+                                          ? job_->GetTrace().compression_mode
+                                          : Options().compression_mode);
+    FlightRecorder::Instance().Record(event);
+
+    uint64_t threshold = Options().flight_recorder_threshold_us;
+    if (threshold == 0 || latency < threshold * 1000) {
+      return;
+    }
+    // A spike often affects many calls at once: dump at most once per second
+    uint64_t now = NowNanos();
+    uint64_t last = last_flight_dump_.load(std::memory_order_relaxed);
+    if ((last != 0 && now - last < 1000000000) ||
+        !last_flight_dump_.compare_exchange_strong(last, now,
+                                                   std::memory_order_relaxed)) {
+      return;
+    }
+    FlightRecorder::Instance().ScheduleDump(Options().flight_recorder_path);
+  }
+
+  void RecordPhases(bool compress, const CallTrace& trace, uint64_t end) {
+    uint64_t completion =
+        trace.last_completion == 0 ? 0 : end - trace.last_completion;
+    uint64_t setup = end - trace.start - trace.submit_nanos -
+                     trace.execute_nanos - completion;
+    stats_.RecordLatency(compress ? kCompressSetup : kUncompressSetup, setup);
+    stats_.RecordLatency(compress ? kCompressSubmit : kUncompressSubmit,
+                         trace.submit_nanos);
+    stats_.RecordLatency(compress ? kCompressExecute : kUncompressExecute,
+                         trace.execute_nanos);
+    stats_.RecordLatency(
+        compress ? kCompressCompletion : kUncompressCompletion, completion);
+
+    if (GetPerfLevel() < PerfLevel::kEnableTimeExceptForMutex) {
+      return;
+    }
+    IAAPerfContext* context = GetIAAPerfContext();
+    if (compress) {
+      context->compress_count++;
+      context->compress_setup_nanos += setup;
+      context->compress_submit_nanos += trace.submit_nanos;
+      context->compress_execute_nanos += trace.execute_nanos;
+      context->compress_completion_nanos += completion;
+    } else {
+      context->uncompress_count++;
+      context->uncompress_setup_nanos += setup;
+      context->uncompress_submit_nanos += trace.submit_nanos;
+      context->uncompress_execute_nanos += trace.execute_nanos;
+      context->uncompress_completion_nanos += completion;
+    }
+    context->busy_retry_count += trace.busy_retries;
+  }
+
+  Status CompressDeflate(const Slice& input, uint32_t flags,
+                         std::string* output) {
+    size_t max_length = MaxDeflateLength(input.size());
+    if (max_length > std::numeric_limits<uint32_t>::max()) {
+      // Attempt compression with largest possible buffer. QPL will return an
+      // error if not sufficient.
+      max_length = std::numeric_limits<uint32_t>::max();
+    }
+    const uint8_t* source = reinterpret_cast<const uint8_t*>(input.data());
+    uint32_t total_out = 0;
+    uint32_t crc = 0;
+    if (Options().output_buffer == output_resize) {
+      // Deflate into the output string, resized to the worst case after the
+      // header and checksum, which is filled in afterwards
+      EncodeHeader(input.size(), flags, output);
+      size_t crc_offset = output->size();
+      if (flags & kChecksum) {
+        PutFixed32(output, 0);
+      }
+      size_t offset = output->size();
+      output->resize(offset + max_length);
+      Status s = Deflate(source, input.size(),
+                         reinterpret_cast<uint8_t*>(&(*output)[offset]),
+                         max_length, &total_out, &crc);
+      if (!s.ok()) {
+        return s;
+      }
+      if (flags & kChecksum) {
+        EncodeFixed32(&(*output)[crc_offset], crc);
+      }
+      output->resize(offset + total_out);
+      Debug(logger_, "Compress - input size: %lu - output size: %u\n",
+            input.size(), total_out);
+      return Status::OK();
+    }
+
+    uint8_t* destination = job_->GetOutputBuffer(max_length);
+    if (destination == nullptr) {
+      return Status::Corruption(MEMORY_ALLOCATION_ERROR);
+    }
+    Status s = Deflate(source, input.size(), destination, max_length,
+                       &total_out, &crc);
+    if (!s.ok()) {
+      return s;
+    }
+    EncodeHeader(input.size(), flags, output);
+    if (flags & kChecksum) {
+      PutFixed32(output, crc);
+    }
+    output->append(reinterpret_cast<const char*>(destination), total_out);
+    Debug(logger_, "Compress - input size: %lu - output size: %u\n",
+          input.size(), total_out);
+
+    return Status::OK();
+  }
+
+  // Layout: header [checksum] [zero-compressed size] payload tail. The payload
+  // is the zero-compressed (and optionally deflated) aligned prefix of the
+  // block, the tail holds the remaining bytes uncompressed.
+  Status CompressZero(const Slice& input, uint32_t flags, std::string* output) {
+    size_t prefix_length =
+        input.size() - input.size() % kZeroCompressAlignment;
+    size_t tail_length = input.size() - prefix_length;
+    size_t max_zero_length = MaxZeroCompressLength(prefix_length);
+    const uint8_t* source = reinterpret_cast<const uint8_t*>(input.data());
+
+    EncodeHeader(input.size(), flags, output);
+    if (flags & kChecksum) {
+      PutFixed32(output, crc32c::Value(input.data(), input.size()));
+    }
+    uint8_t* destination;
+    uint32_t payload_length = 0;
+    Status s;
+    if ((flags & kZeroDeflate) == 0) {
+      destination = job_->GetOutputBuffer(max_zero_length);
+      if (destination == nullptr) {
+        return Status::Corruption(MEMORY_ALLOCATION_ERROR);
+      }
+      s = ZeroCompress(flags, source, prefix_length, destination,
+                       max_zero_length, &payload_length);
+      if (!s.ok()) {
+        return s;
+      }
+    } else {
+      uint8_t* scratch = job_->GetScratch(max_zero_length);
+      if (scratch == nullptr) {
+        return Status::Corruption(MEMORY_ALLOCATION_ERROR);
+      }
+      uint32_t zero_length = 0;
+      s = ZeroCompress(flags, source, prefix_length, scratch, max_zero_length,
+                       &zero_length);
+      if (!s.ok()) {
+        return s;
+      }
+      size_t max_deflate_length = MaxDeflateLength(zero_length);
+      destination = job_->GetOutputBuffer(max_deflate_length);
+      if (destination == nullptr) {
+        return Status::Corruption(MEMORY_ALLOCATION_ERROR);
+      }
+      uint32_t crc = 0;
+      s = Deflate(scratch, zero_length, destination, max_deflate_length,
+                  &payload_length, &crc);
+      if (!s.ok()) {
+        return s;
+      }
+      PutVarint32(output, zero_length);
+    }
+    output->append(reinterpret_cast<const char*>(destination), payload_length);
+    output->append(input.data() + prefix_length, tail_length);
+    Debug(logger_, "Compress (zero) - input size: %lu - output size: %lu\n",
+          input.size(), output->size());
+
+    return Status::OK();
+  }
+
+  Status UncompressZero(const uint8_t* input, size_t input_length,
+                        uint32_t flags, uint8_t* output, size_t output_length) {
+    size_t prefix_length =
+        output_length - output_length % kZeroCompressAlignment;
+    size_t tail_length = output_length - prefix_length;
+    if (input_length < tail_length) {
+      return Status::Corruption("size mismatch");
+    }
+    size_t payload_length = input_length - tail_length;
+
+    uint32_t total_out = 0;
+    Status s;
+    if ((flags & kZeroDeflate) == 0) {
+      s = ZeroUncompress(flags, input, payload_length, output, prefix_length,
+                         &total_out);
+    } else {
+      const char* payload = reinterpret_cast<const char*>(input);
+      uint32_t zero_length = 0;
+      const char* new_payload =
+          GetVarint32Ptr(payload, payload + payload_length, &zero_length);
+      if (new_payload == nullptr) {
+        return Status::Corruption("size decoding error");
+      }
+      payload_length -= new_payload - payload;
+      // Bounds the scratch buffer by what compression could have produced
+      if (zero_length > MaxZeroCompressLength(prefix_length)) {
+        return Status::Corruption("size mismatch");
+      }
+      uint8_t* scratch = job_->GetScratch(zero_length);
+      if (scratch == nullptr) {
+        return Status::Corruption(MEMORY_ALLOCATION_ERROR);
+      }
+      uint32_t inflate_length = 0;
+      uint32_t crc = 0;
+      s = Inflate(reinterpret_cast<const uint8_t*>(new_payload),
+                  payload_length, scratch, zero_length, &inflate_length, &crc);
+      if (s.ok() && inflate_length != zero_length) {
+        s = Status::Corruption("size mismatch");
+      }
+      if (s.ok()) {
+        s = ZeroUncompress(flags, scratch, zero_length, output, prefix_length,
+                           &total_out);
+      }
+    }
+    if (!s.ok()) {
+      return s;
+    }
+    if (total_out != prefix_length) {
+      return Status::Corruption("size mismatch");
+    }
+    memcpy(output + prefix_length, input + input_length - tail_length,
+           tail_length);
+    return Status::OK();
+  }
+
+  Status Deflate(const uint8_t* source, size_t source_length,
+                 uint8_t* destination, size_t destination_length,
+                 uint32_t* total_out, uint32_t* crc) {
+    CallTrace& trace = job_->GetTrace();
+    qpl_compression_levels level = GetQplLevel(trace.level);
+    qpl_path_t execution_path = DeflatePath(source_length, /* compress */ true);
+
+    if (level == qpl_high_level && execution_path == qpl_path_hardware) {
+      execution_path = qpl_path_software;
+      stats_.RecordTick(kSoftwareFallbacks);
+      IAA_TRACE2(fallback, static_cast<int>(qpl_path_hardware),
+                 static_cast<int>(qpl_path_software));
+    }
+
+    qpl_job* job = AcquireJob(execution_path);
     if (job == nullptr) {
       return Status::Corruption(JOB_INIT_ERROR);
     }
 
-    uint8_t* source =
-        const_cast<uint8_t*>(reinterpret_cast<const uint8_t*>(input));
-    uint8_t* destination = reinterpret_cast<uint8_t*>(*output);
+    job->next_in_ptr = const_cast<uint8_t*>(source);
+    job->available_in = static_cast<uint32_t>(source_length);
+    job->next_out_ptr = destination;
+    job->available_out = static_cast<uint32_t>(destination_length);
+    job->level = level;
+    job->op = qpl_op_compress;
+    job->flags = QPL_FLAG_FIRST | QPL_FLAG_LAST;
+    if (!ShouldVerify()) {
+      job->flags |= QPL_FLAG_OMIT_VERIFY;
+    }
+    job->huffman_table = nullptr;
+    job->dictionary = nullptr;
 
-    job->next_in_ptr = source;
-    job->available_in = input_length;
+    if (trace.compression_mode == dynamic_mode) {
+      job->flags |= QPL_FLAG_DYNAMIC_HUFFMAN;
+    }
+
+    qpl_status status = ExecuteJob(job, execution_path);
+    if (status != QPL_STS_OK) {
+      return Status::Corruption(QPL_STATUS(status));
+    }
+    *total_out = job->total_out;
+    *crc = job->crc;
+    return Status::OK();
+  }
+
+  Status Inflate(const uint8_t* source, size_t source_length,
+                 uint8_t* destination, size_t destination_length,
+                 uint32_t* total_out, uint32_t* crc) {
+    qpl_path_t execution_path =
+        DeflatePath(destination_length, /* compress */ false);
+    qpl_job* job = AcquireJob(execution_path);
+    if (job == nullptr) {
+      return Status::Corruption(JOB_INIT_ERROR);
+    }
+
+    job->next_in_ptr = const_cast<uint8_t*>(source);
+    job->available_in = static_cast<uint32_t>(source_length);
     job->next_out_ptr = destination;
-    job->available_out = encoded_output_length;
+    job->available_out = static_cast<uint32_t>(destination_length);
     job->op = qpl_op_decompress;
     job->huffman_table = nullptr;
     job->flags = QPL_FLAG_FIRST | QPL_FLAG_LAST;
 
-    status = QPL_STS_QUEUES_ARE_BUSY_ERR;
-    while (status == QPL_STS_QUEUES_ARE_BUSY_ERR) {
-      status = qpl_execute_job(job);
+    qpl_status status = ExecuteJob(job, execution_path);
+    if (status != QPL_STS_OK) {
+      return Status::Corruption(QPL_STATUS(status));
+    }
+    *total_out = job->total_out;
+    *crc = job->crc;
+    return Status::OK();
+  }
+
+  Status ZeroCompress(uint32_t flags, const uint8_t* source,
+                      size_t source_length, uint8_t* destination,
+                      size_t destination_length, uint32_t* total_out) {
+    return RunZeroJob(
+        (flags & kZeroCompress32) ? qpl_op_z_compress32 : qpl_op_z_compress16,
+        /* compress */ true, source, source_length, destination,
+        destination_length, total_out);
+  }
+
+  Status ZeroUncompress(uint32_t flags, const uint8_t* source,
+                        size_t source_length, uint8_t* destination,
+                        size_t destination_length, uint32_t* total_out) {
+    return RunZeroJob((flags & kZeroCompress32) ? qpl_op_z_decompress32
+                                                : qpl_op_z_decompress16,
+                      /* compress */ false, source, source_length, destination,
+                      destination_length, total_out);
+  }
+
+  Status RunZeroJob(qpl_operation op, bool compress, const uint8_t* source,
+                    size_t source_length, uint8_t* destination,
+                    size_t destination_length, uint32_t* total_out) {
+    qpl_path_t execution_path = JobPath(compress);
+    qpl_job* job = AcquireJob(execution_path);
+    if (job == nullptr) {
+      return Status::Corruption(JOB_INIT_ERROR);
     }
 
+    job->next_in_ptr = const_cast<uint8_t*>(source);
+    job->available_in = static_cast<uint32_t>(source_length);
+    job->next_out_ptr = destination;
+    job->available_out = static_cast<uint32_t>(destination_length);
+    job->op = op;
+    job->flags = QPL_FLAG_FIRST | QPL_FLAG_LAST;
+
+    qpl_status status = ExecuteJob(job, execution_path);
     if (status != QPL_STS_OK) {
       return Status::Corruption(QPL_STATUS(status));
-    } else if (job->total_out != encoded_output_length) {
-      return Status::Corruption("size mismatch");
     }
-    *output_length = job->total_out;
-    Debug(logger_, "Uncompress - input size: %lu - output size: %u\n",
-          input_length, job->total_out);
-
+    *total_out = job->total_out;
     return Status::OK();
   }
 
-  bool IsDictEnabled() const override { return false; }
+  static qpl_operation GetScanOperation(IAAScanOp op) {
+    switch (op) {
+      case IAAScanOp::kNe:
+        return qpl_op_scan_ne;
+      case IAAScanOp::kLt:
+        return qpl_op_scan_lt;
+      case IAAScanOp::kLe:
+        return qpl_op_scan_le;
+      case IAAScanOp::kGt:
+        return qpl_op_scan_gt;
+      case IAAScanOp::kGe:
+        return qpl_op_scan_ge;
+      case IAAScanOp::kRange:
+        return qpl_op_scan_range;
+      case IAAScanOp::kNotRange:
+        return qpl_op_scan_not_range;
+      default:
+        return qpl_op_scan_eq;
+    }
+  }
 
- private:
-  IAACompressorOptions options_;
-  static thread_local IAAJob job_;
-  std::shared_ptr<Logger> logger_;
+  // Runs a scan producing a bit vector (one bit per input value)
+  Status RunScanJob(qpl_operation op, const uint8_t* source,
+                    size_t source_length, uint32_t decompress_flag,
+                    uint32_t bit_width, uint32_t num_values,
+                    const IAAScanPredicate& predicate, uint8_t* destination,
+                    size_t destination_length) {
+    qpl_path_t execution_path = JobPath(/* compress */ false);
+    qpl_job* job = AcquireJob(execution_path);
+    if (job == nullptr) {
+      return Status::Corruption(JOB_INIT_ERROR);
+    }
 
-  uint32_t EncodeSize(size_t length, std::string* output) {
-    PutVarint32(output, length);
-    return output->size();
+    job->op = op;
+    job->next_in_ptr = const_cast<uint8_t*>(source);
+    job->available_in = static_cast<uint32_t>(source_length);
+    job->next_out_ptr = destination;
+    job->available_out = static_cast<uint32_t>(destination_length);
+    job->flags = QPL_FLAG_FIRST | QPL_FLAG_LAST | decompress_flag;
+    job->parser = qpl_p_le_packed_array;
+    job->src1_bit_width = bit_width;
+    job->num_input_elements = num_values;
+    job->param_low = predicate.low;
+    job->param_high = predicate.high;
+    job->out_bit_width = qpl_ow_nom;
+    job->initial_output_index = 0;
+    job->drop_initial_bytes = 0;
+
+    qpl_status status = ExecuteJob(job, execution_path);
+    if (status != QPL_STS_OK) {
+      return Status::Corruption(QPL_STATUS(status));
+    }
+    return Status::OK();
   }
 
-  bool DecodeSize(const char** input, size_t* input_length,
-                  uint32_t* output_length) {
-    auto new_input =
-        GetVarint32Ptr(*input, *input + *input_length, output_length);
-    if (new_input == nullptr) {
-      return false;
+  // Full verification runs on every block if verify is set, otherwise on one in
+  // verify_one_in blocks.
+  bool ShouldVerify() {
+    if (Options().verify) {
+      return true;
     }
-    *input_length -= (new_input - *input);
-    *input = new_input;
-    return true;
+    uint32_t one_in = Options().verify_one_in;
+    return one_in > 0 &&
+           deflate_count_.fetch_add(1, std::memory_order_relaxed) % one_in == 0;
   }
 
-  int GetLevel() const override { return options_.level; }
+  // Returns the block flags for zero compression of input, or 0 if the block
+  // should be deflated.
+  uint32_t SelectZeroCompress(const Slice& input) const {
+    if (Options().zero_compress == zero_none ||
+        input.size() < kZeroCompressAlignment ||
+        input.size() > std::numeric_limits<uint32_t>::max()) {
+      return 0;
+    }
+    uint32_t flags = 0;
+    switch (Options().zero_compress) {
+      case zero_16:
+        flags = kZeroCompress16;
+        break;
+      case zero_32:
+        flags = kZeroCompress32;
+        break;
+      default:
+        flags = DetectZeroCompress(input);
+        break;
+    }
+    if (flags != 0 && Options().zero_compress_deflate) {
+      flags |= kZeroDeflate;
+    }
+    return flags;
+  }
+
+  // Picks the zero compression width that drops at least half of the block,
+  // preferring 32-bit words.
+  static uint32_t DetectZeroCompress(const Slice& input) {
+    size_t prefix_length =
+        input.size() - input.size() % kZeroCompressAlignment;
+    size_t zero_words = 0;
+    size_t zero_dwords = 0;
+    for (size_t i = 0; i < prefix_length; i += sizeof(uint32_t)) {
+      uint16_t low;
+      uint16_t high;
+      memcpy(&low, input.data() + i, sizeof(low));
+      memcpy(&high, input.data() + i + sizeof(low), sizeof(high));
+      zero_words += (low == 0) + (high == 0);
+      zero_dwords += (low == 0 && high == 0);
+    }
+    if (zero_dwords * 2 * sizeof(uint32_t) >= prefix_length) {
+      return kZeroCompress32;
+    }
+    if (zero_words * 2 * sizeof(uint16_t) >= prefix_length) {
+      return kZeroCompress16;
+    }
+    return 0;
+  }
+
+  int GetLevel() const override {
+    SnapshotPin pin(this);
+    return Options().level;
+  }
 
   qpl_compression_levels GetQplLevel(int level) {
     if (level == 0 || level == CompressionOptions::kDefaultCompressionLevel) {
@@ -305,10 +1717,33 @@ class IAACompressor : public Compressor {
 
 // Reuse job structs across calls. Have one struct per thread and execution path
 // (hw, sw, auto).
-thread_local IAAJob IAACompressor::job_;
+thread_local ThreadJob IAACompressor::job_;
+thread_local const IAAOptionsSnapshot* IAACompressor::call_snapshot_ = nullptr;
 
 std::unique_ptr<Compressor> NewIAACompressor() {
   return std::unique_ptr<Compressor>(new IAACompressor());
 }
 
+Status UncompressAndScan(Compressor* compressor, const char* input,
+                         size_t input_length, const IAAColumnLayout& layout,
+                         const IAAScanPredicate& predicate,
+                         IAAScanOutput output_type, std::string* output,
+                         uint32_t* count) {
+  if (compressor == nullptr ||
+      !compressor->IsInstanceOf(IAACompressor::kClassName())) {
+    return Status::InvalidArgument("not an IAA compressor");
+  }
+  return static_cast<IAACompressor*>(compressor)->Scan(
+      input, input_length, layout, predicate, output_type, output, count);
+}
+
+Status SetIAACompressionPressure(Compressor* compressor, bool backlog) {
+  if (compressor == nullptr ||
+      !compressor->IsInstanceOf(IAACompressor::kClassName())) {
+    return Status::InvalidArgument("not an IAA compressor");
+  }
+  static_cast<IAACompressor*>(compressor)->SetPressure(backlog);
+  return Status::OK();
+}
+
 }  // namespace ROCKSDB_NAMESPACE
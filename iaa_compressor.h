@@ -5,8 +5,137 @@
 #pragma once
 
 #include <rocksdb/compressor.h>
+#include <rocksdb/env.h>
+#include <rocksdb/listener.h>
 
 namespace ROCKSDB_NAMESPACE {
 
 std::unique_ptr<Compressor> NewIAACompressor();
+
+// Compressor that delegates to the compressor in its "compressor" option and
+// records uncompressed blocks, with their timing, to a corpus file for
+// replay by iaa_replay_bench (id com.intel.iaa_capture_rocksdb).
+std::unique_ptr<Compressor> NewIAACaptureCompressor();
+
+// Per-thread breakdown of the time spent in Compress and Uncompress, in the
+// style of RocksDB's PerfContext. It is updated when the RocksDB perf level
+// of the thread is kEnableTimeExceptForMutex or higher.
+struct IAAPerfContext {
+  void Reset();
+  std::string ToString() const;
+
+  uint64_t compress_count = 0;
+  // Job setup, before the first submission and between jobs
+  uint64_t compress_setup_nanos = 0;
+  // Submission attempts, until the device accepts the job
+  uint64_t compress_submit_nanos = 0;
+  // Device queueing and engine time, until completion is observed
+  uint64_t compress_execute_nanos = 0;
+  // Work after the last job completes
+  uint64_t compress_completion_nanos = 0;
+  uint64_t uncompress_count = 0;
+  uint64_t uncompress_setup_nanos = 0;
+  uint64_t uncompress_submit_nanos = 0;
+  uint64_t uncompress_execute_nanos = 0;
+  uint64_t uncompress_completion_nanos = 0;
+  // Resubmissions while device queues were full
+  uint64_t busy_retry_count = 0;
+};
+
+IAAPerfContext* GetIAAPerfContext();
+
+// Flight recorder: with the flight_recorder option set, each thread keeps its
+// last 1024 Compress/Uncompress calls (time, sizes, path, mode, latency and
+// status) in memory. These functions write the events of all threads, oldest
+// first, to an info log (e.g. DBOptions::info_log) or append them to a file.
+void DumpIAAFlightRecorder(const std::shared_ptr<Logger>& logger);
+Status DumpIAAFlightRecorder(const std::string& path);
+
+// Measures Compress and Uncompress latency on the software and hardware paths
+// for a range of block sizes and both compression modes, and writes a
+// calibration profile to path. The profile holds the block sizes from which
+// the hardware path is faster, and the fingerprint of the machine
+// configuration. The calibration_profile option loads it. options are applied
+// to the compressors measured (e.g., an executor). If report is not null, a
+// table of the measured latencies is appended to it. If the hardware path
+// cannot run jobs (e.g., on hosts without IAA), a software-only profile is
+// written, with all thresholds set to IAACalibrationProfile::kNever.
+Status CalibrateIAA(const std::string& path, const std::string& options = "",
+                    uint32_t iterations = 200, std::string* report = nullptr);
+
+// Identifies the machine configuration a calibration profile is valid for:
+// CPU model, IAA devices and their enabled work queues (mode and size)
+std::string GetIAAHardwareFingerprint();
+
+// Signals a compaction backlog (e.g., a write stall) to an IAA compressor.
+// With controller=throughput, the controller moves toward speed until the
+// backlog is signaled as cleared.
+Status SetIAACompressionPressure(Compressor* compressor, bool backlog);
+
+struct IAAStallListenerOptions {
+  // Compressor options applied during a backlog, and reverted when it clears
+  // unless they were changed in the meantime
+  std::string backlog_options = "compression_mode=fixed";
+  // A backlog also starts when the pending compaction bytes of the DB reach
+  // this threshold, and clears below half of it. 0 = write stalls only.
+  uint64_t pending_compaction_bytes = 0;
+};
+
+// Creates an EventListener, to be added to DBOptions::listeners, that applies
+// backlog_options to an IAA compressor and signals the backlog to it while
+// writes are stalled (or pending compaction bytes are over the threshold)
+Status NewIAAStallListener(std::shared_ptr<Compressor> compressor,
+                           const IAAStallListenerOptions& options,
+                           std::shared_ptr<EventListener>* listener);
+
+// Creates an EventListener, to be added to DBOptions::listeners, that tracks
+// the output level of the flush or compaction running on each thread, which
+// selects the entry of the policies option that applies to its blocks
+std::shared_ptr<EventListener> NewIAAOutputLevelListener();
+
+// Sets the output level of the blocks compressed by this thread, which
+// selects the entry of the policies option that applies to them (e.g., for
+// files written with SstFileWriter to be ingested at a given level). -1, the
+// default, uses the level of the flush or compaction running on the thread,
+// as tracked by the output level listener.
+void SetIAAThreadOutputLevel(int level);
+
+// Comparison applied to each value by UncompressAndScan
+enum class IAAScanOp { kEq, kNe, kLt, kLe, kGt, kGe, kRange, kNotRange };
+
+struct IAAScanPredicate {
+  IAAScanOp op = IAAScanOp::kEq;
+  // Operand of the comparison. kRange and kNotRange match [low, high].
+  uint32_t low = 0;
+  uint32_t high = 0;
+};
+
+// Layout of a block holding a little-endian packed array of fixed-width
+// unsigned integers
+struct IAAColumnLayout {
+  // Width of each value in bits (1 to 32)
+  uint32_t bit_width = 32;
+  // Number of values in the block. If 0, it is derived from the uncompressed
+  // size of the block.
+  uint32_t num_values = 0;
+};
+
+enum class IAAScanOutput {
+  // One bit per value (least significant bit first), set if the value matches
+  kBitVector,
+  // Matching values, each stored little-endian in 1, 2 or 4 bytes depending on
+  // bit_width
+  kValues,
+};
+
+// Filters a block compressed by the IAA compressor without materializing it.
+// Decompression and filtering run as one QPL analytics operation. Blocks that
+// do not use plain deflate are uncompressed first and then filtered.
+// On success, count holds the number of values scanned (kBitVector) or
+// selected (kValues).
+Status UncompressAndScan(Compressor* compressor, const char* input,
+                         size_t input_length, const IAAColumnLayout& layout,
+                         const IAAScanPredicate& predicate,
+                         IAAScanOutput output_type, std::string* output,
+                         uint32_t* count);
 }  // namespace ROCKSDB_NAMESPACE
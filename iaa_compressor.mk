@@ -2,6 +2,18 @@
 
 # SPDX-License-Identifier: Apache-2.0
 
-iaa_compressor_SOURCES = iaa_compressor.cc
-iaa_compressor_HEADERS = iaa_compressor.h
-iaa_compressor_LDFLAGS = -lqpl -ldl -u iaa_compressor_reg
\ No newline at end of file
+ifeq ($(IAA_COMPRESSION_MANAGER),1)
+# Build against the Compressor/Decompressor API of RocksDB 10 and later
+iaa_compressor_SOURCES = iaa_compression_manager.cc iaa_memory_allocator.cc \
+                         iaa_executor.cc
+iaa_compressor_HEADERS = iaa_compression_manager.h iaa_memory_allocator.h
+iaa_compressor_LDFLAGS = -lqpl -ldl -u iaa_compression_manager_reg \
+                         -u iaa_allocator_reg
+else
+iaa_compressor_SOURCES = iaa_compressor.cc iaa_memory_allocator.cc iaa_stats.cc \
+                         iaa_flight_recorder.cc iaa_corpus.cc iaa_executor.cc \
+                         iaa_calibration.cc iaa_controller.cc iaa_listener.cc
+iaa_compressor_HEADERS = iaa_compressor.h iaa_memory_allocator.h
+iaa_compressor_LDFLAGS = -lqpl -ldl -u iaa_compressor_reg -u iaa_allocator_reg \
+                         -u iaa_capture_reg
+endif
@@ -0,0 +1,145 @@
+// Copyright (C) 2022 Intel Corporation
+
+// SPDX-License-Identifier: Apache-2.0
+
+#include "iaa_controller.h"
+
+#include <algorithm>
+
+namespace ROCKSDB_NAMESPACE {
+
+namespace {
+
+// Ids of the last windows in which the calling thread recorded a block, so
+// that each thread is counted once per window. Ids are unique across
+// controllers, so that a thread compressing for a few column families is not
+// counted again each time it switches.
+struct ThreadWindows {
+  std::array<uint64_t, 4> ids{};
+  uint32_t next = 0;
+};
+
+thread_local ThreadWindows thread_windows;
+
+std::atomic<uint64_t> next_window_id{1};
+
+}  // namespace
+
+uint64_t IAAController::NewWindowId() {
+  return next_window_id.fetch_add(1, std::memory_order_relaxed);
+}
+
+bool IAAController::FirstInWindow(uint64_t window_id) {
+  ThreadWindows& windows = thread_windows;
+  for (uint64_t id : windows.ids) {
+    if (id == window_id) {
+      return false;
+    }
+  }
+  windows.ids[windows.next] = window_id;
+  windows.next = (windows.next + 1) % windows.ids.size();
+  return true;
+}
+
+void IAAController::Record(Setting setting, uint64_t bytes, uint64_t nanos,
+                           uint64_t now, uint32_t target_mbps,
+                           uint64_t window_nanos, uint64_t cpu_nanos,
+                           uint32_t cpu_budget_ns_per_kb) {
+  bytes_[setting].fetch_add(bytes, std::memory_order_relaxed);
+  nanos_[setting].fetch_add(nanos, std::memory_order_relaxed);
+  cpu_nanos_[setting].fetch_add(cpu_nanos, std::memory_order_relaxed);
+  if (nanos > 0 &&
+      FirstInWindow(window_id_.load(std::memory_order_relaxed))) {
+    threads_.fetch_add(1, std::memory_order_relaxed);
+  }
+  uint64_t start = window_start_.load(std::memory_order_relaxed);
+  if (start == 0) {
+    window_start_.compare_exchange_strong(start, now,
+                                          std::memory_order_relaxed);
+    return;
+  }
+  if (now < start + window_nanos) {
+    return;
+  }
+  // A single thread evaluates each window
+  std::unique_lock<std::mutex> lock(mutex_, std::try_to_lock);
+  if (!lock.owns_lock()) {
+    return;
+  }
+  start = window_start_.load(std::memory_order_relaxed);
+  if (now < start + window_nanos) {
+    return;
+  }
+  window_start_.store(now, std::memory_order_relaxed);
+  window_id_.store(NewWindowId(), std::memory_order_relaxed);
+  Evaluate(now - start, target_mbps, cpu_budget_ns_per_kb);
+}
+
+void IAAController::Evaluate(uint64_t window_nanos, uint32_t target_mbps,
+                             uint32_t cpu_budget_ns_per_kb) {
+  uint64_t total_bytes = 0;
+  uint64_t total_nanos = 0;
+  uint64_t threads =
+      std::max<uint64_t>(threads_.exchange(0, std::memory_order_relaxed), 1);
+  for (uint32_t i = 0; i < kNumSettings; i++) {
+    uint64_t bytes = bytes_[i].exchange(0, std::memory_order_relaxed);
+    uint64_t nanos = nanos_[i].exchange(0, std::memory_order_relaxed);
+    uint64_t cpu_nanos = cpu_nanos_[i].exchange(0, std::memory_order_relaxed);
+    total_bytes += bytes;
+    total_nanos += nanos;
+    if (bytes > 0 && nanos > 0) {
+      double mbps = bytes * 1e3 / nanos;
+      mbps_[i] = mbps_[i] == 0 ? mbps : 0.75 * mbps_[i] + 0.25 * mbps;
+    }
+    if (bytes > 0 && cpu_nanos > 0) {
+      double cost = cpu_nanos * 1024.0 / bytes;
+      cpu_ns_per_kb_[i] = cpu_ns_per_kb_[i] == 0
+                              ? cost
+                              : 0.75 * cpu_ns_per_kb_[i] + 0.25 * cost;
+    }
+  }
+  Setting current = setting_.load(std::memory_order_relaxed);
+  if (++windows_ % kReprobeWindows == 0) {
+    for (uint32_t i = current + 1; i < kNumSettings; i++) {
+      mbps_[i] = 0;
+      cpu_ns_per_kb_[i] = 0;
+    }
+  }
+
+  Pressure pressure = pressure_.load(std::memory_order_relaxed);
+  if (pressure == Pressure::kAuto) {
+    if (total_nanos >= window_nanos * threads) {
+      pressure = Pressure::kBacklog;
+    } else if (total_bytes * 1e3 / window_nanos < target_mbps / 10.0) {
+      pressure = Pressure::kIdle;
+    }
+  }
+  auto measured = [&](uint32_t i) {
+    return cpu_budget_ns_per_kb > 0 ? cpu_ns_per_kb_[i] > 0 : mbps_[i] > 0;
+  };
+  auto meets_target = [&](uint32_t i) {
+    return cpu_budget_ns_per_kb > 0 ? cpu_ns_per_kb_[i] <= cpu_budget_ns_per_kb
+                                    : mbps_[i] >= target_mbps;
+  };
+  bool has_faster = current > kFixed;
+  bool has_better_ratio = current + 1 < kNumSettings;
+  bool slow = measured(current) && !meets_target(current);
+  bool next_fast = has_better_ratio && measured(current) &&
+                   meets_target(current) &&
+                   (!measured(current + 1) || meets_target(current + 1));
+  if (pressure == Pressure::kBacklog || (pressure != Pressure::kIdle && slow)) {
+    if (has_faster) {
+      setting_.store(static_cast<Setting>(current - 1),
+                     std::memory_order_relaxed);
+      stats_->RecordTick(kControllerToSpeed);
+    }
+  } else if (pressure == Pressure::kIdle || next_fast) {
+    if (has_better_ratio) {
+      setting_.store(static_cast<Setting>(current + 1),
+                     std::memory_order_relaxed);
+      stats_->RecordTick(kControllerToRatio);
+    }
+  }
+}
+
+}  // namespace ROCKSDB_NAMESPACE
@@ -0,0 +1,91 @@
+// Copyright (C) 2022 Intel Corporation
+
+// SPDX-License-Identifier: Apache-2.0
+
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <mutex>
+
+#include "iaa_stats.h"
+#include "rocksdb/rocksdb_namespace.h"
+
+namespace ROCKSDB_NAMESPACE {
+
+// Feedback controller choosing the compression mode and level of each block
+// to meet a compression throughput target, or a CPU budget per byte. Settings
+// are ordered from fastest to best compression ratio.
+//
+// Compress calls are aggregated over windows. At the end of a window, the
+// controller updates the measured throughput (bytes per second of Compress
+// time, i.e., per thread) and CPU cost (CPU time of the calling thread per KB)
+// of the settings used in the window, estimates the pressure and moves at
+// most one step:
+// - toward speed under backlog, or if the current setting misses the target;
+// - toward ratio when idle, or if the next setting meets the target (or has
+//   not been measured recently).
+// A setting meets the target if its throughput is at least target_mbps or,
+// with a CPU budget, if its CPU cost is within the budget. Unlike Compress
+// time, CPU time excludes waiting for the hardware.
+// Without external pressure, the window is a backlog if the threads that
+// compressed in it spent, on average, all of it compressing, and idle if the
+// input rate was below a tenth of the target.
+class IAAController {
+ public:
+  enum Setting : uint32_t { kFixed, kDynamic, kHighLevel, kNumSettings };
+  enum class Pressure { kAuto, kIdle, kBacklog };
+
+  explicit IAAController(IAAStats* stats)
+      : stats_(stats), window_id_(NewWindowId()) {}
+
+  Setting Current() const { return setting_.load(std::memory_order_relaxed); }
+
+  // Records a block compressed with the given setting in nanos (cpu_nanos of
+  // CPU time), and evaluates the window if it is over. The CPU budget applies
+  // instead of target_mbps if cpu_budget_ns_per_kb is not 0.
+  void Record(Setting setting, uint64_t bytes, uint64_t nanos, uint64_t now,
+              uint32_t target_mbps, uint64_t window_nanos,
+              uint64_t cpu_nanos = 0, uint32_t cpu_budget_ns_per_kb = 0);
+
+  // Overrides the pressure estimated from Compress calls (e.g., with write
+  // stalls reported by RocksDB), until set back to kAuto
+  void SetPressure(Pressure pressure) {
+    pressure_.store(pressure, std::memory_order_relaxed);
+  }
+
+ private:
+  // Measured throughputs of settings above the current one are forgotten
+  // after this many windows, so that they are tried again
+  static constexpr uint32_t kReprobeWindows = 64;
+
+  void Evaluate(uint64_t now, uint32_t target_mbps,
+                uint32_t cpu_budget_ns_per_kb);
+
+  static uint64_t NewWindowId();
+
+  // Returns true the first time the calling thread records a block in the
+  // given window
+  static bool FirstInWindow(uint64_t window_id);
+
+  IAAStats* stats_;
+  std::atomic<Setting> setting_{kDynamic};
+  std::atomic<Pressure> pressure_{Pressure::kAuto};
+  std::atomic<uint64_t> window_start_{0};
+  std::atomic<uint64_t> window_id_;
+  // Threads that compressed blocks in the current window
+  std::atomic<uint64_t> threads_{0};
+  std::array<std::atomic<uint64_t>, kNumSettings> bytes_{};
+  std::array<std::atomic<uint64_t>, kNumSettings> nanos_{};
+  std::array<std::atomic<uint64_t>, kNumSettings> cpu_nanos_{};
+  // Evaluation state, accessed with mutex_ held
+  std::mutex mutex_;
+  // Moving average of the throughput of each setting in MB/s, 0 if unknown
+  std::array<double, kNumSettings> mbps_{};
+  // Moving average of the CPU time of each setting in ns/KB, 0 if unknown
+  std::array<double, kNumSettings> cpu_ns_per_kb_{};
+  uint32_t windows_ = 0;
+};
+
+}  // namespace ROCKSDB_NAMESPACE
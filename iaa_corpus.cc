@@ -0,0 +1,252 @@
+// Copyright (C) 2022 Intel Corporation
+
+// SPDX-License-Identifier: Apache-2.0
+
+#include "iaa_corpus.h"
+
+#include <cstddef>
+#include <cstring>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+
+#include "iaa_compressor.h"
+#include "iaa_stats.h"
+#include "rocksdb/compressor.h"
+#include "rocksdb/configurable.h"
+#include "rocksdb/utilities/object_registry.h"
+#include "rocksdb/utilities/options_type.h"
+#include "util/coding.h"
+
+namespace ROCKSDB_NAMESPACE {
+
+CorpusWriter::~CorpusWriter() {
+  if (file_ != nullptr) {
+    fclose(file_);
+  }
+}
+
+Status CorpusWriter::Open(const std::string& path, uint64_t max_bytes) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (file_ != nullptr) {
+    return Status::OK();
+  }
+  file_ = fopen(path.c_str(), "wb");
+  if (file_ == nullptr) {
+    return Status::IOError("cannot open " + path);
+  }
+  if (fwrite(kCorpusMagic, 1, kCorpusMagicSize, file_) != kCorpusMagicSize) {
+    fclose(file_);
+    file_ = nullptr;
+    return Status::IOError("cannot write " + path);
+  }
+  max_bytes_ = max_bytes;
+  return Status::OK();
+}
+
+Status CorpusWriter::Append(CorpusRecord::Op op, const Slice& data) {
+  uint64_t now = NowNanos();
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (file_ == nullptr) {
+    return Status::InvalidArgument("corpus not open");
+  }
+  if (bytes_ + data.size() > max_bytes_) {
+    return Status::OK();
+  }
+  if (bytes_ == 0 && start_nanos_ == 0) {
+    start_nanos_ = now;
+  }
+  char header[kCorpusRecordHeaderSize];
+  EncodeFixed64(header, now - start_nanos_);
+  EncodeFixed32(header + 8, op);
+  EncodeFixed32(header + 12, static_cast<uint32_t>(data.size()));
+  if (fwrite(header, 1, sizeof(header), file_) != sizeof(header) ||
+      fwrite(data.data(), 1, data.size(), file_) != data.size()) {
+    return Status::IOError("corpus write error");
+  }
+  bytes_ += data.size();
+  return Status::OK();
+}
+
+uint64_t CorpusWriter::BytesWritten() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return bytes_;
+}
+
+Status GetCorpusWriter(const std::string& path, uint64_t max_bytes,
+                       std::shared_ptr<CorpusWriter>* writer) {
+  static std::mutex mutex;
+  static std::map<std::string, std::weak_ptr<CorpusWriter>> writers;
+  std::lock_guard<std::mutex> lock(mutex);
+  std::weak_ptr<CorpusWriter>& entry = writers[path];
+  std::shared_ptr<CorpusWriter> shared = entry.lock();
+  if (shared == nullptr) {
+    shared = std::make_shared<CorpusWriter>();
+    Status s = shared->Open(path, max_bytes);
+    if (!s.ok()) {
+      writers.erase(path);
+      return s;
+    }
+    entry = shared;
+  }
+  *writer = std::move(shared);
+  return Status::OK();
+}
+
+Status ReadCorpus(const std::string& path, std::vector<CorpusRecord>* records) {
+  std::unique_ptr<FILE, int (*)(FILE*)> file(fopen(path.c_str(), "rb"),
+                                             &fclose);
+  if (file == nullptr) {
+    return Status::IOError("cannot open " + path);
+  }
+  char magic[kCorpusMagicSize];
+  if (fread(magic, 1, sizeof(magic), file.get()) != sizeof(magic) ||
+      memcmp(magic, kCorpusMagic, kCorpusMagicSize) != 0) {
+    return Status::Corruption("not a corpus file: " + path);
+  }
+  char header[kCorpusRecordHeaderSize];
+  size_t read;
+  while ((read = fread(header, 1, sizeof(header), file.get())) ==
+         sizeof(header)) {
+    CorpusRecord record;
+    record.time_nanos = DecodeFixed64(header);
+    uint32_t op = DecodeFixed32(header + 8);
+    if (op > CorpusRecord::kUncompress) {
+      return Status::Corruption("invalid operation in corpus");
+    }
+    record.op = static_cast<CorpusRecord::Op>(op);
+    record.data.resize(DecodeFixed32(header + 12));
+    if (fread(&record.data[0], 1, record.data.size(), file.get()) !=
+        record.data.size()) {
+      return Status::Corruption("truncated corpus record");
+    }
+    records->push_back(std::move(record));
+  }
+  if (read != 0) {
+    return Status::Corruption("truncated corpus record header");
+  }
+  return Status::OK();
+}
+
+extern "C" FactoryFunc<Compressor> iaa_capture_reg;
+
+FactoryFunc<Compressor> iaa_capture_reg =
+    ObjectLibrary::Default()->AddFactory<Compressor>(
+        "com.intel.iaa_capture_rocksdb",
+        [](const std::string& /* uri */,
+           std::unique_ptr<Compressor>* compressor, std::string* /* errmsg */) {
+          *compressor = NewIAACaptureCompressor();
+          return compressor->get();
+        });
+
+struct IAACaptureCompressorOptions {
+  static const char* kName() { return "IAACaptureCompressorOptions"; };
+  std::shared_ptr<Compressor> compressor;
+  std::string corpus_path = "/tmp/iaa_corpus.bin";
+  bool capture_reads = false;
+  uint64_t max_bytes = uint64_t{1} << 30;
+};
+
+static std::unordered_map<std::string, OptionTypeInfo>
+    iaa_capture_type_info = {
+        {"compressor",
+         OptionTypeInfo::AsCustomSharedPtr<Compressor>(
+             offsetof(struct IAACaptureCompressorOptions, compressor),
+             OptionVerificationType::kByName, OptionTypeFlags::kNone)},
+        {"corpus_path",
+         {offsetof(struct IAACaptureCompressorOptions, corpus_path),
+          OptionType::kString, OptionVerificationType::kNormal,
+          OptionTypeFlags::kNone}},
+        {"capture_reads",
+         {offsetof(struct IAACaptureCompressorOptions, capture_reads),
+          OptionType::kBoolean, OptionVerificationType::kNormal,
+          OptionTypeFlags::kNone}},
+        {"max_bytes",
+         {offsetof(struct IAACaptureCompressorOptions, max_bytes),
+          OptionType::kUInt64T, OptionVerificationType::kNormal,
+          OptionTypeFlags::kNone}}};
+
+// Delegates to another compressor and records the uncompressed payload of
+// each block, with its time, to a corpus file. Blocks are stored in the format
+// of the wrapped compressor.
+class IAACaptureCompressor : public Compressor {
+ public:
+  IAACaptureCompressor() {
+    RegisterOptions(&options_, &iaa_capture_type_info);
+  }
+
+  static const char* kClassName() { return "com.intel.iaa_capture_rocksdb"; }
+
+  const char* Name() const override { return kClassName(); }
+
+  Status PrepareOptions(const ConfigOptions& config_options) override {
+    if (options_.compressor == nullptr) {
+      return Status::InvalidArgument("compressor must be set");
+    }
+    Status s = Compressor::PrepareOptions(config_options);
+    if (!s.ok()) {
+      return s;
+    }
+    // Calls in progress keep the writer they loaded
+    std::lock_guard<std::mutex> lock(writer_mutex_);
+    if (std::atomic_load(&writer_) == nullptr ||
+        writer_path_ != options_.corpus_path ||
+        writer_max_bytes_ != options_.max_bytes) {
+      std::shared_ptr<CorpusWriter> writer;
+      s = GetCorpusWriter(options_.corpus_path, options_.max_bytes, &writer);
+      if (!s.ok()) {
+        return s;
+      }
+      std::atomic_store(&writer_, writer);
+      writer_path_ = options_.corpus_path;
+      writer_max_bytes_ = options_.max_bytes;
+    }
+    return s;
+  }
+
+  uint32_t GetParallelThreads() const override {
+    return options_.compressor->GetParallelThreads();
+  }
+
+  Status Compress(const CompressionInfo& info, const Slice& input,
+                  std::string* output) override {
+    std::shared_ptr<CorpusWriter> writer = std::atomic_load(&writer_);
+    if (writer != nullptr) {
+      writer->Append(CorpusRecord::kCompress, input).PermitUncheckedError();
+    }
+    return options_.compressor->Compress(info, input, output);
+  }
+
+  Status Uncompress(const UncompressionInfo& info, const char* input,
+                    size_t input_length, char** output,
+                    size_t* output_length) override {
+    Status s = options_.compressor->Uncompress(info, input, input_length,
+                                               output, output_length);
+    if (s.ok() && options_.capture_reads) {
+      std::shared_ptr<CorpusWriter> writer = std::atomic_load(&writer_);
+      if (writer != nullptr) {
+        writer
+            ->Append(CorpusRecord::kUncompress, Slice(*output, *output_length))
+            .PermitUncheckedError();
+      }
+    }
+    return s;
+  }
+
+ private:
+  IAACaptureCompressorOptions options_;
+  // Writer of corpus_path, shared with other capture compressors writing to
+  // the same file. Set when the compressor is prepared, and replaced when
+  // corpus_path or max_bytes change. Blocks are not captured until then.
+  std::shared_ptr<CorpusWriter> writer_;
+  std::mutex writer_mutex_;
+  std::string writer_path_;
+  uint64_t writer_max_bytes_ = 0;
+};
+
+std::unique_ptr<Compressor> NewIAACaptureCompressor() {
+  return std::unique_ptr<Compressor>(new IAACaptureCompressor());
+}
+
+}  // namespace ROCKSDB_NAMESPACE
@@ -0,0 +1,67 @@
+// Copyright (C) 2022 Intel Corporation
+
+// SPDX-License-Identifier: Apache-2.0
+
+#pragma once
+
+#include <cstdint>
+#include <cstdio>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "rocksdb/rocksdb_namespace.h"
+#include "rocksdb/slice.h"
+#include "rocksdb/status.h"
+
+namespace ROCKSDB_NAMESPACE {
+
+// Corpus of uncompressed block payloads captured from a running RocksDB by
+// the capture compressor (com.intel.iaa_capture_rocksdb), for replay by
+// benchmarks.
+//
+// File format: the 8-byte magic kCorpusMagic, then one record per block:
+// fixed64 time in nanoseconds since the first record, fixed32 operation,
+// fixed32 payload length, payload.
+constexpr char kCorpusMagic[] = "IAACRP01";
+constexpr size_t kCorpusMagicSize = 8;
+constexpr size_t kCorpusRecordHeaderSize = 16;
+
+struct CorpusRecord {
+  enum Op : uint32_t { kCompress, kUncompress };
+
+  uint64_t time_nanos = 0;
+  Op op = kCompress;
+  std::string data;
+};
+
+// Appends records to a corpus file. Thread-safe.
+class CorpusWriter {
+ public:
+  ~CorpusWriter();
+
+  // Creates (or truncates) the file, unless already open. Records beyond
+  // max_bytes of payload are dropped.
+  Status Open(const std::string& path, uint64_t max_bytes);
+  Status Append(CorpusRecord::Op op, const Slice& data);
+  uint64_t BytesWritten() const;
+
+ private:
+  mutable std::mutex mutex_;
+  FILE* file_ = nullptr;
+  uint64_t max_bytes_ = 0;
+  uint64_t bytes_ = 0;
+  uint64_t start_nanos_ = 0;
+};
+
+// Returns the writer of the corpus file at path, shared by all the users of
+// the process that write to it, so that they do not truncate it or
+// interleave partial records. The first opens the file with its max_bytes;
+// the file is closed once no user holds the writer.
+Status GetCorpusWriter(const std::string& path, uint64_t max_bytes,
+                       std::shared_ptr<CorpusWriter>* writer);
+
+Status ReadCorpus(const std::string& path, std::vector<CorpusRecord>* records);
+
+}  // namespace ROCKSDB_NAMESPACE
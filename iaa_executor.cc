@@ -0,0 +1,254 @@
+// Copyright (C) 2022 Intel Corporation
+
+// SPDX-License-Identifier: Apache-2.0
+
+#include "iaa_executor.h"
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <random>
+#include <string>
+#include <thread>
+#include <unordered_map>
+
+#include "iaa_stats.h"
+#include "options/customizable_util.h"
+#include "rocksdb/utilities/object_registry.h"
+#include "rocksdb/utilities/options_type.h"
+
+namespace ROCKSDB_NAMESPACE {
+
+class QplExecutor : public IAAExecutor {
+ public:
+  static const char* kClassName() { return "qpl"; }
+
+  const char* Name() const override { return kClassName(); }
+
+  qpl_status Submit(qpl_job* job, qpl_path_t /* execution_path */) override {
+    return qpl_submit_job(job);
+  }
+
+  qpl_status Wait(qpl_job* job, qpl_path_t /* execution_path */) override {
+    return qpl_wait_job(job);
+  }
+};
+
+enum latency_distribution { latency_fixed, latency_exponential };
+
+std::unordered_map<std::string, latency_distribution> latency_distributions{
+    {"fixed", latency_fixed}, {"exponential", latency_exponential}};
+
+struct IAAEmulatorOptions {
+  static const char* kName() { return "IAAEmulatorOptions"; };
+  uint32_t devices = 1;
+  uint32_t wqs = 1;
+  uint32_t wq_depth = 32;
+  double latency_us = 0;
+  latency_distribution distribution = latency_fixed;
+  uint32_t throughput_mbps = 0;
+  uint32_t busy_one_in = 0;
+  uint32_t fault_one_in = 0;
+};
+
+static std::unordered_map<std::string, OptionTypeInfo>
+    iaa_emulator_type_info = {
+        {"devices",
+         {offsetof(struct IAAEmulatorOptions, devices), OptionType::kUInt32T,
+          OptionVerificationType::kNormal, OptionTypeFlags::kNone}},
+        {"wqs",
+         {offsetof(struct IAAEmulatorOptions, wqs), OptionType::kUInt32T,
+          OptionVerificationType::kNormal, OptionTypeFlags::kNone}},
+        {"wq_depth",
+         {offsetof(struct IAAEmulatorOptions, wq_depth), OptionType::kUInt32T,
+          OptionVerificationType::kNormal, OptionTypeFlags::kNone}},
+        {"latency_us",
+         {offsetof(struct IAAEmulatorOptions, latency_us), OptionType::kDouble,
+          OptionVerificationType::kNormal, OptionTypeFlags::kNone}},
+        {"distribution",
+         OptionTypeInfo::Enum(
+             offsetof(struct IAAEmulatorOptions, distribution),
+             &latency_distributions)},
+        {"throughput_mbps",
+         {offsetof(struct IAAEmulatorOptions, throughput_mbps),
+          OptionType::kUInt32T, OptionVerificationType::kNormal,
+          OptionTypeFlags::kNone}},
+        {"busy_one_in",
+         {offsetof(struct IAAEmulatorOptions, busy_one_in),
+          OptionType::kUInt32T, OptionVerificationType::kNormal,
+          OptionTypeFlags::kNone}},
+        {"fault_one_in",
+         {offsetof(struct IAAEmulatorOptions, fault_one_in),
+          OptionType::kUInt32T, OptionVerificationType::kNormal,
+          OptionTypeFlags::kNone}}};
+
+// Emulates the hardware path on the QPL software path. Jobs requested on the
+// hardware or auto path run on the software path, but behave as if they were
+// submitted to one of several work queues (WQs) across devices:
+// - A job occupies a slot of a WQ from submission until it completes. If all
+//   WQs are full, submission returns QPL_STS_QUEUES_ARE_BUSY_ERR. WQs are
+//   tried round-robin, starting from the one after the last WQ used.
+// - A job completes no earlier than its device time after submission:
+//   latency_us (fixed, or exponentially distributed with that mean) plus its
+//   input size at throughput_mbps.
+// - One in busy_one_in submissions is rejected as busy regardless of WQ
+//   occupancy, and one in fault_one_in jobs fails with
+//   QPL_STS_LIBRARY_INTERNAL_ERR.
+// Jobs requested on the software path run unchanged.
+class IAAEmulator : public IAAExecutor {
+ public:
+  IAAEmulator() { RegisterOptions(&options_, &iaa_emulator_type_info); }
+
+  static const char* kClassName() { return "emulator"; }
+
+  const char* Name() const override { return kClassName(); }
+
+  Status PrepareOptions(const ConfigOptions& config_options) override {
+    if (options_.devices == 0 || options_.wqs == 0 || options_.wq_depth == 0) {
+      return Status::InvalidArgument(
+          "devices, wqs and wq_depth must be greater than 0");
+    }
+    if (options_.latency_us < 0) {
+      return Status::InvalidArgument("latency_us must not be negative");
+    }
+    // Jobs in flight hold slots of the WQs, so they are only sized once
+    uint32_t num_wqs = options_.devices * options_.wqs;
+    if (in_flight_ == nullptr) {
+      in_flight_.reset(new std::atomic<uint32_t>[num_wqs]);
+      for (uint32_t i = 0; i < num_wqs; i++) {
+        in_flight_[i].store(0, std::memory_order_relaxed);
+      }
+      num_wqs_ = num_wqs;
+    } else if (num_wqs != num_wqs_) {
+      return Status::InvalidArgument(
+          "devices and wqs cannot be changed once prepared");
+    }
+    return IAAExecutor::PrepareOptions(config_options);
+  }
+
+  qpl_path_t JobPath(qpl_path_t /* execution_path */) const override {
+    return qpl_path_software;
+  }
+
+  qpl_status Submit(qpl_job* job, qpl_path_t execution_path) override {
+    if (execution_path == qpl_path_software) {
+      return qpl_submit_job(job);
+    }
+    if (in_flight_ == nullptr) {
+      // Options were not prepared
+      return QPL_STS_JOB_NOT_SUBMITTED;
+    }
+    ThreadState& state = GetThreadState();
+    if (OneIn(state, options_.busy_one_in)) {
+      return QPL_STS_QUEUES_ARE_BUSY_ERR;
+    }
+    uint64_t start = next_wq_.fetch_add(1, std::memory_order_relaxed);
+    for (uint32_t i = 0; i < num_wqs_; i++) {
+      uint32_t wq = static_cast<uint32_t>((start + i) % num_wqs_);
+      uint32_t depth = in_flight_[wq].load(std::memory_order_relaxed);
+      while (depth < options_.wq_depth) {
+        if (in_flight_[wq].compare_exchange_weak(depth, depth + 1,
+                                                 std::memory_order_acquire)) {
+          state.job = job;
+          state.wq = wq;
+          state.deadline = NowNanos() + DeviceNanos(state, job->available_in);
+          state.fault = OneIn(state, options_.fault_one_in);
+          return QPL_STS_OK;
+        }
+      }
+    }
+    return QPL_STS_QUEUES_ARE_BUSY_ERR;
+  }
+
+  qpl_status Wait(qpl_job* job, qpl_path_t execution_path) override {
+    if (execution_path == qpl_path_software) {
+      return qpl_wait_job(job);
+    }
+    ThreadState& state = GetThreadState();
+    if (state.job != job) {
+      return QPL_STS_JOB_NOT_SUBMITTED;
+    }
+    qpl_status status = qpl_execute_job(job);
+    uint64_t now = NowNanos();
+    if (now < state.deadline) {
+      std::this_thread::sleep_for(
+          std::chrono::nanoseconds(state.deadline - now));
+    }
+    in_flight_[state.wq].fetch_sub(1, std::memory_order_release);
+    state.job = nullptr;
+    if (status == QPL_STS_OK && state.fault) {
+      status = QPL_STS_LIBRARY_INTERNAL_ERR;
+    }
+    return status;
+  }
+
+ private:
+  // Job in flight of the calling thread
+  struct ThreadState {
+    std::mt19937_64 rng{std::hash<std::thread::id>()(
+        std::this_thread::get_id())};
+    qpl_job* job = nullptr;
+    uint32_t wq = 0;
+    uint64_t deadline = 0;
+    bool fault = false;
+  };
+
+  static ThreadState& GetThreadState() {
+    static thread_local ThreadState state;
+    return state;
+  }
+
+  static bool OneIn(ThreadState& state, uint32_t n) {
+    return n > 0 && state.rng() % n == 0;
+  }
+
+  uint64_t DeviceNanos(ThreadState& state, uint32_t bytes) {
+    double nanos = options_.latency_us * 1000;
+    if (options_.distribution == latency_exponential && nanos > 0) {
+      nanos = std::exponential_distribution<double>(1 / nanos)(state.rng);
+    }
+    if (options_.throughput_mbps > 0) {
+      nanos += static_cast<double>(bytes) * 1000 / options_.throughput_mbps;
+    }
+    return static_cast<uint64_t>(nanos);
+  }
+
+  IAAEmulatorOptions options_;
+  uint32_t num_wqs_ = 0;
+  std::unique_ptr<std::atomic<uint32_t>[]> in_flight_;
+  std::atomic<uint64_t> next_wq_{0};
+};
+
+static FactoryFunc<IAAExecutor> qpl_executor_reg =
+    ObjectLibrary::Default()->AddFactory<IAAExecutor>(
+        QplExecutor::kClassName(),
+        [](const std::string& /* uri */, std::unique_ptr<IAAExecutor>* executor,
+           std::string* /* errmsg */) {
+          executor->reset(new QplExecutor());
+          return executor->get();
+        });
+
+static FactoryFunc<IAAExecutor> emulator_executor_reg =
+    ObjectLibrary::Default()->AddFactory<IAAExecutor>(
+        IAAEmulator::kClassName(),
+        [](const std::string& /* uri */, std::unique_ptr<IAAExecutor>* executor,
+           std::string* /* errmsg */) {
+          executor->reset(new IAAEmulator());
+          return executor->get();
+        });
+
+Status IAAExecutor::CreateFromString(const ConfigOptions& config_options,
+                                     const std::string& value,
+                                     std::shared_ptr<IAAExecutor>* result) {
+  return LoadSharedObject<IAAExecutor>(config_options, value, result);
+}
+
+IAAExecutor* IAAExecutor::Default() {
+  static QplExecutor executor;
+  return &executor;
+}
+
+}  // namespace ROCKSDB_NAMESPACE
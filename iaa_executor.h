@@ -0,0 +1,41 @@
+// Copyright (C) 2022 Intel Corporation
+
+// SPDX-License-Identifier: Apache-2.0
+
+#pragma once
+
+#include <memory>
+#include <string>
+
+#include "qpl/qpl.h"
+#include "rocksdb/customizable.h"
+#include "rocksdb/status.h"
+
+namespace ROCKSDB_NAMESPACE {
+
+// Runs the QPL jobs of IAACompressor. The default executor passes jobs to
+// QPL. Others are selected with the "executor" option of the compressor,
+// e.g. executor={id=emulator;devices=4;wq_depth=16;latency_us=5}.
+class IAAExecutor : public Customizable {
+ public:
+  static const char* Type() { return "IAAExecutor"; }
+
+  static Status CreateFromString(const ConfigOptions& config_options,
+                                 const std::string& value,
+                                 std::shared_ptr<IAAExecutor>* result);
+
+  // Executor passing jobs to QPL
+  static IAAExecutor* Default();
+
+  // Path of the job used to run a job requested on execution_path
+  virtual qpl_path_t JobPath(qpl_path_t execution_path) const {
+    return execution_path;
+  }
+
+  // Returns QPL_STS_QUEUES_ARE_BUSY_ERR if the job cannot be accepted yet.
+  // Each thread has at most one job in flight: Submit is followed by Wait.
+  virtual qpl_status Submit(qpl_job* job, qpl_path_t execution_path) = 0;
+  virtual qpl_status Wait(qpl_job* job, qpl_path_t execution_path) = 0;
+};
+
+}  // namespace ROCKSDB_NAMESPACE
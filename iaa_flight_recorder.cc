@@ -0,0 +1,195 @@
+// Copyright (C) 2022 Intel Corporation
+
+// SPDX-License-Identifier: Apache-2.0
+
+#include "iaa_flight_recorder.h"
+
+#include <algorithm>
+#include <cinttypes>
+#include <cstdio>
+#include <ctime>
+#include <memory>
+#include <thread>
+
+#include "iaa_compressor.h"
+#include "rocksdb/env.h"
+
+namespace ROCKSDB_NAMESPACE {
+
+std::string FlightEvent::ToString() const {
+  static const char* kPaths[] = {"auto", "hw", "sw"};
+  static const char* kModes[] = {"dynamic", "fixed"};
+  time_t seconds = static_cast<time_t>(timestamp_us / 1000000);
+  struct tm time;
+  localtime_r(&seconds, &time);
+  char buf[256];
+  snprintf(buf, sizeof(buf),
+           "%04d/%02d/%02d-%02d:%02d:%02d.%06" PRIu64
+           " %s path=%s mode=%s input=%u output=%u latency_ns=%" PRIu64
+           " status=%d",
+           time.tm_year + 1900, time.tm_mon + 1, time.tm_mday, time.tm_hour,
+           time.tm_min, time.tm_sec, timestamp_us % 1000000,
+           op == kCompress ? "compress" : "uncompress",
+           path < 3 ? kPaths[path] : "unknown",
+           mode < 2 ? kModes[mode] : "unknown", input_size, output_size,
+           latency_ns, status);
+  return buf;
+}
+
+void FlightRing::Record(const FlightEvent& event) {
+  Slot& slot = slots_[next_ % kCapacity];
+  uint64_t sequence = 2 * next_ + 1;
+  slot.sequence.store(sequence, std::memory_order_relaxed);
+  std::atomic_thread_fence(std::memory_order_release);
+  slot.words[0].store(event.timestamp_us, std::memory_order_relaxed);
+  slot.words[1].store(event.latency_ns, std::memory_order_relaxed);
+  slot.words[2].store(uint64_t{event.input_size} << 32 | event.output_size,
+                      std::memory_order_relaxed);
+  slot.words[3].store(uint64_t{static_cast<uint32_t>(event.status)} << 32 |
+                          uint64_t{event.op} << 16 | uint64_t{event.path} << 8 |
+                          event.mode,
+                      std::memory_order_relaxed);
+  slot.sequence.store(sequence + 1, std::memory_order_release);
+  next_++;
+}
+
+void FlightRing::Collect(std::vector<FlightEvent>* events) const {
+  for (const Slot& slot : slots_) {
+    uint64_t before = slot.sequence.load(std::memory_order_acquire);
+    if (before == 0 || before % 2 == 1) {
+      continue;
+    }
+    uint64_t words[4];
+    for (size_t i = 0; i < 4; i++) {
+      words[i] = slot.words[i].load(std::memory_order_relaxed);
+    }
+    std::atomic_thread_fence(std::memory_order_acquire);
+    if (slot.sequence.load(std::memory_order_relaxed) != before) {
+      continue;
+    }
+    FlightEvent event;
+    event.timestamp_us = words[0];
+    event.latency_ns = words[1];
+    event.input_size = static_cast<uint32_t>(words[2] >> 32);
+    event.output_size = static_cast<uint32_t>(words[2]);
+    event.status = static_cast<int32_t>(words[3] >> 32);
+    event.op = static_cast<FlightEvent::Op>((words[3] >> 16) & 0xff);
+    event.path = static_cast<uint8_t>(words[3] >> 8);
+    event.mode = static_cast<uint8_t>(words[3]);
+    events->push_back(event);
+  }
+}
+
+// Ring of the calling thread, registered while the thread is alive
+class ThreadRing {
+ public:
+  ThreadRing() : ring_(new FlightRing()) {
+    FlightRecorder::Instance().Register(ring_.get());
+  }
+
+  ~ThreadRing() { FlightRecorder::Instance().Unregister(ring_.get()); }
+
+  FlightRing* Get() { return ring_.get(); }
+
+ private:
+  std::unique_ptr<FlightRing> ring_;
+};
+
+FlightRecorder& FlightRecorder::Instance() {
+  // Never destroyed, so that rings of threads exiting late can unregister
+  static FlightRecorder* instance = new FlightRecorder();
+  return *instance;
+}
+
+void FlightRecorder::Record(const FlightEvent& event) {
+  static thread_local ThreadRing ring;
+  ring.Get()->Record(event);
+}
+
+std::vector<FlightEvent> FlightRecorder::Collect() const {
+  std::vector<FlightEvent> events;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    for (FlightRing* ring : rings_) {
+      ring->Collect(&events);
+    }
+  }
+  std::stable_sort(events.begin(), events.end(),
+                   [](const FlightEvent& a, const FlightEvent& b) {
+                     return a.timestamp_us < b.timestamp_us;
+                   });
+  return events;
+}
+
+void FlightRecorder::Register(FlightRing* ring) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  rings_.insert(ring);
+}
+
+void FlightRecorder::Unregister(FlightRing* ring) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  rings_.erase(ring);
+}
+
+void FlightRecorder::ScheduleDump(const std::string& path) {
+  std::lock_guard<std::mutex> lock(dump_mutex_);
+  if (!dump_path_.empty()) {
+    return;
+  }
+  dump_path_ = path;
+  if (!dump_thread_started_) {
+    // Runs for the life of the process, as the recorder does
+    std::thread([this]() { DumpLoop(); }).detach();
+    dump_thread_started_ = true;
+  }
+  dump_cv_.notify_all();
+}
+
+void FlightRecorder::WaitForDumps() {
+  std::unique_lock<std::mutex> lock(dump_mutex_);
+  dump_cv_.wait(lock, [this]() { return dump_path_.empty() && !dumping_; });
+}
+
+void FlightRecorder::DumpLoop() {
+  std::unique_lock<std::mutex> lock(dump_mutex_);
+  while (true) {
+    dump_cv_.wait(lock, [this]() { return !dump_path_.empty(); });
+    std::string path;
+    path.swap(dump_path_);
+    dumping_ = true;
+    lock.unlock();
+    // Nothing to report a failure to: the file is only read after the fact
+    DumpIAAFlightRecorder(path).PermitUncheckedError();
+    lock.lock();
+    dumping_ = false;
+    dump_cv_.notify_all();
+  }
+}
+
+void DumpIAAFlightRecorder(const std::shared_ptr<Logger>& logger) {
+  std::vector<FlightEvent> events = FlightRecorder::Instance().Collect();
+  Info(logger, "IAA flight recorder: %zu events, oldest first",
+       events.size());
+  for (const FlightEvent& event : events) {
+    Info(logger, "%s", event.ToString().c_str());
+  }
+}
+
+Status DumpIAAFlightRecorder(const std::string& path) {
+  FILE* file = fopen(path.c_str(), "a");
+  if (file == nullptr) {
+    return Status::IOError("cannot open " + path);
+  }
+  std::vector<FlightEvent> events = FlightRecorder::Instance().Collect();
+  fprintf(file, "IAA flight recorder: %zu events, oldest first\n",
+          events.size());
+  for (const FlightEvent& event : events) {
+    fprintf(file, "%s\n", event.ToString().c_str());
+  }
+  if (fclose(file) != 0) {
+    return Status::IOError("cannot write " + path);
+  }
+  return Status::OK();
+}
+
+}  // namespace ROCKSDB_NAMESPACE
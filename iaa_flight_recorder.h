@@ -0,0 +1,93 @@
+// Copyright (C) 2022 Intel Corporation
+
+// SPDX-License-Identifier: Apache-2.0
+
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <unordered_set>
+#include <vector>
+
+#include "rocksdb/rocksdb_namespace.h"
+
+namespace ROCKSDB_NAMESPACE {
+
+struct FlightEvent {
+  enum Op : uint8_t { kCompress, kUncompress };
+
+  uint64_t timestamp_us = 0;  // Wall clock, at the end of the call
+  uint64_t latency_ns = 0;
+  uint32_t input_size = 0;
+  uint32_t output_size = 0;
+  int32_t status = 0;  // As in the USDT probes
+  Op op = kCompress;
+  uint8_t path = 0;
+  uint8_t mode = 0;
+
+  std::string ToString() const;
+};
+
+// Ring buffer with the last kCapacity events of one thread. Only the owning
+// thread writes to it; other threads read it without locking (a seqlock per
+// slot discards slots being overwritten).
+class FlightRing {
+ public:
+  static constexpr size_t kCapacity = 1024;
+
+  void Record(const FlightEvent& event);
+  void Collect(std::vector<FlightEvent>* events) const;
+
+ private:
+  struct Slot {
+    // Odd while being written, 0 if never written
+    std::atomic<uint64_t> sequence{0};
+    std::array<std::atomic<uint64_t>, 4> words{};
+  };
+
+  uint64_t next_ = 0;
+  std::array<Slot, kCapacity> slots_;
+};
+
+// Low-overhead record of recent Compress/Uncompress calls for post-mortem
+// analysis of latency spikes. Each thread records into its own ring buffer,
+// allocated on first use and dropped when the thread exits.
+class FlightRecorder {
+ public:
+  static FlightRecorder& Instance();
+
+  void Record(const FlightEvent& event);
+
+  // Events of all threads, oldest first
+  std::vector<FlightEvent> Collect() const;
+
+  // Appends the events of all threads to path on a background thread, so
+  // that the calling thread does no I/O. A request made while a dump is
+  // pending is dropped.
+  void ScheduleDump(const std::string& path);
+  // Waits until scheduled dumps are written
+  void WaitForDumps();
+
+ private:
+  friend class ThreadRing;
+
+  void Register(FlightRing* ring);
+  void Unregister(FlightRing* ring);
+  void DumpLoop();
+
+  mutable std::mutex mutex_;
+  std::unordered_set<FlightRing*> rings_;
+
+  std::mutex dump_mutex_;
+  std::condition_variable dump_cv_;
+  // Path of the pending dump, empty if none
+  std::string dump_path_;
+  bool dumping_ = false;
+  bool dump_thread_started_ = false;
+};
+
+}  // namespace ROCKSDB_NAMESPACE
@@ -0,0 +1,209 @@
+// Copyright (C) 2022 Intel Corporation
+
+// SPDX-License-Identifier: Apache-2.0
+
+#include "iaa_listener.h"
+
+#include <mutex>
+#include <set>
+
+#include "iaa_compressor.h"
+#include "rocksdb/convenience.h"
+#include "rocksdb/db.h"
+#include "rocksdb/listener.h"
+
+namespace ROCKSDB_NAMESPACE {
+
+// Switches an IAA compressor to backlog_options while any column family has
+// a write stall or pending compaction bytes are over the threshold, and back
+// to its previous options once the backlog clears
+class IAAStallListener : public EventListener {
+ public:
+  IAAStallListener(std::shared_ptr<Compressor> compressor,
+                   const IAAStallListenerOptions& options,
+                   std::unordered_map<std::string, std::string> backlog_map)
+      : compressor_(std::move(compressor)),
+        options_(options),
+        backlog_map_(std::move(backlog_map)) {}
+
+  static const char* kClassName() { return "com.intel.iaa_stall_listener"; }
+
+  const char* Name() const override { return kClassName(); }
+
+  void OnStallConditionsChanged(const WriteStallInfo& info) override {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (info.condition.cur == WriteStallCondition::kNormal) {
+      stalled_.erase(info.cf_name);
+    } else {
+      stalled_.insert(info.cf_name);
+    }
+    Update();
+  }
+
+  // Pending compaction bytes change when flushes and compactions complete
+  void OnFlushCompleted(DB* db, const FlushJobInfo& /* info */) override {
+    CheckPendingBytes(db);
+  }
+
+  void OnCompactionCompleted(DB* db,
+                             const CompactionJobInfo& /* info */) override {
+    CheckPendingBytes(db);
+  }
+
+ private:
+  void CheckPendingBytes(DB* db) {
+    uint64_t pending = 0;
+    if (options_.pending_compaction_bytes == 0 ||
+        !db->GetAggregatedIntProperty(
+            DB::Properties::kEstimatePendingCompactionBytes, &pending)) {
+      return;
+    }
+    std::lock_guard<std::mutex> lock(mutex_);
+    // The backlog clears at half the threshold, so that the compressor does
+    // not switch back and forth around it
+    if (pending >= options_.pending_compaction_bytes) {
+      pending_backlog_ = true;
+    } else if (pending < options_.pending_compaction_bytes / 2) {
+      pending_backlog_ = false;
+    }
+    Update();
+  }
+
+  // Applies or reverts backlog_options when the backlog state changes. Only
+  // the options of backlog_options are saved and restored, and an option
+  // changed since the backlog started (e.g., with SetOptions) keeps its new
+  // value. Called with mutex_ held.
+  void Update() {
+    bool backlog = !stalled_.empty() || pending_backlog_;
+    if (backlog == backlog_) {
+      return;
+    }
+    backlog_ = backlog;
+    ConfigOptions config_options;
+    Status s;
+    if (backlog) {
+      saved_.clear();
+      applied_.clear();
+      s = GetOptions(config_options, &saved_);
+      if (s.ok()) {
+        s = compressor_->ConfigureFromMap(config_options, backlog_map_);
+      }
+      // Values as the compressor reports them, to compare with on restore
+      if (s.ok()) {
+        s = GetOptions(config_options, &applied_);
+      }
+      if (!s.ok()) {
+        // Options are left unchanged: there is nothing to revert
+        saved_.clear();
+      }
+    } else if (!saved_.empty()) {
+      std::unordered_map<std::string, std::string> current;
+      s = GetOptions(config_options, &current);
+      std::unordered_map<std::string, std::string> restore;
+      for (const auto& option : saved_) {
+        if (s.ok() && current[option.first] == applied_[option.first]) {
+          restore.insert(option);
+        }
+      }
+      if (!restore.empty()) {
+        s = compressor_->ConfigureFromMap(config_options, restore);
+      }
+      saved_.clear();
+    }
+    s.PermitUncheckedError();
+    SetIAACompressionPressure(compressor_.get(), backlog)
+        .PermitUncheckedError();
+  }
+
+  // Gets the current values of the options in backlog_map_
+  Status GetOptions(const ConfigOptions& config_options,
+                    std::unordered_map<std::string, std::string>* values) {
+    for (const auto& option : backlog_map_) {
+      std::string value;
+      Status s = compressor_->GetOption(config_options, option.first, &value);
+      if (!s.ok()) {
+        return s;
+      }
+      (*values)[option.first] = value;
+    }
+    return Status::OK();
+  }
+
+  std::shared_ptr<Compressor> compressor_;
+  const IAAStallListenerOptions options_;
+  const std::unordered_map<std::string, std::string> backlog_map_;
+  std::mutex mutex_;
+  // Column families with a write stall (delayed or stopped writes)
+  std::set<std::string> stalled_;
+  bool pending_backlog_ = false;
+  bool backlog_ = false;
+  // Values of the options in backlog_map_ before the backlog
+  std::unordered_map<std::string, std::string> saved_;
+  // Values of the options in backlog_map_ once backlog_options was applied
+  std::unordered_map<std::string, std::string> applied_;
+};
+
+// Output level of the job running on this thread, set by
+// IAAOutputLevelListener
+thread_local int job_output_level = -1;
+
+int GetIAAJobOutputLevel() { return job_output_level; }
+
+// Records the output level of each flush and compaction on the thread that
+// runs it, for the policies option. RocksDB notifies listeners of the start
+// and completion of a job on the thread running it.
+class IAAOutputLevelListener : public EventListener {
+ public:
+  static const char* kClassName() {
+    return "com.intel.iaa_output_level_listener";
+  }
+
+  const char* Name() const override { return kClassName(); }
+
+  void OnFlushBegin(DB* /* db */, const FlushJobInfo& /* info */) override {
+    job_output_level = 0;
+  }
+
+  void OnFlushCompleted(DB* /* db */, const FlushJobInfo& /* info */) override {
+    job_output_level = -1;
+  }
+
+  void OnCompactionBegin(DB* /* db */, const CompactionJobInfo& info) override {
+    job_output_level = info.output_level;
+  }
+
+  void OnCompactionCompleted(DB* /* db */,
+                             const CompactionJobInfo& /* info */) override {
+    job_output_level = -1;
+  }
+};
+
+std::shared_ptr<EventListener> NewIAAOutputLevelListener() {
+  return std::make_shared<IAAOutputLevelListener>();
+}
+
+Status NewIAAStallListener(std::shared_ptr<Compressor> compressor,
+                           const IAAStallListenerOptions& options,
+                           std::shared_ptr<EventListener>* listener) {
+  std::unordered_map<std::string, std::string> backlog_map;
+  Status s = StringToMap(options.backlog_options, &backlog_map);
+  if (!s.ok()) {
+    return s;
+  }
+  // Check that the compressor is an IAA compressor with these options
+  s = SetIAACompressionPressure(compressor.get(), false);
+  ConfigOptions config_options;
+  for (auto it = backlog_map.begin(); s.ok() && it != backlog_map.end();
+       ++it) {
+    std::string value;
+    s = compressor->GetOption(config_options, it->first, &value);
+  }
+  if (!s.ok()) {
+    return s;
+  }
+  listener->reset(
+      new IAAStallListener(std::move(compressor), options, backlog_map));
+  return Status::OK();
+}
+
+}  // namespace ROCKSDB_NAMESPACE
@@ -0,0 +1,15 @@
+// Copyright (C) 2022 Intel Corporation
+
+// SPDX-License-Identifier: Apache-2.0
+
+#pragma once
+
+#include "rocksdb/rocksdb_namespace.h"
+
+namespace ROCKSDB_NAMESPACE {
+
+// Output level of the flush or compaction that the output level listener
+// (NewIAAOutputLevelListener) saw start on this thread, or -1
+int GetIAAJobOutputLevel();
+
+}  // namespace ROCKSDB_NAMESPACE
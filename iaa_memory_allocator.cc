@@ -0,0 +1,558 @@
+// Copyright (C) 2022 Intel Corporation
+
+// SPDX-License-Identifier: Apache-2.0
+
+#include "iaa_memory_allocator.h"
+
+#include <linux/mempolicy.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "rocksdb/configurable.h"
+#include "rocksdb/utilities/object_registry.h"
+#include "rocksdb/utilities/options_type.h"
+#include "util/thread_local.h"
+
+namespace ROCKSDB_NAMESPACE {
+
+extern "C" FactoryFunc<MemoryAllocator> iaa_allocator_reg;
+
+FactoryFunc<MemoryAllocator> iaa_allocator_reg =
+    ObjectLibrary::Default()->AddFactory<MemoryAllocator>(
+        "com.intel.iaa_allocator_rocksdb",
+        [](const std::string& /* uri */,
+           std::unique_ptr<MemoryAllocator>* allocator,
+           std::string* /* errmsg */) {
+          *allocator = NewIAAMemoryAllocator();
+          return allocator->get();
+        });
+
+struct IAAMemoryAllocatorOptions {
+  static const char* kName() { return "IAAMemoryAllocatorOptions"; };
+  size_t arena_size = 64 << 20;
+  bool huge_pages = true;
+  bool prefault = true;
+  bool numa_local = true;
+};
+
+static std::unordered_map<std::string, OptionTypeInfo>
+    iaa_allocator_type_info = {
+        {"arena_size",
+         {offsetof(struct IAAMemoryAllocatorOptions, arena_size),
+          OptionType::kSizeT, OptionVerificationType::kNormal,
+          OptionTypeFlags::kNone}},
+        {"huge_pages",
+         {offsetof(struct IAAMemoryAllocatorOptions, huge_pages),
+          OptionType::kBoolean, OptionVerificationType::kNormal,
+          OptionTypeFlags::kNone}},
+        {"prefault",
+         {offsetof(struct IAAMemoryAllocatorOptions, prefault),
+          OptionType::kBoolean, OptionVerificationType::kNormal,
+          OptionTypeFlags::kNone}},
+        {"numa_local",
+         {offsetof(struct IAAMemoryAllocatorOptions, numa_local),
+          OptionType::kBoolean, OptionVerificationType::kNormal,
+          OptionTypeFlags::kNone}}};
+
+// Every allocation is preceded by a header recording where it came from. Its
+// size keeps allocations aligned to cache lines.
+struct AllocationHeader {
+  uint32_t size_class;
+  uint32_t node;
+  size_t mapping_length;  // Only for allocations larger than any size class
+};
+
+constexpr size_t kHeaderSize = 64;
+static_assert(sizeof(AllocationHeader) <= kHeaderSize, "header too large");
+
+// Size classes go from 1KiB to 4MiB (header included), in 4 steps per power
+// of two, so that a block wastes less than a quarter of its size, e.g., the
+// header of a 4KiB allocation only adds a 5KiB class
+constexpr size_t kMinClassShift = 10;
+constexpr size_t kClassSteps = 4;
+constexpr size_t kClassStepShift = 2;
+constexpr size_t kNumClasses = 12 * kClassSteps + 1;
+constexpr uint32_t kLargeClass = kNumClasses;
+
+constexpr size_t kHugePageSize = 2 << 20;
+constexpr size_t kPageSize = 4096;
+constexpr uint32_t kMaxNodes = 64;
+
+// Threads cache freed blocks of the size classes up to 64KiB, at most
+// kThreadCacheClassBytes per class, and exchange them with the free lists of
+// the node in batches of half of that
+constexpr uint32_t kNumCachedClasses = 6 * kClassSteps + 1;
+constexpr size_t kThreadCacheClassBytes = 128 << 10;
+
+// Freed mappings of large allocations kept for reuse
+constexpr size_t kMaxCachedMappings = 4;
+
+class IAAMemoryAllocator : public MemoryAllocator {
+ public:
+  IAAMemoryAllocator() : caches_(new ThreadLocalPtr(&ReleaseThreadCache)) {
+    RegisterOptions(&options_, &iaa_allocator_type_info);
+  }
+
+  ~IAAMemoryAllocator() override {
+    // Returns the blocks cached by threads to the arenas before unmapping them
+    caches_.reset();
+    for (auto& mapping : mappings_) {
+      munmap(mapping.region, mapping.length);
+    }
+    for (auto& node : nodes_) {
+      NodeArenas* arenas = node.load(std::memory_order_relaxed);
+      if (arenas != nullptr) {
+        for (auto& arena : arenas->arenas) {
+          munmap(arena.first, arena.second);
+        }
+        delete arenas;
+      }
+    }
+  }
+
+  static const char* kClassName() { return "com.intel.iaa_allocator_rocksdb"; }
+
+  const char* Name() const override { return kClassName(); }
+
+  Status PrepareOptions(const ConfigOptions& config_options) override {
+    if (options_.arena_size == 0) {
+      return Status::InvalidArgument("arena_size must be greater than 0");
+    }
+    return MemoryAllocator::PrepareOptions(config_options);
+  }
+
+  void* Allocate(size_t size) override {
+    size_t total = size + kHeaderSize;
+    uint32_t size_class = GetSizeClass(total);
+    if (size_class == kLargeClass) {
+      return AllocateLarge(total);
+    }
+
+    char* block = nullptr;
+    uint32_t node = 0;
+    ThreadCache* cache =
+        size_class < kNumCachedClasses ? GetThreadCache() : nullptr;
+    if (cache != nullptr) {
+      block = cache->Pop(size_class);
+      if (block == nullptr) {
+        block = Refill(cache, size_class);
+      }
+      node = cache->node;
+    } else {
+      node = options_.numa_local ? GetCurrentNode() : 0;
+      NodeArenas* arenas = GetNode(node);
+      if (arenas != nullptr) {
+        std::lock_guard<std::mutex> lock(arenas->mutex);
+        block = TakeFree(arenas, size_class);
+        if (block == nullptr) {
+          block = Carve(arenas, node, ClassSize(size_class));
+        }
+      }
+    }
+    if (block == nullptr) {
+      return nullptr;
+    }
+    auto header = reinterpret_cast<AllocationHeader*>(block);
+    header->size_class = size_class;
+    header->node = node;
+    header->mapping_length = 0;
+    return block + kHeaderSize;
+  }
+
+  void Deallocate(void* p) override {
+    if (p == nullptr) {
+      return;
+    }
+    char* block = static_cast<char*>(p) - kHeaderSize;
+    auto header = reinterpret_cast<AllocationHeader*>(block);
+    if (header->size_class == kLargeClass) {
+      DeallocateLarge(block, header->node, header->mapping_length);
+      return;
+    }
+    // The free list link overwrites the header
+    uint32_t size_class = header->size_class;
+    uint32_t node = header->node;
+    // Blocks of other nodes go back to their node
+    ThreadCache* cache =
+        size_class < kNumCachedClasses ? GetThreadCache() : nullptr;
+    if (cache != nullptr && cache->node == node) {
+      cache->Push(size_class, block);
+      if (cache->counts[size_class] > CacheCapacity(size_class)) {
+        Drain(cache, size_class, CacheCapacity(size_class) / 2);
+      }
+      return;
+    }
+    NodeArenas* arenas = nodes_[node].load(std::memory_order_acquire);
+    std::lock_guard<std::mutex> lock(arenas->mutex);
+    PutFree(arenas, size_class, block);
+  }
+
+  size_t UsableSize(void* p, size_t /* allocation_size */) const override {
+    auto header = reinterpret_cast<const AllocationHeader*>(
+        static_cast<char*>(p) - kHeaderSize);
+    if (header->size_class == kLargeClass) {
+      return header->mapping_length - kHeaderSize;
+    }
+    return ClassSize(header->size_class) - kHeaderSize;
+  }
+
+  // Unmaps the cached mappings of large allocations, and releases the pages
+  // of free blocks of 16KiB and more (except their first page)
+  size_t Trim() {
+    size_t released = 0;
+    {
+      std::lock_guard<std::mutex> lock(mappings_mutex_);
+      for (auto& mapping : mappings_) {
+        munmap(mapping.region, mapping.length);
+        released += mapping.length;
+      }
+      mappings_.clear();
+    }
+    for (auto& node : nodes_) {
+      NodeArenas* arenas = node.load(std::memory_order_acquire);
+      if (arenas == nullptr) {
+        continue;
+      }
+      std::lock_guard<std::mutex> lock(arenas->mutex);
+      for (uint32_t size_class = 0; size_class < kNumClasses; size_class++) {
+        for (FreeBlock* block = arenas->free_lists[size_class];
+             block != nullptr; block = block->next) {
+          uintptr_t start = RoundUp(
+              reinterpret_cast<uintptr_t>(block) + sizeof(FreeBlock),
+              kPageSize);
+          uintptr_t end = (reinterpret_cast<uintptr_t>(block) +
+                           ClassSize(size_class)) /
+                          kPageSize * kPageSize;
+          if (end > start &&
+              madvise(reinterpret_cast<void*>(start), end - start,
+                      MADV_DONTNEED) == 0) {
+            released += end - start;
+          }
+        }
+      }
+    }
+    return released;
+  }
+
+ private:
+  struct FreeBlock {
+    FreeBlock* next;
+  };
+
+  // Arenas and free lists of one NUMA node
+  struct NodeArenas {
+    std::mutex mutex;
+    std::array<FreeBlock*, kNumClasses> free_lists{};
+    std::vector<std::pair<char*, size_t>> arenas;
+    char* next = nullptr;
+    char* end = nullptr;
+  };
+
+  // Free blocks of one node held by a thread
+  struct ThreadCache {
+    explicit ThreadCache(IAAMemoryAllocator* owner) : allocator(owner) {}
+
+    char* Pop(uint32_t size_class) {
+      FreeBlock* block = heads[size_class];
+      if (block == nullptr) {
+        return nullptr;
+      }
+      heads[size_class] = block->next;
+      counts[size_class]--;
+      return reinterpret_cast<char*>(block);
+    }
+
+    void Push(uint32_t size_class, char* block) {
+      auto free_block = reinterpret_cast<FreeBlock*>(block);
+      free_block->next = heads[size_class];
+      heads[size_class] = free_block;
+      counts[size_class]++;
+    }
+
+    IAAMemoryAllocator* allocator;
+    // Node of the cached blocks, kMaxNodes until the first refill
+    uint32_t node = kMaxNodes;
+    std::array<FreeBlock*, kNumCachedClasses> heads{};
+    std::array<size_t, kNumCachedClasses> counts{};
+  };
+
+  // Freed mapping of a large allocation
+  struct Mapping {
+    char* region;
+    size_t length;
+    uint32_t node;
+  };
+
+  IAAMemoryAllocatorOptions options_;
+  // Created on first use, and never freed before the allocator
+  std::array<std::atomic<NodeArenas*>, kMaxNodes> nodes_{};
+  std::mutex mappings_mutex_;
+  std::vector<Mapping> mappings_;
+  std::unique_ptr<ThreadLocalPtr> caches_;
+
+  static size_t ClassSize(uint32_t size_class) {
+    return (kClassSteps + size_class % kClassSteps)
+           << (kMinClassShift - kClassStepShift + size_class / kClassSteps);
+  }
+
+  static size_t CacheCapacity(uint32_t size_class) {
+    return kThreadCacheClassBytes / ClassSize(size_class);
+  }
+
+  static uint32_t GetSizeClass(size_t size) {
+    if (size <= ClassSize(0)) {
+      return 0;
+    }
+    // size is in (2^shift, 2^(shift + 1)], which has kClassSteps classes
+    size_t shift = 63 - __builtin_clzll(size - 1);
+    size_t step_shift = shift - kClassStepShift;
+    size_t steps = ((size - 1) >> step_shift) + 1;
+    size_t size_class =
+        (shift - kMinClassShift) * kClassSteps + steps - kClassSteps;
+    return static_cast<uint32_t>(std::min(size_class, kNumClasses));
+  }
+
+  static uint32_t GetCurrentNode() {
+    unsigned int cpu = 0;
+    unsigned int node = 0;
+    if (syscall(SYS_getcpu, &cpu, &node, nullptr) != 0 || node >= kMaxNodes) {
+      return 0;
+    }
+    return node;
+  }
+
+  NodeArenas* GetNode(uint32_t node) {
+    NodeArenas* arenas = nodes_[node].load(std::memory_order_acquire);
+    if (arenas != nullptr) {
+      return arenas;
+    }
+    std::unique_ptr<NodeArenas> created(new (std::nothrow) NodeArenas());
+    if (created == nullptr) {
+      return nullptr;
+    }
+    if (nodes_[node].compare_exchange_strong(arenas, created.get(),
+                                             std::memory_order_acq_rel)) {
+      return created.release();
+    }
+    // Another thread created it first
+    return arenas;
+  }
+
+  ThreadCache* GetThreadCache() {
+    auto cache = static_cast<ThreadCache*>(caches_->Get());
+    if (cache == nullptr) {
+      cache = new (std::nothrow) ThreadCache(this);
+      caches_->Reset(cache);
+    }
+    return cache;
+  }
+
+  // Called when a thread exits, or for all threads when the allocator is
+  // destroyed
+  static void ReleaseThreadCache(void* ptr) {
+    auto cache = static_cast<ThreadCache*>(ptr);
+    for (uint32_t size_class = 0; size_class < kNumCachedClasses;
+         size_class++) {
+      cache->allocator->Drain(cache, size_class, 0);
+    }
+    delete cache;
+  }
+
+  // Returns cached blocks of a size class to the free list of their node,
+  // until keep are left
+  void Drain(ThreadCache* cache, uint32_t size_class, size_t keep) {
+    if (cache->counts[size_class] <= keep) {
+      return;
+    }
+    NodeArenas* arenas = nodes_[cache->node].load(std::memory_order_acquire);
+    std::lock_guard<std::mutex> lock(arenas->mutex);
+    while (cache->counts[size_class] > keep) {
+      PutFree(arenas, size_class, cache->Pop(size_class));
+    }
+  }
+
+  // Takes a batch of blocks from the node of the calling thread into its
+  // cache, and returns one of them. Carves a block if none is free.
+  char* Refill(ThreadCache* cache, uint32_t size_class) {
+    uint32_t node = options_.numa_local ? GetCurrentNode() : 0;
+    if (node != cache->node) {
+      // The thread moved to another node: its cached blocks are not local
+      for (uint32_t i = 0; cache->node < kMaxNodes && i < kNumCachedClasses;
+           i++) {
+        Drain(cache, i, 0);
+      }
+      cache->node = node;
+    }
+    NodeArenas* arenas = GetNode(node);
+    if (arenas == nullptr) {
+      return nullptr;
+    }
+    std::lock_guard<std::mutex> lock(arenas->mutex);
+    for (size_t i = 0; i < CacheCapacity(size_class) / 2; i++) {
+      char* block = TakeFree(arenas, size_class);
+      if (block == nullptr) {
+        break;
+      }
+      cache->Push(size_class, block);
+    }
+    char* block = cache->Pop(size_class);
+    return block != nullptr ? block
+                            : Carve(arenas, node, ClassSize(size_class));
+  }
+
+  // Must be called with the node mutex held
+  static char* TakeFree(NodeArenas* arenas, uint32_t size_class) {
+    FreeBlock*& head = arenas->free_lists[size_class];
+    if (head == nullptr) {
+      return nullptr;
+    }
+    FreeBlock* block = head;
+    head = head->next;
+    return reinterpret_cast<char*>(block);
+  }
+
+  static void PutFree(NodeArenas* arenas, uint32_t size_class, char* block) {
+    auto free_block = reinterpret_cast<FreeBlock*>(block);
+    FreeBlock*& head = arenas->free_lists[size_class];
+    free_block->next = head;
+    head = free_block;
+  }
+
+  // Takes a block from the current arena of the node, mapping a new arena if
+  // the current one is exhausted. Must be called with the node mutex held.
+  char* Carve(NodeArenas* arenas, uint32_t node, size_t size) {
+    if (arenas->next == nullptr ||
+        static_cast<size_t>(arenas->end - arenas->next) < size) {
+      size_t length = std::max(options_.arena_size, size);
+      char* arena = Map(length, node);
+      if (arena == nullptr) {
+        return nullptr;
+      }
+      length = RoundUp(length, kHugePageSize);
+      arenas->arenas.emplace_back(arena, length);
+      arenas->next = arena;
+      arenas->end = arena + length;
+    }
+    char* block = arenas->next;
+    arenas->next += size;
+    return block;
+  }
+
+  // Reuses a freed mapping of the node that fits the allocation without
+  // wasting more than half of it, otherwise maps a new one
+  void* AllocateLarge(size_t size) {
+    size_t length = RoundUp(size, kHugePageSize);
+    uint32_t node = options_.numa_local ? GetCurrentNode() : 0;
+    char* block = nullptr;
+    {
+      std::lock_guard<std::mutex> lock(mappings_mutex_);
+      for (auto it = mappings_.begin(); it != mappings_.end(); ++it) {
+        if (it->node == node && it->length >= length &&
+            it->length <= 2 * length) {
+          block = it->region;
+          length = it->length;
+          mappings_.erase(it);
+          break;
+        }
+      }
+    }
+    if (block == nullptr) {
+      block = Map(length, node);
+    }
+    if (block == nullptr) {
+      return nullptr;
+    }
+    auto header = reinterpret_cast<AllocationHeader*>(block);
+    header->size_class = kLargeClass;
+    header->node = node;
+    header->mapping_length = length;
+    return block + kHeaderSize;
+  }
+
+  void DeallocateLarge(char* block, uint32_t node, size_t length) {
+    {
+      std::lock_guard<std::mutex> lock(mappings_mutex_);
+      if (mappings_.size() < kMaxCachedMappings) {
+        mappings_.push_back({block, length, node});
+        return;
+      }
+    }
+    munmap(block, length);
+  }
+
+  static size_t RoundUp(size_t size, size_t alignment) {
+    return (size + alignment - 1) / alignment * alignment;
+  }
+
+  // Maps a region aligned to huge pages, bound to the given node and
+  // optionally pre-faulted, so that the device does not take page faults
+  // when writing to it.
+  char* Map(size_t size, uint32_t node) {
+    size_t length = RoundUp(size, kHugePageSize);
+    // Over-allocate to align the region to huge pages, then trim
+    size_t mapped = length + kHugePageSize;
+    void* addr = mmap(nullptr, mapped, PROT_READ | PROT_WRITE,
+                      MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (addr == MAP_FAILED) {
+      return nullptr;
+    }
+    uintptr_t start = reinterpret_cast<uintptr_t>(addr);
+    uintptr_t aligned = RoundUp(start, kHugePageSize);
+    if (aligned > start) {
+      munmap(addr, aligned - start);
+    }
+    size_t tail = start + mapped - (aligned + length);
+    if (tail > 0) {
+      munmap(reinterpret_cast<void*>(aligned + length), tail);
+    }
+    char* region = reinterpret_cast<char*>(aligned);
+
+    if (options_.huge_pages) {
+      madvise(region, length, MADV_HUGEPAGE);
+    }
+    if (options_.numa_local) {
+      // Failure (e.g., kernel without NUMA support) leaves the default
+      // policy, under which pre-faulting from this thread is also node-local.
+      unsigned long nodemask[kMaxNodes / (8 * sizeof(unsigned long))] = {};
+      nodemask[node / (8 * sizeof(unsigned long))] |=
+          1UL << (node % (8 * sizeof(unsigned long)));
+      syscall(SYS_mbind, region, length, MPOL_PREFERRED, nodemask,
+              kMaxNodes + 1, 0);
+    }
+    if (options_.prefault) {
+      for (size_t offset = 0; offset < length; offset += kPageSize) {
+        region[offset] = 0;
+      }
+    }
+    return region;
+  }
+};
+
+std::unique_ptr<MemoryAllocator> NewIAAMemoryAllocator() {
+  return std::unique_ptr<MemoryAllocator>(new IAAMemoryAllocator());
+}
+
+Status TrimIAAMemoryAllocator(MemoryAllocator* allocator, size_t* released) {
+  if (allocator == nullptr ||
+      !allocator->IsInstanceOf(IAAMemoryAllocator::kClassName())) {
+    return Status::InvalidArgument("not an IAA memory allocator");
+  }
+  size_t bytes = static_cast<IAAMemoryAllocator*>(allocator)->Trim();
+  if (released != nullptr) {
+    *released = bytes;
+  }
+  return Status::OK();
+}
+
+}  // namespace ROCKSDB_NAMESPACE
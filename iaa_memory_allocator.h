@@ -0,0 +1,29 @@
+// Copyright (C) 2022 Intel Corporation
+
+// SPDX-License-Identifier: Apache-2.0
+
+#pragma once
+
+#include <rocksdb/memory_allocator.h>
+#include <rocksdb/status.h>
+
+namespace ROCKSDB_NAMESPACE {
+
+// Memory allocator backed by NUMA-local, huge-page, pre-faulted arenas, with
+// free lists per node and size class, and per-thread caches of free blocks.
+// Set it as memory_allocator of the block cache: decompression outputs are
+// then allocated from it as well.
+//
+// Arenas are kept until the allocator is destroyed, so it holds the peak of
+// its allocations of up to 4MiB, plus at most 3.125MiB of free blocks
+// cached per thread and 4 freed mappings of larger allocations.
+std::unique_ptr<MemoryAllocator> NewIAAMemoryAllocator();
+
+// Returns memory held by an IAA memory allocator to the system: unmaps its
+// freed mappings of large allocations, and releases the pages of its free
+// blocks of 16KiB and more, which are faulted in again when reused. Blocks
+// cached by threads are not released. released, if not null, is set to the
+// number of bytes released.
+Status TrimIAAMemoryAllocator(MemoryAllocator* allocator,
+                              size_t* released = nullptr);
+}  // namespace ROCKSDB_NAMESPACE
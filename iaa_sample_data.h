@@ -0,0 +1,38 @@
+// Copyright (C) 2022 Intel Corporation
+
+// SPDX-License-Identifier: Apache-2.0
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <random>
+#include <string>
+
+#include "rocksdb/rocksdb_namespace.h"
+
+namespace ROCKSDB_NAMESPACE {
+
+// Text-like block with a compression ratio of about 3:1: words drawn from a
+// small vocabulary mixed with decimal numbers. The same seed gives the same
+// block, so that calibration and benchmark runs can be compared.
+inline std::string GenerateIAASampleText(size_t length, uint32_t seed = 301) {
+  static const char* kWords[] = {"the",   "key",      "value",  "rocksdb",
+                                 "block", "compress", "table",  "level",
+                                 "user",  "index",    "filter", "data"};
+  std::mt19937 rng(seed);
+  std::string block;
+  block.reserve(length + 16);
+  while (block.size() < length) {
+    if (rng() % 4 == 0) {
+      block += std::to_string(rng() % 1000000);
+    } else {
+      block += kWords[rng() % (sizeof(kWords) / sizeof(kWords[0]))];
+    }
+    block += ' ';
+  }
+  block.resize(length);
+  return block;
+}
+
+}  // namespace ROCKSDB_NAMESPACE
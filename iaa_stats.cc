@@ -0,0 +1,288 @@
+// Copyright (C) 2022 Intel Corporation
+
+// SPDX-License-Identifier: Apache-2.0
+
+#include "iaa_stats.h"
+
+#include <algorithm>
+
+namespace ROCKSDB_NAMESPACE {
+
+uint32_t HistogramData::BucketIndex(uint64_t value) {
+  if (value < kSubBuckets) {
+    return static_cast<uint32_t>(value);
+  }
+  uint32_t msb = 63 - __builtin_clzll(value);
+  if (msb >= kMaxBits) {
+    return kNumBuckets - 1;
+  }
+  uint32_t shift = msb - kSubBucketBits;
+  uint32_t sub_bucket = (value >> shift) & (kSubBuckets - 1);
+  return (shift + 1) * kSubBuckets + sub_bucket;
+}
+
+uint64_t HistogramData::BucketLowerBound(uint32_t index) {
+  if (index < kSubBuckets) {
+    return index;
+  }
+  uint32_t shift = index / kSubBuckets - 1;
+  return (uint64_t{kSubBuckets} + index % kSubBuckets) << shift;
+}
+
+uint64_t HistogramData::BucketUpperBound(uint32_t index) {
+  if (index < kSubBuckets) {
+    return index;
+  }
+  uint32_t shift = index / kSubBuckets - 1;
+  return BucketLowerBound(index) + (uint64_t{1} << shift) - 1;
+}
+
+void HistogramData::Add(uint64_t value) {
+  buckets_[BucketIndex(value)]++;
+  count_++;
+  sum_ += value;
+  max_ = std::max(max_, value);
+}
+
+void HistogramData::Merge(const HistogramData& other) {
+  for (uint32_t i = 0; i < kNumBuckets; i++) {
+    buckets_[i] += other.buckets_[i];
+  }
+  count_ += other.count_;
+  sum_ += other.sum_;
+  max_ = std::max(max_, other.max_);
+}
+
+double HistogramData::Average() const {
+  return count_ == 0 ? 0.0 : static_cast<double>(sum_) / count_;
+}
+
+uint64_t HistogramData::Percentile(double percentile) const {
+  if (count_ == 0) {
+    return 0;
+  }
+  double threshold = count_ * percentile / 100.0;
+  uint64_t cumulative = 0;
+  for (uint32_t i = 0; i < kNumBuckets; i++) {
+    cumulative += buckets_[i];
+    if (cumulative > 0 && cumulative >= threshold) {
+      return std::min(BucketUpperBound(i), max_);
+    }
+  }
+  return max_;
+}
+
+void AtomicHistogram::Add(uint64_t value) {
+  buckets_[HistogramData::BucketIndex(value)].fetch_add(
+      1, std::memory_order_relaxed);
+  sum_.fetch_add(value, std::memory_order_relaxed);
+  uint64_t max = max_.load(std::memory_order_relaxed);
+  while (value > max &&
+         !max_.compare_exchange_weak(max, value, std::memory_order_relaxed)) {
+  }
+}
+
+void AtomicHistogram::MergeInto(HistogramData* data) const {
+  for (uint32_t i = 0; i < HistogramData::kNumBuckets; i++) {
+    uint64_t count = buckets_[i].load(std::memory_order_relaxed);
+    data->buckets_[i] += count;
+    data->count_ += count;
+  }
+  data->sum_ += sum_.load(std::memory_order_relaxed);
+  data->max_ = std::max(data->max_, max_.load(std::memory_order_relaxed));
+}
+
+void AtomicHistogram::Reset() {
+  for (auto& bucket : buckets_) {
+    bucket.store(0, std::memory_order_relaxed);
+  }
+  sum_.store(0, std::memory_order_relaxed);
+  max_.store(0, std::memory_order_relaxed);
+}
+
+IAAStats::IAAStats() : ticker_shards_(new TickerShard[kNumShards]) {}
+
+IAAStats::~IAAStats() {
+  for (auto& shard : histograms_) {
+    for (auto& entry : shard) {
+      delete entry.load(std::memory_order_relaxed);
+    }
+  }
+}
+
+uint32_t IAAStats::ShardIndex() {
+  // Threads are assigned shards round-robin when they first record
+  static std::atomic<uint32_t> next_shard{0};
+  static thread_local uint32_t shard =
+      next_shard.fetch_add(1, std::memory_order_relaxed) % kNumShards;
+  return shard;
+}
+
+AtomicHistogram* IAAStats::CreateHistogram(
+    std::atomic<AtomicHistogram*>* entry) {
+  AtomicHistogram* created = new AtomicHistogram();
+  AtomicHistogram* expected = nullptr;
+  if (!entry->compare_exchange_strong(expected, created,
+                                      std::memory_order_acq_rel)) {
+    // Another thread of the shard created it first
+    delete created;
+    return expected;
+  }
+  return created;
+}
+
+void IAAStats::RecordStatus(uint32_t status) {
+  status_codes_[std::min(status, kNumStatusCodes - 1)].fetch_add(
+      1, std::memory_order_relaxed);
+}
+
+uint64_t IAAStats::GetTicker(IAATicker ticker) const {
+  uint64_t total = 0;
+  for (uint32_t i = 0; i < kNumShards; i++) {
+    total += ticker_shards_[i].tickers[ticker].load(std::memory_order_relaxed);
+  }
+  return total;
+}
+
+HistogramData IAAStats::GetHistogram(IAAHistogram histogram) const {
+  HistogramData data;
+  for (auto& shard : histograms_) {
+    const AtomicHistogram* entry =
+        shard[histogram].load(std::memory_order_acquire);
+    if (entry != nullptr) {
+      entry->MergeInto(&data);
+    }
+  }
+  return data;
+}
+
+std::string IAAStats::ToString(const std::string& delimiter) const {
+  std::string result;
+  auto append = [&](const std::string& name, uint64_t value) {
+    if (!result.empty()) {
+      result.append(delimiter);
+    }
+    result.append(name).append("=").append(std::to_string(value));
+  };
+  for (uint32_t i = 0; i < kTickerCount; i++) {
+    auto ticker = static_cast<IAATicker>(i);
+    append(TickerName(ticker), GetTicker(ticker));
+  }
+  for (uint32_t i = 0; i < kHistogramCount; i++) {
+    auto histogram = static_cast<IAAHistogram>(i);
+    HistogramData data = GetHistogram(histogram);
+    std::string name = HistogramName(histogram);
+    append(name + "_count", data.Count());
+    append(name + "_avg_ns", static_cast<uint64_t>(data.Average()));
+    append(name + "_p50_ns", data.Percentile(50));
+    append(name + "_p99_ns", data.Percentile(99));
+    append(name + "_p999_ns", data.Percentile(99.9));
+    append(name + "_max_ns", data.Max());
+  }
+  for (uint32_t i = 0; i < kNumStatusCodes; i++) {
+    uint64_t count = status_codes_[i].load(std::memory_order_relaxed);
+    if (count > 0) {
+      append("qpl_status_" + std::to_string(i), count);
+    }
+  }
+  return result;
+}
+
+void IAAStats::Reset() {
+  for (uint32_t i = 0; i < kNumShards; i++) {
+    for (auto& ticker : ticker_shards_[i].tickers) {
+      ticker.store(0, std::memory_order_relaxed);
+    }
+  }
+  for (auto& shard : histograms_) {
+    for (auto& entry : shard) {
+      AtomicHistogram* histogram = entry.load(std::memory_order_acquire);
+      if (histogram != nullptr) {
+        histogram->Reset();
+      }
+    }
+  }
+  for (auto& count : status_codes_) {
+    count.store(0, std::memory_order_relaxed);
+  }
+}
+
+const char* IAAStats::TickerName(IAATicker ticker) {
+  switch (ticker) {
+    case kCompressCalls:
+      return "compress_calls";
+    case kCompressBytesIn:
+      return "compress_bytes_in";
+    case kCompressBytesOut:
+      return "compress_bytes_out";
+    case kUncompressCalls:
+      return "uncompress_calls";
+    case kUncompressBytesIn:
+      return "uncompress_bytes_in";
+    case kUncompressBytesOut:
+      return "uncompress_bytes_out";
+    case kAutoPathJobs:
+      return "auto_path_jobs";
+    case kHardwarePathJobs:
+      return "hw_path_jobs";
+    case kSoftwarePathJobs:
+      return "sw_path_jobs";
+    case kBusyRetries:
+      return "busy_retries";
+    case kSoftwareFallbacks:
+      return "sw_fallbacks";
+    case kCompressErrors:
+      return "compress_errors";
+    case kUncompressErrors:
+      return "uncompress_errors";
+    case kWarmUpJobs:
+      return "warm_up_jobs";
+    case kWarmUpErrors:
+      return "warm_up_errors";
+    case kControllerFixedBlocks:
+      return "controller_fixed_blocks";
+    case kControllerDynamicBlocks:
+      return "controller_dynamic_blocks";
+    case kControllerHighLevelBlocks:
+      return "controller_high_level_blocks";
+    case kControllerToSpeed:
+      return "controller_to_speed";
+    case kControllerToRatio:
+      return "controller_to_ratio";
+    case kBacklogs:
+      return "backlogs";
+    case kPolicyBlocks:
+      return "policy_blocks";
+    default:
+      return "unknown";
+  }
+}
+
+const char* IAAStats::HistogramName(IAAHistogram histogram) {
+  switch (histogram) {
+    case kCompressLatency:
+      return "compress_latency";
+    case kUncompressLatency:
+      return "uncompress_latency";
+    case kCompressSetup:
+      return "compress_setup";
+    case kCompressSubmit:
+      return "compress_submit";
+    case kCompressExecute:
+      return "compress_execute";
+    case kCompressCompletion:
+      return "compress_completion";
+    case kUncompressSetup:
+      return "uncompress_setup";
+    case kUncompressSubmit:
+      return "uncompress_submit";
+    case kUncompressExecute:
+      return "uncompress_execute";
+    case kUncompressCompletion:
+      return "uncompress_completion";
+    default:
+      return "unknown";
+  }
+}
+
+}  // namespace ROCKSDB_NAMESPACE
@@ -0,0 +1,191 @@
+// Copyright (C) 2022 Intel Corporation
+
+// SPDX-License-Identifier: Apache-2.0
+
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <ctime>
+#include <memory>
+#include <string>
+
+#include "rocksdb/rocksdb_namespace.h"
+
+namespace ROCKSDB_NAMESPACE {
+
+inline uint64_t NowNanos() {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+             std::chrono::steady_clock::now().time_since_epoch())
+      .count();
+}
+
+// CPU time of the calling thread
+inline uint64_t ThreadCpuNanos() {
+  struct timespec ts;
+  clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+  return static_cast<uint64_t>(ts.tv_sec) * 1000000000 + ts.tv_nsec;
+}
+
+// Log-linear histogram (HDR style). Each power of two is split into
+// kSubBuckets buckets, so percentiles are within 1/kSubBuckets of the recorded
+// values. Values up to 2^40 are tracked, larger ones are clamped.
+class HistogramData {
+ public:
+  static constexpr uint32_t kSubBucketBits = 3;
+  static constexpr uint32_t kSubBuckets = 1 << kSubBucketBits;
+  static constexpr uint32_t kMaxBits = 40;
+  static constexpr uint32_t kNumBuckets =
+      (kMaxBits - kSubBucketBits + 1) * kSubBuckets;
+
+  static uint32_t BucketIndex(uint64_t value);
+  static uint64_t BucketLowerBound(uint32_t index);
+  static uint64_t BucketUpperBound(uint32_t index);
+
+  void Add(uint64_t value);
+  void Merge(const HistogramData& other);
+  uint64_t Count() const { return count_; }
+  uint64_t Max() const { return max_; }
+  double Average() const;
+  // Upper bound of the bucket holding the given percentile (0-100)
+  uint64_t Percentile(double percentile) const;
+
+ private:
+  friend class AtomicHistogram;
+  std::array<uint64_t, kNumBuckets> buckets_{};
+  uint64_t count_ = 0;
+  uint64_t sum_ = 0;
+  uint64_t max_ = 0;
+};
+
+// Histogram updated concurrently with relaxed atomics
+class AtomicHistogram {
+ public:
+  void Add(uint64_t value);
+  void MergeInto(HistogramData* data) const;
+  void Reset();
+
+ private:
+  std::array<std::atomic<uint64_t>, HistogramData::kNumBuckets> buckets_{};
+  std::atomic<uint64_t> sum_{0};
+  std::atomic<uint64_t> max_{0};
+};
+
+enum IAATicker : uint32_t {
+  kCompressCalls,
+  kCompressBytesIn,
+  kCompressBytesOut,
+  kUncompressCalls,
+  kUncompressBytesIn,
+  kUncompressBytesOut,
+  // QPL jobs submitted per requested execution path
+  kAutoPathJobs,
+  kHardwarePathJobs,
+  kSoftwarePathJobs,
+  // Resubmissions due to full device queues
+  kBusyRetries,
+  // Jobs moved to the software path because hardware does not support them
+  kSoftwareFallbacks,
+  kCompressErrors,
+  kUncompressErrors,
+  // Jobs created and checked with canary jobs by warm-up, and canary failures
+  kWarmUpJobs,
+  kWarmUpErrors,
+  // Blocks compressed with each setting of the throughput controller (in the
+  // order of IAAController::Setting), and its steps toward speed and ratio
+  kControllerFixedBlocks,
+  kControllerDynamicBlocks,
+  kControllerHighLevelBlocks,
+  kControllerToSpeed,
+  kControllerToRatio,
+  // Backlogs signaled with SetIAACompressionPressure (e.g., write stalls)
+  kBacklogs,
+  // Blocks compressed with a policy of the policies option
+  kPolicyBlocks,
+  kTickerCount
+};
+
+enum IAAHistogram : uint32_t {
+  kCompressLatency,
+  kUncompressLatency,
+  // Phases of a call: setup (until the first job submission, plus work
+  // between jobs), submit (until the device accepts the job, including busy
+  // retries), execute (until completion is observed, i.e., queueing and
+  // engine time) and completion (after the last job completes)
+  kCompressSetup,
+  kCompressSubmit,
+  kCompressExecute,
+  kCompressCompletion,
+  kUncompressSetup,
+  kUncompressSubmit,
+  kUncompressExecute,
+  kUncompressCompletion,
+  kHistogramCount
+};
+
+// Always-on statistics of a compressor. Updates go to one of several shards,
+// picked per thread, so threads rarely share cache lines. Shards are summed
+// when statistics are read. Tickers are small and have kNumShards shards;
+// histograms (2.4KB each) have kNumHistogramShards shards and are allocated
+// when first recorded, so that a compressor takes a few KB until used and
+// at most about 200KB.
+class IAAStats {
+ public:
+  static constexpr uint32_t kNumShards = 32;
+  static constexpr uint32_t kNumHistogramShards = 8;
+  static constexpr uint32_t kNumStatusCodes = 256;
+
+  IAAStats();
+  ~IAAStats();
+  IAAStats(const IAAStats&) = delete;
+  IAAStats& operator=(const IAAStats&) = delete;
+
+  void RecordTick(IAATicker ticker, uint64_t count = 1) {
+    ticker_shards_[ShardIndex()].tickers[ticker].fetch_add(
+        count, std::memory_order_relaxed);
+  }
+
+  void RecordLatency(IAAHistogram histogram, uint64_t nanos) {
+    std::atomic<AtomicHistogram*>& entry =
+        histograms_[ShardIndex() % kNumHistogramShards][histogram];
+    AtomicHistogram* data = entry.load(std::memory_order_acquire);
+    if (data == nullptr) {
+      data = CreateHistogram(&entry);
+    }
+    data->Add(nanos);
+  }
+
+  // Counts a QPL error status. Codes beyond kNumStatusCodes share one counter.
+  void RecordStatus(uint32_t status);
+
+  uint64_t GetTicker(IAATicker ticker) const;
+  HistogramData GetHistogram(IAAHistogram histogram) const;
+
+  // Serializes all counters and latency percentiles as name=value pairs
+  std::string ToString(const std::string& delimiter = ";") const;
+
+  void Reset();
+
+  static const char* TickerName(IAATicker ticker);
+  static const char* HistogramName(IAAHistogram histogram);
+
+ private:
+  struct alignas(64) TickerShard {
+    std::array<std::atomic<uint64_t>, kTickerCount> tickers{};
+  };
+
+  // Shard of the calling thread, in [0, kNumShards)
+  static uint32_t ShardIndex();
+  AtomicHistogram* CreateHistogram(std::atomic<AtomicHistogram*>* entry);
+
+  std::unique_ptr<TickerShard[]> ticker_shards_;
+  // nullptr until recorded
+  std::array<std::array<std::atomic<AtomicHistogram*>, kHistogramCount>,
+             kNumHistogramShards>
+      histograms_{};
+  std::array<std::atomic<uint64_t>, kNumStatusCodes> status_codes_{};
+};
+
+}  // namespace ROCKSDB_NAMESPACE
@@ -0,0 +1,44 @@
+// Copyright (C) 2022 Intel Corporation
+
+// SPDX-License-Identifier: Apache-2.0
+
+#pragma once
+
+// USDT (SDT) probes on the compression hot path, for use with bpftrace, perf
+// or SystemTap. All probes belong to the iaa_compressor provider:
+//
+//   compress_start(input_size, path, mode)
+//   compress_end(input_size, output_size, path, status, latency_ns)
+//   decompress_start(input_size, path)
+//   decompress_end(input_size, output_size, path, status, latency_ns)
+//   busy_retry(path, retries)
+//   fallback(from_path, to_path)
+//   job_acquire(path, acquired)
+//   job_release(path, op)
+//
+// path is the qpl_path_t value (0 = auto, 1 = hw, 2 = sw). mode is the
+// compression_mode (0 = dynamic, 1 = fixed). status is the QPL status of the
+// last job of the call, or -1 if the call failed for another reason. acquired
+// is 0 if no job could be initialized for the path. A job is released when it
+// completes; op is its qpl_operation.
+// A disabled probe is a single nop instruction. Probes are compiled only when
+// <sys/sdt.h> is available and IAA_DISABLE_USDT is not defined.
+
+#if !defined(IAA_DISABLE_USDT) && defined(__has_include)
+#if __has_include(<sys/sdt.h>)
+#include <sys/sdt.h>
+#define IAA_USDT_ENABLED 1
+#endif
+#endif
+
+#ifdef IAA_USDT_ENABLED
+#define IAA_TRACE2(name, a1, a2) DTRACE_PROBE2(iaa_compressor, name, a1, a2)
+#define IAA_TRACE3(name, a1, a2, a3) \
+  DTRACE_PROBE3(iaa_compressor, name, a1, a2, a3)
+#define IAA_TRACE5(name, a1, a2, a3, a4, a5) \
+  DTRACE_PROBE5(iaa_compressor, name, a1, a2, a3, a4, a5)
+#else
+#define IAA_TRACE2(name, a1, a2)
+#define IAA_TRACE3(name, a1, a2, a3)
+#define IAA_TRACE5(name, a1, a2, a3, a4, a5)
+#endif
@@ -0,0 +1,293 @@
+// Copyright (C) 2022 Intel Corporation
+
+// SPDX-License-Identifier: Apache-2.0
+
+#include "../iaa_compression_manager.h"
+
+#include <gtest/gtest.h>
+
+#include <atomic>
+#include <cstring>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "../iaa_sample_data.h"
+#include "rocksdb/convenience.h"
+#include "util/coding.h"
+
+namespace ROCKSDB_NAMESPACE {
+
+class IAACompressionManagerTest : public testing::TestWithParam<std::string> {
+ public:
+  void SetUp() override {
+    ConfigOptions config_options;
+    Status s = CompressionManager::CreateFromString(
+        config_options, "id=com.intel.iaa_compression_manager;" + GetParam(),
+        &manager);
+    ASSERT_TRUE(s.ok()) << s.ToString();
+    compressor = manager->GetCompressor(CompressionOptions(), kZSTD);
+    ASSERT_NE(compressor, nullptr);
+    decompressor = manager->GetDecompressor();
+    ASSERT_NE(decompressor, nullptr);
+  }
+
+  // Compresses into a buffer of the given capacity. Returns an empty string
+  // if the block is rejected.
+  std::string Compress(const std::string& input, size_t capacity,
+                       Compressor::ManagedWorkingArea* working_area) {
+    std::string output(capacity, '\0');
+    size_t output_size = capacity;
+    CompressionType type = kDisableCompressionOption;
+    Status s = compressor->CompressBlock(input, &output[0], &output_size,
+                                         &type, working_area);
+    EXPECT_TRUE(s.ok()) << s.ToString();
+    if (type == kNoCompression) {
+      return "";
+    }
+    EXPECT_EQ(type, kIAACompressionType);
+    output.resize(output_size);
+    return output;
+  }
+
+  Status Decompress(const std::string& compressed, std::string* output,
+                    Decompressor::ManagedWorkingArea* working_area) {
+    Decompressor::Args args;
+    args.compression_type = kIAACompressionType;
+    args.compressed_data = compressed;
+    args.working_area = working_area;
+    Status s = decompressor->ExtractUncompressedSize(args);
+    if (!s.ok()) {
+      return s;
+    }
+    output->resize(args.uncompressed_size);
+    return decompressor->DecompressBlock(args, &(*output)[0]);
+  }
+
+  std::shared_ptr<CompressionManager> manager;
+  std::unique_ptr<Compressor> compressor;
+  std::shared_ptr<Decompressor> decompressor;
+};
+
+TEST_P(IAACompressionManagerTest, RoundTrip) {
+  Compressor::ManagedWorkingArea compress_area =
+      compressor->ObtainWorkingArea();
+  Decompressor::ManagedWorkingArea decompress_area =
+      decompressor->ObtainWorkingArea(kIAACompressionType);
+  for (size_t length : {1, 100, 4096, 65536, 1 << 20}) {
+    std::string input = GenerateIAASampleText(length);
+    // With and without working areas
+    for (bool use_areas : {true, false}) {
+      std::string compressed = Compress(
+          input, length + 64, use_areas ? &compress_area : nullptr);
+      ASSERT_FALSE(compressed.empty()) << length;
+      std::string output;
+      Status s = Decompress(compressed, &output,
+                            use_areas ? &decompress_area : nullptr);
+      ASSERT_TRUE(s.ok()) << length << ": " << s.ToString();
+      ASSERT_EQ(output, input);
+    }
+  }
+}
+
+TEST_P(IAACompressionManagerTest, Rejected) {
+  // Random data does not compress: it does not fit a buffer of its size
+  std::string input(65536, '\0');
+  std::mt19937 rng(301);
+  for (char& c : input) {
+    c = static_cast<char>(rng());
+  }
+  ASSERT_TRUE(Compress(input, input.size(), nullptr).empty());
+  ASSERT_TRUE(Compress(input, 1, nullptr).empty());
+}
+
+TEST_P(IAACompressionManagerTest, Threads) {
+  std::string input = GenerateIAASampleText(65536);
+  std::vector<std::thread> threads;
+  std::atomic<int> failures{0};
+  for (int t = 0; t < 4; t++) {
+    threads.emplace_back([&]() {
+      Compressor::ManagedWorkingArea compress_area =
+          compressor->ObtainWorkingArea();
+      Decompressor::ManagedWorkingArea decompress_area =
+          decompressor->ObtainWorkingArea(kIAACompressionType);
+      for (int i = 0; i < 100; i++) {
+        std::string compressed =
+            Compress(input, input.size(), &compress_area);
+        std::string output;
+        if (compressed.empty() ||
+            !Decompress(compressed, &output, &decompress_area).ok() ||
+            output != input) {
+          failures++;
+        }
+      }
+    });
+  }
+  for (std::thread& thread : threads) {
+    thread.join();
+  }
+  ASSERT_EQ(failures.load(), 0);
+}
+
+INSTANTIATE_TEST_CASE_P(
+    Options, IAACompressionManagerTest,
+    testing::Values("execution_path=sw", "execution_path=sw;integrity=crc",
+                    "execution_path=sw;compression_mode=fixed",
+                    "execution_path=hw;executor={id=emulator}"));
+
+TEST(Integrity, ChecksumMismatch) {
+  std::shared_ptr<CompressionManager> manager;
+  ConfigOptions config_options;
+  Status s = CompressionManager::CreateFromString(
+      config_options,
+      "id=com.intel.iaa_compression_manager;execution_path=sw;integrity=crc",
+      &manager);
+  ASSERT_TRUE(s.ok()) << s.ToString();
+  std::unique_ptr<Compressor> compressor =
+      manager->GetCompressor(CompressionOptions(), kIAACompressionType);
+  std::shared_ptr<Decompressor> decompressor = manager->GetDecompressor();
+
+  std::string input = GenerateIAASampleText(4096);
+  std::string compressed(input.size(), '\0');
+  size_t compressed_size = compressed.size();
+  CompressionType type = kNoCompression;
+  s = compressor->CompressBlock(input, &compressed[0], &compressed_size, &type,
+                                nullptr);
+  ASSERT_TRUE(s.ok()) << s.ToString();
+  ASSERT_EQ(type, kIAACompressionType);
+  compressed.resize(compressed_size);
+  // The checksum follows the 6-byte header (varint64 with flags)
+  compressed[6] ^= 1;
+
+  Decompressor::Args args;
+  args.compression_type = kIAACompressionType;
+  args.compressed_data = compressed;
+  s = decompressor->ExtractUncompressedSize(args);
+  ASSERT_TRUE(s.ok()) << s.ToString();
+  ASSERT_EQ(args.uncompressed_size, input.size());
+  std::string output(input.size(), '\0');
+  s = decompressor->DecompressBlock(args, &output[0]);
+  ASSERT_TRUE(s.IsCorruption()) << s.ToString();
+}
+
+TEST(Zlib, LegacyBlocks) {
+  std::unique_ptr<Compressor> zlib =
+      GetBuiltinV2CompressionManager()->GetCompressor(CompressionOptions(),
+                                                      kZlibCompression);
+  if (zlib == nullptr) {
+    GTEST_SKIP() << "zlib is not supported by this build of RocksDB";
+  }
+  ConfigOptions config_options;
+  for (const char* options : {"zlib_offload=true", "zlib_offload=false"}) {
+    std::shared_ptr<CompressionManager> manager;
+    Status s = CompressionManager::CreateFromString(
+        config_options,
+        std::string("id=com.intel.iaa_compression_manager;execution_path=sw;") +
+            options,
+        &manager);
+    ASSERT_TRUE(s.ok()) << s.ToString();
+    std::shared_ptr<Decompressor> decompressor = manager->GetDecompressor();
+
+    // Raw deflate (default) and zlib headers
+    for (int window_bits : {-14, 15}) {
+      CompressionOptions compression_options;
+      compression_options.window_bits = window_bits;
+      zlib = GetBuiltinV2CompressionManager()->GetCompressor(
+          compression_options, kZlibCompression);
+      ASSERT_NE(zlib, nullptr);
+      std::string input = GenerateIAASampleText(65536);
+      std::string compressed(input.size(), '\0');
+      size_t compressed_size = compressed.size();
+      CompressionType type = kNoCompression;
+      s = zlib->CompressBlock(input, &compressed[0], &compressed_size, &type,
+                              nullptr);
+      ASSERT_TRUE(s.ok()) << s.ToString();
+      ASSERT_EQ(type, kZlibCompression);
+      compressed.resize(compressed_size);
+
+      Decompressor::ManagedWorkingArea working_area =
+          decompressor->ObtainWorkingArea(kZlibCompression);
+      Decompressor::Args args;
+      args.compression_type = kZlibCompression;
+      args.compressed_data = compressed;
+      args.working_area = &working_area;
+      s = decompressor->ExtractUncompressedSize(args);
+      ASSERT_TRUE(s.ok()) << s.ToString();
+      ASSERT_EQ(args.uncompressed_size, input.size());
+      std::string output(input.size(), '\0');
+      s = decompressor->DecompressBlock(args, &output[0]);
+      ASSERT_TRUE(s.ok()) << options << " " << window_bits << ": "
+                          << s.ToString();
+      ASSERT_EQ(output, input);
+    }
+  }
+}
+
+// Corrupt zlib blocks fail with the QPL status, while blocks whose job could
+// not run are passed to the built-in decompressor
+TEST(Zlib, Fallback) {
+  std::unique_ptr<Compressor> zlib =
+      GetBuiltinV2CompressionManager()->GetCompressor(CompressionOptions(),
+                                                      kZlibCompression);
+  if (zlib == nullptr) {
+    GTEST_SKIP() << "zlib is not supported by this build of RocksDB";
+  }
+  std::string input = GenerateIAASampleText(65536);
+  std::string compressed(input.size(), '\0');
+  size_t compressed_size = compressed.size();
+  CompressionType type = kNoCompression;
+  Status s = zlib->CompressBlock(input, &compressed[0], &compressed_size,
+                                 &type, nullptr);
+  ASSERT_TRUE(s.ok()) << s.ToString();
+  compressed.resize(compressed_size);
+  // The raw deflate stream follows the size prefix. Block type 3 is reserved.
+  uint32_t length = 0;
+  const char* stream = GetVarint32Ptr(
+      compressed.data(), compressed.data() + compressed.size(), &length);
+  ASSERT_NE(stream, nullptr);
+  std::string corrupt = compressed;
+  corrupt[stream - compressed.data()] |= 0x06;
+
+  ConfigOptions config_options;
+  for (const char* options :
+       {"execution_path=sw",
+        "execution_path=hw;executor={id=emulator;fault_one_in=1}"}) {
+    std::shared_ptr<CompressionManager> manager;
+    s = CompressionManager::CreateFromString(
+        config_options,
+        std::string("id=com.intel.iaa_compression_manager;") + options,
+        &manager);
+    ASSERT_TRUE(s.ok()) << s.ToString();
+    std::shared_ptr<Decompressor> decompressor = manager->GetDecompressor();
+    bool faults = strstr(options, "fault_one_in") != nullptr;
+
+    for (const std::string* block : {&compressed, &corrupt}) {
+      Decompressor::Args args;
+      args.compression_type = kZlibCompression;
+      args.compressed_data = *block;
+      s = decompressor->ExtractUncompressedSize(args);
+      ASSERT_TRUE(s.ok()) << s.ToString();
+      std::string output(input.size(), '\0');
+      s = decompressor->DecompressBlock(args, &output[0]);
+      if (block == &compressed) {
+        // Failed jobs are retried by the built-in decompressor
+        ASSERT_TRUE(s.ok()) << options << ": " << s.ToString();
+        ASSERT_EQ(output, input);
+      } else if (!faults) {
+        ASSERT_TRUE(s.IsCorruption()) << s.ToString();
+        ASSERT_NE(s.ToString().find("QPL status"), std::string::npos)
+            << s.ToString();
+      } else {
+        ASSERT_FALSE(s.ok());
+      }
+    }
+  }
+}
+
+}  // namespace ROCKSDB_NAMESPACE
+
+int main(int argc, char* argv[]) {
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
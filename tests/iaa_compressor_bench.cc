@@ -0,0 +1,208 @@
+// Copyright (C) 2022 Intel Corporation
+
+// SPDX-License-Identifier: Apache-2.0
+
+#include <benchmark/benchmark.h>
+
+#include <cstring>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "../iaa_compressor.h"
+#include "../iaa_sample_data.h"
+#include "rocksdb/convenience.h"
+
+namespace ROCKSDB_NAMESPACE {
+
+// Same block sizes as IAACompressorTest
+static const std::vector<int64_t> kBlockSizes = {
+    100, 1 << 8, 1000, 1 << 10, 1 << 12, 1 << 14, 1 << 16, 100000, 1000000,
+    1 << 20};
+
+struct BenchConfig {
+  std::string path;
+  std::string mode;
+  int level;
+  bool verify;
+
+  std::string Name() const {
+    return path + "/" + mode + "/level=" + std::to_string(level) +
+           "/verify=" + (verify ? "true" : "false");
+  }
+
+  std::string Options() const {
+    return "id=com.intel.iaa_compressor_rocksdb;execution_path=" + path +
+           ";compression_mode=" + mode + ";level=" + std::to_string(level) +
+           ";verify=" + (verify ? "true" : "false");
+  }
+};
+
+std::shared_ptr<Compressor> CreateCompressor(benchmark::State& state,
+                                             const BenchConfig& config) {
+  std::shared_ptr<Compressor> compressor;
+  ConfigOptions config_options;
+  Status s = Compressor::CreateFromString(config_options, config.Options(),
+                                          &compressor);
+  if (!s.ok()) {
+    state.SkipWithError(s.ToString().c_str());
+    return nullptr;
+  }
+  return compressor;
+}
+
+// Reports bytes_per_second (of uncompressed data), the time per block and
+// the compression ratio
+static void BM_Compress(benchmark::State& state, const BenchConfig& config) {
+  std::shared_ptr<Compressor> compressor = CreateCompressor(state, config);
+  if (compressor == nullptr) {
+    return;
+  }
+  std::string input = GenerateIAASampleText(state.range(0));
+  CompressionInfo compr_info(CompressionDict::GetEmptyDict());
+  std::string compressed;
+  for (auto _ : state) {
+    compressed.clear();
+    Status s = compressor->Compress(compr_info, input, &compressed);
+    if (!s.ok()) {
+      state.SkipWithError(s.ToString().c_str());
+      return;
+    }
+    benchmark::DoNotOptimize(compressed.data());
+  }
+  state.SetBytesProcessed(state.iterations() * input.size());
+  state.counters["ratio"] =
+      static_cast<double>(input.size()) / compressed.size();
+}
+
+static void BM_Uncompress(benchmark::State& state, const BenchConfig& config) {
+  std::shared_ptr<Compressor> compressor = CreateCompressor(state, config);
+  if (compressor == nullptr) {
+    return;
+  }
+  std::string input = GenerateIAASampleText(state.range(0));
+  CompressionInfo compr_info(CompressionDict::GetEmptyDict());
+  std::string compressed;
+  Status s = compressor->Compress(compr_info, input, &compressed);
+  if (!s.ok()) {
+    state.SkipWithError(s.ToString().c_str());
+    return;
+  }
+  UncompressionInfo uncompr_info(UncompressionDict::GetEmptyDict());
+  for (auto _ : state) {
+    char* uncompressed;
+    size_t uncompressed_length;
+    s = compressor->Uncompress(uncompr_info, compressed.data(),
+                               compressed.size(), &uncompressed,
+                               &uncompressed_length);
+    if (!s.ok()) {
+      state.SkipWithError(s.ToString().c_str());
+      return;
+    }
+    benchmark::DoNotOptimize(uncompressed);
+    delete[] uncompressed;
+  }
+  state.SetBytesProcessed(state.iterations() * input.size());
+  state.counters["ratio"] =
+      static_cast<double>(input.size()) / compressed.size();
+}
+
+// Registers Compress and Uncompress for each combination of execution path,
+// compression mode, level and verify (verify only applies to Compress)
+void RegisterCompressorBenchmarks(const std::vector<std::string>& paths) {
+  for (const std::string& path : paths) {
+    for (const char* mode : {"dynamic", "fixed"}) {
+      for (int level : {0, 1}) {
+        for (bool verify : {false, true}) {
+          BenchConfig config{path, mode, level, verify};
+          benchmark::RegisterBenchmark(("Compress/" + config.Name()).c_str(),
+                                       BM_Compress, config)
+              ->ArgNames({"block_size"})
+              ->ArgsProduct({kBlockSizes});
+          if (!verify) {
+            benchmark::RegisterBenchmark(
+                ("Uncompress/" + config.Name()).c_str(), BM_Uncompress,
+                config)
+                ->ArgNames({"block_size"})
+                ->ArgsProduct({kBlockSizes});
+          }
+        }
+      }
+    }
+  }
+}
+
+// Compress on the software path with each output_buffer strategy: resize
+// deflates into the output string, resized (and zero-filled) to the
+// worst-case compressed size; scratch deflates into a reused buffer and
+// copies the result to the string at its exact size. The output string is
+// new for each block, as in RocksDB.
+static void BM_Output(benchmark::State& state, const std::string& strategy) {
+  std::shared_ptr<Compressor> compressor;
+  ConfigOptions config_options;
+  Status s = Compressor::CreateFromString(
+      config_options,
+      "id=com.intel.iaa_compressor_rocksdb;execution_path=sw;output_buffer=" +
+          strategy,
+      &compressor);
+  if (!s.ok()) {
+    state.SkipWithError(s.ToString().c_str());
+    return;
+  }
+  std::string input = GenerateIAASampleText(state.range(0));
+  CompressionInfo compr_info(CompressionDict::GetEmptyDict());
+  size_t compressed_size = 0;
+  for (auto _ : state) {
+    std::string compressed;
+    s = compressor->Compress(compr_info, input, &compressed);
+    if (!s.ok()) {
+      state.SkipWithError(s.ToString().c_str());
+      return;
+    }
+    benchmark::DoNotOptimize(compressed.data());
+    compressed_size = compressed.size();
+  }
+  state.SetBytesProcessed(state.iterations() * input.size());
+  state.counters["ratio"] =
+      static_cast<double>(input.size()) / compressed_size;
+}
+
+#define BLOCK_SIZES \
+  RangeMultiplier(4)->Range(1 << 10, 1 << 20)->Arg(100000)->Arg(1000000)
+
+BENCHMARK_CAPTURE(BM_Output, Resize, std::string("resize"))->BLOCK_SIZES;
+BENCHMARK_CAPTURE(BM_Output, Scratch, std::string("scratch"))->BLOCK_SIZES;
+
+}  // namespace ROCKSDB_NAMESPACE
+
+// In addition to the Google Benchmark flags (e.g. --benchmark_filter,
+// --benchmark_format=json), --paths=<list> selects the execution paths to
+// benchmark, as a comma-separated list of sw, hw and auto. The default is sw,
+// so that the benchmark runs without IAA hardware.
+int main(int argc, char** argv) {
+  std::vector<std::string> paths = {"sw"};
+  int args = 1;
+  for (int i = 1; i < argc; i++) {
+    if (strncmp(argv[i], "--paths=", 8) == 0) {
+      paths.clear();
+      std::stringstream list(argv[i] + 8);
+      std::string path;
+      while (std::getline(list, path, ',')) {
+        paths.push_back(path);
+      }
+    } else {
+      argv[args++] = argv[i];
+    }
+  }
+  argc = args;
+
+  ROCKSDB_NAMESPACE::RegisterCompressorBenchmarks(paths);
+  benchmark::Initialize(&argc, argv);
+  if (benchmark::ReportUnrecognizedArguments(argc, argv)) {
+    return 1;
+  }
+  benchmark::RunSpecifiedBenchmarks();
+  benchmark::Shutdown();
+  return 0;
+}
@@ -6,11 +6,27 @@
 
 #include <gtest/gtest.h>
 
+#include <atomic>
+#include <chrono>
 #include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
 #include <iostream>
+#include <limits>
+#include <sstream>
+#include <thread>
 #include <tuple>
+#include <vector>
 
+#include "../iaa_calibration.h"
+#include "../iaa_controller.h"
+#include "../iaa_corpus.h"
+#include "../iaa_executor.h"
+#include "../iaa_flight_recorder.h"
+#include "qpl/qpl.h"
 #include "rocksdb/convenience.h"
+#include "rocksdb/perf_level.h"
 #include "util/coding.h"
 
 namespace ROCKSDB_NAMESPACE {
@@ -38,6 +54,55 @@ TEST(Options, DefaultOptions) {
   s = compressor->GetOption(config_options, "parallel_threads", &value);
   ASSERT_TRUE(s.ok());
   ASSERT_EQ(value, "1");
+  s = compressor->GetOption(config_options, "zero_compress", &value);
+  ASSERT_TRUE(s.ok());
+  ASSERT_EQ(value, "none");
+  s = compressor->GetOption(config_options, "zero_compress_deflate", &value);
+  ASSERT_TRUE(s.ok());
+  ASSERT_EQ(value, "false");
+  s = compressor->GetOption(config_options, "integrity", &value);
+  ASSERT_TRUE(s.ok());
+  ASSERT_EQ(value, "none");
+  s = compressor->GetOption(config_options, "verify_one_in", &value);
+  ASSERT_TRUE(s.ok());
+  ASSERT_EQ(value, "0");
+  s = compressor->GetOption(config_options, "flight_recorder", &value);
+  ASSERT_TRUE(s.ok());
+  ASSERT_EQ(value, "false");
+  s = compressor->GetOption(config_options, "flight_recorder_threshold_us",
+                            &value);
+  ASSERT_TRUE(s.ok());
+  ASSERT_EQ(value, "0");
+  s = compressor->GetOption(config_options, "flight_recorder_path", &value);
+  ASSERT_TRUE(s.ok());
+  ASSERT_EQ(value, "/tmp/iaa_flight_recorder.txt");
+  s = compressor->GetOption(config_options, "warm_up_jobs", &value);
+  ASSERT_TRUE(s.ok());
+  ASSERT_EQ(value, "0");
+  s = compressor->GetOption(config_options, "warm_up_async", &value);
+  ASSERT_TRUE(s.ok());
+  ASSERT_EQ(value, "false");
+  s = compressor->GetOption(config_options, "calibration_profile", &value);
+  ASSERT_TRUE(s.ok());
+  ASSERT_EQ(value, "");
+  s = compressor->GetOption(config_options, "controller", &value);
+  ASSERT_TRUE(s.ok());
+  ASSERT_EQ(value, "none");
+  s = compressor->GetOption(config_options, "target_mbps", &value);
+  ASSERT_TRUE(s.ok());
+  ASSERT_EQ(value, "100");
+  s = compressor->GetOption(config_options, "cpu_budget_ns_per_kb", &value);
+  ASSERT_TRUE(s.ok());
+  ASSERT_EQ(value, "0");
+  s = compressor->GetOption(config_options, "controller_window_ms", &value);
+  ASSERT_TRUE(s.ok());
+  ASSERT_EQ(value, "100");
+  s = compressor->GetOption(config_options, "policies", &value);
+  ASSERT_TRUE(s.ok());
+  ASSERT_EQ(value, "");
+  s = compressor->GetOption(config_options, "output_buffer", &value);
+  ASSERT_TRUE(s.ok());
+  ASSERT_EQ(value, "scratch");
 }
 
 TEST(Options, NonDefaultOptions) {
@@ -47,7 +112,13 @@ TEST(Options, NonDefaultOptions) {
       Compressor::CreateFromString(config_options,
                                    "id=com.intel.iaa_compressor_rocksdb;"
                                    "execution_path=hw;compression_mode=fixed;"
-                                   "verify=true;level=1;parallel_threads=2",
+                                   "verify=true;level=1;parallel_threads=2;"
+                                   "zero_compress=z32;"
+                                   "zero_compress_deflate=true;"
+                                   "integrity=crc;verify_one_in=8;"
+                                   "flight_recorder=true;"
+                                   "flight_recorder_threshold_us=500;"
+                                   "flight_recorder_path=/tmp/iaa.txt",
                                    &compressor);
   ASSERT_TRUE(s.ok());
 
@@ -67,6 +138,28 @@ TEST(Options, NonDefaultOptions) {
   s = compressor->GetOption(config_options, "parallel_threads", &value);
   ASSERT_TRUE(s.ok());
   ASSERT_EQ(value, "2");
+  s = compressor->GetOption(config_options, "zero_compress", &value);
+  ASSERT_TRUE(s.ok());
+  ASSERT_EQ(value, "z32");
+  s = compressor->GetOption(config_options, "zero_compress_deflate", &value);
+  ASSERT_TRUE(s.ok());
+  ASSERT_EQ(value, "true");
+  s = compressor->GetOption(config_options, "integrity", &value);
+  ASSERT_TRUE(s.ok());
+  ASSERT_EQ(value, "crc");
+  s = compressor->GetOption(config_options, "verify_one_in", &value);
+  ASSERT_TRUE(s.ok());
+  ASSERT_EQ(value, "8");
+  s = compressor->GetOption(config_options, "flight_recorder", &value);
+  ASSERT_TRUE(s.ok());
+  ASSERT_EQ(value, "true");
+  s = compressor->GetOption(config_options, "flight_recorder_threshold_us",
+                            &value);
+  ASSERT_TRUE(s.ok());
+  ASSERT_EQ(value, "500");
+  s = compressor->GetOption(config_options, "flight_recorder_path", &value);
+  ASSERT_TRUE(s.ok());
+  ASSERT_EQ(value, "/tmp/iaa.txt");
 }
 
 TEST(Options, InvalidOptions) {
@@ -117,6 +210,20 @@ char* GenerateBlock(size_t length, int seed = 0) {
   return buf;
 }
 
+// Block of 32-bit counters where only one in every eight is non-zero
+char* GenerateSparseBlock(size_t length) {
+  char* buf = (char*)calloc(length, 1);
+  if (!buf) {
+    return nullptr;
+  }
+  for (size_t i = 0; i + sizeof(uint32_t) <= length;
+       i += 8 * sizeof(uint32_t)) {
+    uint32_t counter = static_cast<uint32_t>(i) + 1;
+    memcpy(buf + i, &counter, sizeof(counter));
+  }
+  return buf;
+}
+
 void DestroyBlock(char* buf) { free(buf); }
 
 class NullMemoryAllocator : public MemoryAllocator {
@@ -139,6 +246,85 @@ class ExceptionMemoryAllocator : public MemoryAllocator {
   void Deallocate(void* /*p*/) override {}
 };
 
+std::unordered_map<std::string, std::string> GetStats(Compressor* compressor) {
+  std::string value;
+  ConfigOptions config_options;
+  Status s = compressor->GetOption(config_options, "stats", &value);
+  EXPECT_TRUE(s.ok()) << s.ToString();
+  std::unordered_map<std::string, std::string> stats;
+  s = StringToMap(value, &stats);
+  EXPECT_TRUE(s.ok()) << s.ToString();
+  return stats;
+}
+
+// Options change while other threads compress and uncompress
+TEST(Options, Reconfigure) {
+  size_t input_length = 16384;
+  char* input = GenerateBlock(input_length);
+  ASSERT_NE(input, nullptr);
+
+  std::shared_ptr<Compressor> compressor;
+  ConfigOptions config_options;
+  Status s = Compressor::CreateFromString(
+      config_options, "id=com.intel.iaa_compressor_rocksdb;execution_path=sw",
+      &compressor);
+  ASSERT_TRUE(s.ok()) << s.ToString();
+
+  std::atomic<bool> stop{false};
+  std::atomic<int> failures{0};
+  std::vector<std::thread> threads;
+  for (int t = 0; t < 4; t++) {
+    threads.emplace_back([&]() {
+      CompressionInfo compr_info(CompressionDict::GetEmptyDict());
+      UncompressionInfo uncompr_info(UncompressionDict::GetEmptyDict());
+      while (!stop.load()) {
+        std::string compressed;
+        char* uncompressed = nullptr;
+        size_t uncompressed_length = 0;
+        Status status = compressor->Compress(
+            compr_info, Slice(input, input_length), &compressed);
+        if (status.ok()) {
+          status = compressor->Uncompress(uncompr_info, compressed.c_str(),
+                                          compressed.length(), &uncompressed,
+                                          &uncompressed_length);
+        }
+        if (!status.ok() || uncompressed_length != input_length ||
+            memcmp(uncompressed, input, input_length) != 0) {
+          failures++;
+        }
+        delete[] uncompressed;
+      }
+    });
+  }
+  for (int i = 0; i < 100; i++) {
+    s = compressor->ConfigureFromString(
+        config_options, i % 2 == 0 ? "compression_mode=fixed;verify=true;"
+                                     "zero_compress=auto;integrity=crc"
+                                   : "compression_mode=dynamic;verify=false;"
+                                     "zero_compress=none;integrity=none");
+    ASSERT_TRUE(s.ok()) << s.ToString();
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  }
+  stop = true;
+  for (std::thread& thread : threads) {
+    thread.join();
+  }
+  ASSERT_EQ(failures.load(), 0);
+
+  // Move traffic to another execution path
+  s = compressor->ConfigureFromString(
+      config_options, "execution_path=hw;executor={id=emulator}");
+  ASSERT_TRUE(s.ok()) << s.ToString();
+  CompressionInfo compr_info(CompressionDict::GetEmptyDict());
+  std::string compressed;
+  s = compressor->Compress(compr_info, Slice(input, input_length),
+                           &compressed);
+  ASSERT_TRUE(s.ok()) << s.ToString();
+  ASSERT_EQ(GetStats(compressor.get())["hw_path_jobs"], "1");
+
+  DestroyBlock(input);
+}
+
 TEST(ErrorConditions, AllocationError) {
   size_t input_length = 1024;
   char* input = GenerateBlock(input_length);
@@ -256,72 +442,342 @@ TEST(ErrorConditions, UncompressWrongSize) {
   DestroyBlock(input);
 }
 
-struct TestParam {
-  TestParam(std::string _execution_path, std::string _compression_mode,
-            std::string _other_opts, size_t _block_size,
-            unsigned int _num_blocks = 1)
-      : execution_path(_execution_path),
-        compression_mode(_compression_mode),
-        other_opts(_other_opts),
-        block_size(_block_size),
-        num_blocks(_num_blocks) {}
+TEST(ZeroCompress, SparseBlock) {
+  size_t input_length = 65536 + 100;
+  char* input = GenerateSparseBlock(input_length);
+  ASSERT_NE(input, nullptr);
 
-  std::string execution_path;
-  std::string compression_mode;
-  std::string other_opts;
-  size_t block_size;
-  unsigned int num_blocks;
+  for (std::string opts :
+       {"zero_compress=z16", "zero_compress=z32", "zero_compress=auto",
+        "zero_compress=auto;zero_compress_deflate=true"}) {
+    std::shared_ptr<Compressor> compressor;
+    ConfigOptions config_options;
+    Status s = Compressor::CreateFromString(
+        config_options,
+        "id=com.intel.iaa_compressor_rocksdb;execution_path=sw;" + opts,
+        &compressor);
+    ASSERT_TRUE(s.ok()) << s.ToString();
 
-  std::string GetOpts() {
-    return "execution_path=" + execution_path +
-           ";compression_mode=" + compression_mode + ";" + other_opts;
+    CompressionInfo compr_info(CompressionDict::GetEmptyDict());
+    std::string compressed;
+    Slice data(input, input_length);
+    s = compressor->Compress(compr_info, data, &compressed);
+    ASSERT_TRUE(s.ok()) << opts << ": " << s.ToString();
+    ASSERT_LT(compressed.length(), input_length / 2) << opts;
+
+    UncompressionInfo uncompr_info(UncompressionDict::GetEmptyDict());
+    char* uncompressed;
+    size_t uncompressed_length;
+    s = compressor->Uncompress(uncompr_info, compressed.c_str(),
+                               compressed.length(), &uncompressed,
+                               &uncompressed_length);
+    ASSERT_TRUE(s.ok()) << opts << ": " << s.ToString();
+    ASSERT_EQ(uncompressed_length, input_length);
+    ASSERT_TRUE(memcmp(uncompressed, input, input_length) == 0) << opts;
+    delete[] uncompressed;
   }
-};
 
-class IAACompressorTest
-    : public testing::TestWithParam<std::tuple<
-          std::string, std::string, std::string, size_t, unsigned int>> {
- public:
-  static void SetUpTestSuite() {
-    ObjectLibrary::Default()->AddFactory<Compressor>(
-        "com.intel.iaa_compressor_rocksdb",
-        [](const std::string& /* uri */, std::unique_ptr<Compressor>* c,
-           std::string* /* errmsg */) {
-          c->reset(NewIAACompressor().get());
-          return c->get();
-        });
+  DestroyBlock(input);
+}
+
+// Zero compression jobs run on the path of the policy of the block
+TEST(ZeroCompress, PolicyPath) {
+  size_t input_length = 65536 + 100;
+  char* input = GenerateSparseBlock(input_length);
+  ASSERT_NE(input, nullptr);
+  std::shared_ptr<Compressor> compressor;
+  ConfigOptions config_options;
+  Status s = Compressor::CreateFromString(
+      config_options,
+      "id=com.intel.iaa_compressor_rocksdb;execution_path=sw;"
+      "executor={id=emulator};zero_compress=z16;policies=L1-:hw:dynamic",
+      &compressor);
+  ASSERT_TRUE(s.ok()) << s.ToString();
+
+  SetIAAThreadOutputLevel(1);
+  CompressionInfo compr_info(CompressionDict::GetEmptyDict());
+  std::string compressed;
+  s = compressor->Compress(compr_info, Slice(input, input_length),
+                           &compressed);
+  SetIAAThreadOutputLevel(-1);
+  ASSERT_TRUE(s.ok()) << s.ToString();
+  auto stats = GetStats(compressor.get());
+  ASSERT_EQ(stats["sw_path_jobs"], "0");
+  ASSERT_NE(stats["hw_path_jobs"], "0");
+
+  // Decompression runs on the path of the options
+  UncompressionInfo uncompr_info(UncompressionDict::GetEmptyDict());
+  char* uncompressed;
+  size_t uncompressed_length;
+  s = compressor->Uncompress(uncompr_info, compressed.c_str(),
+                             compressed.length(), &uncompressed,
+                             &uncompressed_length);
+  ASSERT_TRUE(s.ok()) << s.ToString();
+  ASSERT_EQ(uncompressed_length, input_length);
+  ASSERT_EQ(memcmp(uncompressed, input, input_length), 0);
+  delete[] uncompressed;
+  ASSERT_NE(GetStats(compressor.get())["sw_path_jobs"], "0");
+
+  DestroyBlock(input);
+}
+
+TEST(ZeroCompress, DeflateBlockReadable) {
+  // Blocks written without zero compression must be readable by a compressor
+  // configured with it, and vice versa.
+  size_t input_length = 4096;
+  char* input = GenerateSparseBlock(input_length);
+  ASSERT_NE(input, nullptr);
+
+  std::shared_ptr<Compressor> deflate_compressor;
+  std::shared_ptr<Compressor> zero_compressor;
+  ConfigOptions config_options;
+  Status s = Compressor::CreateFromString(
+      config_options, "id=com.intel.iaa_compressor_rocksdb;execution_path=sw",
+      &deflate_compressor);
+  ASSERT_TRUE(s.ok()) << s.ToString();
+  s = Compressor::CreateFromString(config_options,
+                                   "id=com.intel.iaa_compressor_rocksdb;"
+                                   "execution_path=sw;zero_compress=z32",
+                                   &zero_compressor);
+  ASSERT_TRUE(s.ok()) << s.ToString();
+
+  CompressionInfo compr_info(CompressionDict::GetEmptyDict());
+  UncompressionInfo uncompr_info(UncompressionDict::GetEmptyDict());
+  Slice data(input, input_length);
+  for (auto& pair : {std::make_pair(deflate_compressor, zero_compressor),
+                     std::make_pair(zero_compressor, deflate_compressor)}) {
+    std::string compressed;
+    s = pair.first->Compress(compr_info, data, &compressed);
+    ASSERT_TRUE(s.ok()) << s.ToString();
+
+    char* uncompressed;
+    size_t uncompressed_length;
+    s = pair.second->Uncompress(uncompr_info, compressed.c_str(),
+                                compressed.length(), &uncompressed,
+                                &uncompressed_length);
+    ASSERT_TRUE(s.ok()) << s.ToString();
+    ASSERT_EQ(uncompressed_length, input_length);
+    ASSERT_TRUE(memcmp(uncompressed, input, input_length) == 0);
+    delete[] uncompressed;
   }
 
-  void SetUp() override {
-    TestParam test_param(std::get<0>(GetParam()), std::get<1>(GetParam()),
-                         std::get<2>(GetParam()), std::get<3>(GetParam()),
-                         std::get<4>(GetParam()));
-    ;
+  DestroyBlock(input);
+}
+
+TEST(ZeroCompress, CorruptSize) {
+  size_t input_length = 65536 + 100;
+  char* input = GenerateSparseBlock(input_length);
+  ASSERT_NE(input, nullptr);
+  std::shared_ptr<Compressor> compressor;
+  ConfigOptions config_options;
+  Status s = Compressor::CreateFromString(
+      config_options,
+      "id=com.intel.iaa_compressor_rocksdb;execution_path=sw;"
+      "zero_compress=z32;zero_compress_deflate=true",
+      &compressor);
+  ASSERT_TRUE(s.ok()) << s.ToString();
+
+  CompressionInfo compr_info(CompressionDict::GetEmptyDict());
+  std::string compressed;
+  s = compressor->Compress(compr_info, Slice(input, input_length),
+                           &compressed);
+  ASSERT_TRUE(s.ok()) << s.ToString();
+
+  // The zero-compressed size follows the header
+  uint64_t header;
+  const char* end = compressed.data() + compressed.size();
+  const char* size = GetVarint64Ptr(compressed.data(), end, &header);
+  ASSERT_NE(size, nullptr);
+  uint32_t zero_length;
+  const char* payload = GetVarint32Ptr(size, end, &zero_length);
+  ASSERT_NE(payload, nullptr);
+  std::string prefix(compressed.data(), size - compressed.data());
+
+  // Larger than zero compression can produce: rejected before allocation
+  std::string overlong = prefix;
+  PutVarint32(&overlong, std::numeric_limits<uint32_t>::max());
+  overlong.append(payload, end - payload);
+  // Truncated in the middle of the varint
+  std::string truncated = prefix + "\xff" + std::string(100, '\0');
+
+  UncompressionInfo uncompr_info(UncompressionDict::GetEmptyDict());
+  for (auto& test : {std::make_pair(overlong, "Corruption: size mismatch"),
+                     std::make_pair(truncated,
+                                    "Corruption: size decoding error")}) {
+    char* uncompressed = nullptr;
+    size_t uncompressed_length = 0;
+    s = compressor->Uncompress(uncompr_info, test.first.c_str(),
+                               test.first.length(), &uncompressed,
+                               &uncompressed_length);
+    ASSERT_TRUE(s.IsCorruption()) << s.ToString();
+    ASSERT_EQ(s.ToString(), test.second);
+    delete[] uncompressed;
+  }
+
+  DestroyBlock(input);
+}
+
+// Checks that a corrupt checksum of input is detected for each option
+void ChecksumMismatch(const char* input, size_t input_length) {
+  for (std::string opts :
+       {"integrity=crc", "integrity=crc;verify_one_in=2",
+        "integrity=crc;zero_compress=z32",
+        "integrity=crc;zero_compress=z16;zero_compress_deflate=true"}) {
+    std::shared_ptr<Compressor> compressor;
     ConfigOptions config_options;
-    Compressor::CreateFromString(
+    Status s = Compressor::CreateFromString(
         config_options,
-        "id=com.intel.iaa_compressor_rocksdb;" + test_param.GetOpts(),
+        "id=com.intel.iaa_compressor_rocksdb;execution_path=sw;" + opts,
         &compressor);
+    ASSERT_TRUE(s.ok()) << s.ToString();
+
+    CompressionInfo compr_info(CompressionDict::GetEmptyDict());
+    std::string compressed;
+    Slice data(input, input_length);
+    s = compressor->Compress(compr_info, data, &compressed);
+    ASSERT_TRUE(s.ok()) << opts << ": " << s.ToString();
+
+    UncompressionInfo uncompr_info(UncompressionDict::GetEmptyDict());
+    char* uncompressed;
+    size_t uncompressed_length;
+    s = compressor->Uncompress(uncompr_info, compressed.c_str(),
+                               compressed.length(), &uncompressed,
+                               &uncompressed_length);
+    ASSERT_TRUE(s.ok()) << opts << ": " << s.ToString();
+    ASSERT_EQ(uncompressed_length, input_length);
+    ASSERT_TRUE(memcmp(uncompressed, input, input_length) == 0) << opts;
+    delete[] uncompressed;
+
+    // Corrupt the checksum, which follows the header
+    uint64_t header;
+    const char* checksum = GetVarint64Ptr(
+        compressed.data(), compressed.data() + compressed.size(), &header);
+    ASSERT_NE(checksum, nullptr);
+    compressed[checksum - compressed.data()] ^= 1;
+    s = compressor->Uncompress(uncompr_info, compressed.c_str(),
+                               compressed.length(), &uncompressed,
+                               &uncompressed_length);
+    ASSERT_TRUE(s.IsCorruption()) << opts;
+    ASSERT_EQ(s.ToString(), "Corruption: checksum mismatch") << opts;
+    delete[] uncompressed;
+  }
+}
+
+TEST(Integrity, ChecksumMismatch) {
+  // Zero compression leaves the bytes after the last 128-byte unit of an
+  // unaligned block uncompressed
+  for (size_t input_length : {65536, 65536 + 100}) {
+    char* input = GenerateSparseBlock(input_length);
+    ASSERT_NE(input, nullptr);
+    SCOPED_TRACE(input_length);
+    ChecksumMismatch(input, input_length);
+    DestroyBlock(input);
+    ASSERT_FALSE(HasFatalFailure());
   }
+}
+
+TEST(Stats, Counters) {
+  size_t input_length = 4096;
+  char* input = GenerateBlock(input_length);
+  ASSERT_NE(input, nullptr);
 
   std::shared_ptr<Compressor> compressor;
-};
+  ConfigOptions config_options;
+  Status s = Compressor::CreateFromString(
+      config_options, "id=com.intel.iaa_compressor_rocksdb;execution_path=sw",
+      &compressor);
+  ASSERT_TRUE(s.ok()) << s.ToString();
 
-TEST_P(IAACompressorTest, CompressDecompress) {
-  TestParam test_param(std::get<0>(GetParam()), std::get<1>(GetParam()),
-                       std::get<2>(GetParam()), std::get<3>(GetParam()),
-                       std::get<4>(GetParam()));
+  CompressionInfo compr_info(CompressionDict::GetEmptyDict());
+  std::string compressed;
+  Slice data(input, input_length);
+  s = compressor->Compress(compr_info, data, &compressed);
+  ASSERT_TRUE(s.ok()) << s.ToString();
 
-  size_t input_length = test_param.block_size;
+  UncompressionInfo uncompr_info(UncompressionDict::GetEmptyDict());
+  char* uncompressed;
+  size_t uncompressed_length;
+  for (int i = 0; i < 2; i++) {
+    s = compressor->Uncompress(uncompr_info, compressed.c_str(),
+                               compressed.length(), &uncompressed,
+                               &uncompressed_length);
+    ASSERT_TRUE(s.ok()) << s.ToString();
+    delete[] uncompressed;
+  }
+  std::string empty;
+  s = compressor->Compress(compr_info, Slice(nullptr, 0), &empty);
+  ASSERT_TRUE(s.IsCorruption());
+
+  std::string value;
+  s = compressor->GetOption(config_options, "stats", &value);
+  ASSERT_TRUE(s.ok()) << s.ToString();
+  std::unordered_map<std::string, std::string> stats;
+  s = StringToMap(value, &stats);
+  ASSERT_TRUE(s.ok()) << s.ToString();
+  ASSERT_EQ(stats["compress_calls"], "2");
+  ASSERT_EQ(stats["compress_errors"], "1");
+  ASSERT_EQ(stats["compress_bytes_in"], std::to_string(input_length));
+  ASSERT_EQ(stats["compress_bytes_out"], std::to_string(compressed.length()));
+  ASSERT_EQ(stats["uncompress_calls"], "2");
+  ASSERT_EQ(stats["uncompress_bytes_out"], std::to_string(2 * input_length));
+  ASSERT_EQ(stats["sw_path_jobs"], "4");
+  ASSERT_EQ(stats["hw_path_jobs"], "0");
+  ASSERT_EQ(stats["compress_latency_count"], "2");
+  ASSERT_EQ(stats["uncompress_latency_count"], "2");
+  ASSERT_NE(stats["uncompress_latency_max_ns"], "0");
+  ASSERT_EQ(stats["qpl_status_50"], "1");
+
+  // Statistics are not part of the serialized options
+  std::string options;
+  s = compressor->GetOptionString(config_options, &options);
+  ASSERT_TRUE(s.ok()) << s.ToString();
+  ASSERT_EQ(options.find("compress_calls"), std::string::npos);
+  ASSERT_NE(compressor->GetPrintableOptions().find("uncompress_calls=2"),
+            std::string::npos);
+
+  DestroyBlock(input);
+}
+
+std::string ReadFile(const std::string& path) {
+  std::ifstream file(path);
+  std::stringstream contents;
+  contents << file.rdbuf();
+  return contents.str();
+}
+
+TEST(Stats, FlightRecorder) {
+  size_t input_length = 4096;
   char* input = GenerateBlock(input_length);
   ASSERT_NE(input, nullptr);
+  std::string path = "/tmp/iaa_flight_recorder_test.txt";
+  std::remove(path.c_str());
+
+  // Any call takes longer than 1us, so the first one triggers a dump
+  std::shared_ptr<Compressor> compressor;
+  ConfigOptions config_options;
+  Status s = Compressor::CreateFromString(
+      config_options,
+      "id=com.intel.iaa_compressor_rocksdb;execution_path=sw;"
+      "flight_recorder=true;flight_recorder_threshold_us=1;"
+      "flight_recorder_path=" +
+          path,
+      &compressor);
+  ASSERT_TRUE(s.ok()) << s.ToString();
 
   CompressionInfo compr_info(CompressionDict::GetEmptyDict());
   std::string compressed;
-  Slice data(input, input_length);
-  Status s = compressor->Compress(compr_info, data, &compressed);
+  s = compressor->Compress(compr_info, Slice(input, input_length),
+                           &compressed);
   ASSERT_TRUE(s.ok()) << s.ToString();
+  // The dump is written by a background thread
+  FlightRecorder::Instance().WaitForDumps();
+  std::string dump = ReadFile(path);
+  ASSERT_NE(dump.find("compress path=sw mode=dynamic input=4096 output=" +
+                      std::to_string(compressed.size())),
+            std::string::npos)
+      << dump;
 
+  // Further dumps are rate limited, but events are still recorded
   UncompressionInfo uncompr_info(UncompressionDict::GetEmptyDict());
   char* uncompressed;
   size_t uncompressed_length;
@@ -329,23 +785,1176 @@ TEST_P(IAACompressorTest, CompressDecompress) {
                              compressed.length(), &uncompressed,
                              &uncompressed_length);
   ASSERT_TRUE(s.ok()) << s.ToString();
-  ASSERT_EQ(uncompressed_length, input_length);
-  ASSERT_TRUE(memcmp(uncompressed, input, input_length) == 0);
   delete[] uncompressed;
+  FlightRecorder::Instance().WaitForDumps();
+  ASSERT_EQ(ReadFile(path), dump);
+
+  std::remove(path.c_str());
+  s = DumpIAAFlightRecorder(path);
+  ASSERT_TRUE(s.ok()) << s.ToString();
+  dump = ReadFile(path);
+  ASSERT_NE(dump.find("uncompress path=sw mode=dynamic input=" +
+                      std::to_string(compressed.size()) + " output=4096"),
+            std::string::npos)
+      << dump;
+  std::remove(path.c_str());
 
   DestroyBlock(input);
 }
 
-#define BLOCK_SIZES                                                       \
-  100, 1 << 8, 1000, 1 << 10, 1 << 12, 1 << 14, 1 << 16, 100000, 1000000, \
-      1 << 20
+TEST(Corpus, Capture) {
+  size_t input_length = 4096;
+  char* input = GenerateBlock(input_length);
+  ASSERT_NE(input, nullptr);
+  std::string path = "/tmp/iaa_corpus_test.bin";
+  std::string compressed;
+  {
+    std::shared_ptr<Compressor> compressor;
+    ConfigOptions config_options;
+    Status s = Compressor::CreateFromString(
+        config_options,
+        "id=com.intel.iaa_capture_rocksdb;"
+        "compressor={id=com.intel.iaa_compressor_rocksdb;execution_path=sw};"
+        "capture_reads=true;corpus_path=" +
+            path,
+        &compressor);
+    ASSERT_TRUE(s.ok()) << s.ToString();
 
-INSTANTIATE_TEST_SUITE_P(CompressSWDecompressSW, IAACompressorTest,
-                         testing::Combine(testing::Values("sw"),
-                                          testing::Values("dynamic", "fixed"),
-                                          testing::Values("level=0", "level=1"),
-                                          testing::Values(BLOCK_SIZES),
-                                          testing::Values(1)));
+    CompressionInfo compr_info(CompressionDict::GetEmptyDict());
+    s = compressor->Compress(compr_info, Slice(input, input_length),
+                             &compressed);
+    ASSERT_TRUE(s.ok()) << s.ToString();
+    UncompressionInfo uncompr_info(UncompressionDict::GetEmptyDict());
+    char* uncompressed;
+    size_t uncompressed_length;
+    s = compressor->Uncompress(uncompr_info, compressed.c_str(),
+                               compressed.length(), &uncompressed,
+                               &uncompressed_length);
+    ASSERT_TRUE(s.ok()) << s.ToString();
+    delete[] uncompressed;
+  }
+
+  // Blocks are in the format of the wrapped compressor
+  std::shared_ptr<Compressor> iaa;
+  ConfigOptions config_options;
+  Status s = Compressor::CreateFromString(
+      config_options, "id=com.intel.iaa_compressor_rocksdb;execution_path=sw",
+      &iaa);
+  ASSERT_TRUE(s.ok()) << s.ToString();
+  UncompressionInfo uncompr_info(UncompressionDict::GetEmptyDict());
+  char* uncompressed;
+  size_t uncompressed_length;
+  s = iaa->Uncompress(uncompr_info, compressed.c_str(), compressed.length(),
+                      &uncompressed, &uncompressed_length);
+  ASSERT_TRUE(s.ok()) << s.ToString();
+  delete[] uncompressed;
+
+  std::vector<CorpusRecord> corpus;
+  s = ReadCorpus(path, &corpus);
+  ASSERT_TRUE(s.ok()) << s.ToString();
+  ASSERT_EQ(corpus.size(), 2);
+  ASSERT_EQ(corpus[0].op, CorpusRecord::kCompress);
+  ASSERT_EQ(corpus[0].data, std::string(input, input_length));
+  ASSERT_EQ(corpus[1].op, CorpusRecord::kUncompress);
+  ASSERT_EQ(corpus[1].data, corpus[0].data);
+  ASSERT_LE(corpus[0].time_nanos, corpus[1].time_nanos);
+  std::remove(path.c_str());
+
+  DestroyBlock(input);
+}
+
+// Capture compressors writing to the same file share it
+TEST(Corpus, SharedFile) {
+  size_t input_length = 4096;
+  char* input = GenerateBlock(input_length);
+  ASSERT_NE(input, nullptr);
+  std::string path = "/tmp/iaa_corpus_test.bin";
+  {
+    std::vector<std::shared_ptr<Compressor>> compressors(2);
+    ConfigOptions config_options;
+    for (auto& compressor : compressors) {
+      Status s = Compressor::CreateFromString(
+          config_options,
+          "id=com.intel.iaa_capture_rocksdb;"
+          "compressor={id=com.intel.iaa_compressor_rocksdb;"
+          "execution_path=sw};corpus_path=" +
+              path,
+          &compressor);
+      ASSERT_TRUE(s.ok()) << s.ToString();
+    }
+    CompressionInfo compr_info(CompressionDict::GetEmptyDict());
+    for (auto& compressor : compressors) {
+      std::string compressed;
+      Status s = compressor->Compress(compr_info, Slice(input, input_length),
+                                      &compressed);
+      ASSERT_TRUE(s.ok()) << s.ToString();
+    }
+  }
+
+  std::vector<CorpusRecord> corpus;
+  Status s = ReadCorpus(path, &corpus);
+  ASSERT_TRUE(s.ok()) << s.ToString();
+  ASSERT_EQ(corpus.size(), 2);
+  ASSERT_EQ(corpus[1].data, std::string(input, input_length));
+  std::remove(path.c_str());
+
+  // A file that cannot be opened is reported
+  std::shared_ptr<CorpusWriter> writer;
+  s = GetCorpusWriter("/nonexistent/iaa_corpus.bin", 1024, &writer);
+  ASSERT_TRUE(s.IsIOError()) << s.ToString();
+
+  DestroyBlock(input);
+}
+
+// A changed corpus_path takes effect when the compressor is prepared again
+TEST(Corpus, Reconfigure) {
+  size_t input_length = 4096;
+  char* input = GenerateBlock(input_length);
+  ASSERT_NE(input, nullptr);
+  std::vector<std::string> paths = {"/tmp/iaa_corpus_test.bin",
+                                    "/tmp/iaa_corpus_test2.bin"};
+  std::string options =
+      "id=com.intel.iaa_capture_rocksdb;"
+      "compressor={id=com.intel.iaa_compressor_rocksdb;execution_path=sw};"
+      "corpus_path=";
+  CompressionInfo compr_info(CompressionDict::GetEmptyDict());
+  {
+    std::shared_ptr<Compressor> compressor;
+    ConfigOptions config_options;
+    Status s = Compressor::CreateFromString(config_options,
+                                            options + paths[0], &compressor);
+    ASSERT_TRUE(s.ok()) << s.ToString();
+    for (const std::string& path : paths) {
+      s = compressor->ConfigureFromString(config_options,
+                                          "corpus_path=" + path);
+      ASSERT_TRUE(s.ok()) << s.ToString();
+      std::string compressed;
+      s = compressor->Compress(compr_info, Slice(input, input_length),
+                               &compressed);
+      ASSERT_TRUE(s.ok()) << s.ToString();
+    }
+  }
+  for (const std::string& path : paths) {
+    std::vector<CorpusRecord> corpus;
+    Status s = ReadCorpus(path, &corpus);
+    ASSERT_TRUE(s.ok()) << path << ": " << s.ToString();
+    ASSERT_EQ(corpus.size(), 1) << path;
+    std::remove(path.c_str());
+  }
+
+  // Without PrepareOptions, blocks are compressed but not captured
+  std::shared_ptr<Compressor> compressor;
+  ConfigOptions config_options;
+  config_options.invoke_prepare_options = false;
+  Status s = Compressor::CreateFromString(config_options, options + paths[0],
+                                          &compressor);
+  ASSERT_TRUE(s.ok()) << s.ToString();
+  std::string compressed;
+  s = compressor->Compress(compr_info, Slice(input, input_length),
+                           &compressed);
+  ASSERT_TRUE(s.ok()) << s.ToString();
+  ASSERT_TRUE(Env::Default()->FileExists(paths[0]).IsNotFound());
+
+  DestroyBlock(input);
+}
+
+TEST(Emulator, InvalidOptions) {
+  std::shared_ptr<Compressor> compressor;
+  ConfigOptions config_options;
+  Status s = Compressor::CreateFromString(
+      config_options,
+      "id=com.intel.iaa_compressor_rocksdb;executor={id=emulator;wq_depth=0}",
+      &compressor);
+  ASSERT_TRUE(s.IsInvalidArgument()) << s.ToString();
+
+  // WQs are sized when the emulator is first prepared
+  std::shared_ptr<IAAExecutor> executor;
+  s = IAAExecutor::CreateFromString(config_options, "id=emulator;devices=2",
+                                    &executor);
+  ASSERT_TRUE(s.ok()) << s.ToString();
+  s = executor->ConfigureFromString(config_options, "wqs=2");
+  ASSERT_TRUE(s.IsInvalidArgument()) << s.ToString();
+  s = executor->ConfigureFromString(config_options, "wqs=1;wq_depth=4");
+  ASSERT_TRUE(s.ok()) << s.ToString();
+}
+
+TEST(Emulator, Faults) {
+  size_t input_length = 4096;
+  char* input = GenerateBlock(input_length);
+  ASSERT_NE(input, nullptr);
+
+  std::shared_ptr<Compressor> compressor;
+  ConfigOptions config_options;
+  Status s = Compressor::CreateFromString(
+      config_options,
+      "id=com.intel.iaa_compressor_rocksdb;execution_path=hw;"
+      "executor={id=emulator;fault_one_in=1}",
+      &compressor);
+  ASSERT_TRUE(s.ok()) << s.ToString();
+
+  CompressionInfo compr_info(CompressionDict::GetEmptyDict());
+  std::string compressed;
+  s = compressor->Compress(compr_info, Slice(input, input_length),
+                           &compressed);
+  ASSERT_TRUE(s.IsCorruption()) << s.ToString();
+  auto stats = GetStats(compressor.get());
+  ASSERT_EQ(stats["compress_errors"], "1");
+  ASSERT_EQ(stats["hw_path_jobs"], "1");
+  ASSERT_EQ(stats["qpl_status_" + std::to_string(QPL_STS_LIBRARY_INTERNAL_ERR)],
+            "1");
+
+  DestroyBlock(input);
+}
+
+// Threads contend for a single WQ slot, so submissions are rejected as busy
+// and retried until the slot is released
+TEST(Emulator, QueueFull) {
+  size_t input_length = 16384;
+  char* input = GenerateBlock(input_length);
+  ASSERT_NE(input, nullptr);
+
+  std::shared_ptr<Compressor> compressor;
+  ConfigOptions config_options;
+  Status s = Compressor::CreateFromString(
+      config_options,
+      "id=com.intel.iaa_compressor_rocksdb;execution_path=hw;"
+      "executor={id=emulator;devices=1;wqs=1;wq_depth=1;latency_us=100}",
+      &compressor);
+  ASSERT_TRUE(s.ok()) << s.ToString();
+
+  std::vector<std::thread> threads;
+  std::atomic<int> failures{0};
+  for (int t = 0; t < 4; t++) {
+    threads.emplace_back([&]() {
+      CompressionInfo compr_info(CompressionDict::GetEmptyDict());
+      UncompressionInfo uncompr_info(UncompressionDict::GetEmptyDict());
+      for (int i = 0; i < 10; i++) {
+        std::string compressed;
+        char* uncompressed = nullptr;
+        size_t uncompressed_length = 0;
+        Status status = compressor->Compress(
+            compr_info, Slice(input, input_length), &compressed);
+        if (status.ok()) {
+          status = compressor->Uncompress(uncompr_info, compressed.c_str(),
+                                          compressed.length(), &uncompressed,
+                                          &uncompressed_length);
+        }
+        if (!status.ok() || uncompressed_length != input_length ||
+            memcmp(uncompressed, input, input_length) != 0) {
+          failures++;
+        }
+        delete[] uncompressed;
+      }
+    });
+  }
+  for (std::thread& thread : threads) {
+    thread.join();
+  }
+  ASSERT_EQ(failures.load(), 0);
+  auto stats = GetStats(compressor.get());
+  ASSERT_EQ(stats["hw_path_jobs"], "80");
+  ASSERT_NE(stats["busy_retries"], "0");
+
+  DestroyBlock(input);
+}
+
+// Threads sharing histogram shards are all counted, and Reset clears them
+TEST(Stats, HistogramShards) {
+  IAAStats stats;
+  ASSERT_EQ(stats.GetHistogram(kCompressLatency).Count(), 0);
+  std::vector<std::thread> threads;
+  for (uint32_t t = 0; t < 2 * IAAStats::kNumHistogramShards; t++) {
+    threads.emplace_back([&stats, t]() {
+      for (uint64_t i = 0; i < 100; i++) {
+        stats.RecordLatency(kCompressLatency, 1000 * (t + 1));
+        stats.RecordTick(kCompressCalls);
+      }
+    });
+  }
+  for (std::thread& thread : threads) {
+    thread.join();
+  }
+  HistogramData data = stats.GetHistogram(kCompressLatency);
+  ASSERT_EQ(data.Count(), 200 * IAAStats::kNumHistogramShards);
+  ASSERT_EQ(data.Max(), 2000 * IAAStats::kNumHistogramShards);
+  ASSERT_EQ(stats.GetTicker(kCompressCalls),
+            200 * IAAStats::kNumHistogramShards);
+  ASSERT_EQ(stats.GetHistogram(kUncompressLatency).Count(), 0);
+  stats.Reset();
+  ASSERT_EQ(stats.GetHistogram(kCompressLatency).Count(), 0);
+}
+
+// Windows of 1ms with a target of 100MB/s. Each Record call below is the
+// first of a window and evaluates the previous one.
+TEST(Controller, Steps) {
+  IAAStats stats;
+  IAAController controller(&stats);
+  const uint64_t kWindow = 1000000;
+  const uint32_t kTarget = 100;
+  uint64_t now = 1;
+  ASSERT_EQ(controller.Current(), IAAController::kDynamic);
+  controller.Record(IAAController::kDynamic, 0, 0, now, kTarget, kWindow);
+
+  // 20KB in 0.5ms (40MB/s): slower than the target
+  controller.Record(IAAController::kDynamic, 20000, 500000, now + 10, kTarget,
+                    kWindow);
+  now += kWindow;
+  controller.Record(IAAController::kDynamic, 0, 0, now, kTarget, kWindow);
+  ASSERT_EQ(controller.Current(), IAAController::kFixed);
+  ASSERT_EQ(stats.GetTicker(kControllerToSpeed), 1);
+
+  // 100KB in 0.5ms (200MB/s), but the next setting was measured slower than
+  // the target
+  controller.Record(IAAController::kFixed, 100000, 500000, now + 10, kTarget,
+                    kWindow);
+  now += kWindow;
+  controller.Record(IAAController::kFixed, 0, 0, now, kTarget, kWindow);
+  ASSERT_EQ(controller.Current(), IAAController::kFixed);
+
+  // Idle: moves toward ratio regardless of throughput
+  for (int i = 0; i < 3; i++) {
+    now += kWindow;
+    controller.Record(controller.Current(), 100, 10000, now, kTarget, kWindow);
+  }
+  ASSERT_EQ(controller.Current(), IAAController::kHighLevel);
+  ASSERT_EQ(stats.GetTicker(kControllerToRatio), 2);
+
+  // External pressure overrides the estimate
+  controller.SetPressure(IAAController::Pressure::kBacklog);
+  now += kWindow;
+  controller.Record(controller.Current(), 100, 10000, now, kTarget, kWindow);
+  ASSERT_EQ(controller.Current(), IAAController::kDynamic);
+  controller.SetPressure(IAAController::Pressure::kAuto);
+
+  // Backlog: more than a thread busy compressing for the whole window
+  controller.Record(IAAController::kDynamic, 1000000, 2 * kWindow, now + 10,
+                    kTarget, kWindow);
+  now += kWindow;
+  controller.Record(IAAController::kDynamic, 0, 0, now, kTarget, kWindow);
+  ASSERT_EQ(controller.Current(), IAAController::kFixed);
+  ASSERT_EQ(stats.GetTicker(kControllerToSpeed), 3);
+
+  // Concurrent threads: busy time is compared with the window of each thread
+  auto record_concurrently = [&](uint64_t nanos) {
+    std::vector<std::thread> threads;
+    for (int i = 0; i < 4; i++) {
+      threads.emplace_back([&]() {
+        controller.Record(controller.Current(), 100000, nanos, now + 10,
+                          kTarget, kWindow);
+      });
+    }
+    for (auto& thread : threads) {
+      thread.join();
+    }
+    now += kWindow;
+    controller.Record(controller.Current(), 0, 0, now, kTarget, kWindow);
+  };
+  // 4 threads busy for 0.3ms each (333MB/s): not a backlog, and fast enough
+  // to try the next setting
+  record_concurrently(kWindow * 3 / 10);
+  ASSERT_EQ(controller.Current(), IAAController::kDynamic);
+  ASSERT_EQ(stats.GetTicker(kControllerToRatio), 3);
+  // 4 threads busy for the whole window: backlog
+  record_concurrently(kWindow);
+  ASSERT_EQ(controller.Current(), IAAController::kFixed);
+  ASSERT_EQ(stats.GetTicker(kControllerToSpeed), 4);
+}
+
+// With a CPU budget, a setting slower than target_mbps meets the target if it
+// used little CPU time (e.g., waiting for the hardware)
+TEST(Controller, CpuBudget) {
+  IAAStats stats;
+  IAAController controller(&stats);
+  const uint64_t kWindow = 1000000;
+  const uint32_t kTarget = 100;
+  const uint32_t kBudget = 10000;
+  uint64_t now = 1;
+  controller.Record(IAAController::kDynamic, 0, 0, now, kTarget, kWindow, 0,
+                    kBudget);
+
+  // 20KB in 0.5ms (40MB/s) of which 0.1ms of CPU time (5000ns/KB)
+  controller.Record(IAAController::kDynamic, 20480, 500000, now + 10, kTarget,
+                    kWindow, 100000, kBudget);
+  now += kWindow;
+  controller.Record(IAAController::kDynamic, 0, 0, now, kTarget, kWindow, 0,
+                    kBudget);
+  ASSERT_EQ(controller.Current(), IAAController::kHighLevel);
+  ASSERT_EQ(stats.GetTicker(kControllerToRatio), 1);
+
+  // 20KB with 0.4ms of CPU time (20000ns/KB): over the budget
+  controller.Record(IAAController::kHighLevel, 20480, 500000, now + 10,
+                    kTarget, kWindow, 400000, kBudget);
+  now += kWindow;
+  controller.Record(IAAController::kHighLevel, 0, 0, now, kTarget, kWindow, 0,
+                    kBudget);
+  ASSERT_EQ(controller.Current(), IAAController::kDynamic);
+  ASSERT_EQ(stats.GetTicker(kControllerToSpeed), 1);
+}
+
+TEST(Controller, Compressor) {
+  size_t input_length = 65536;
+  char* input = GenerateBlock(input_length);
+  ASSERT_NE(input, nullptr);
+
+  std::shared_ptr<Compressor> compressor;
+  ConfigOptions config_options;
+  Status s = Compressor::CreateFromString(
+      config_options,
+      "id=com.intel.iaa_compressor_rocksdb;execution_path=sw;"
+      "controller=throughput;target_mbps=0",
+      &compressor);
+  ASSERT_TRUE(s.IsInvalidArgument()) << s.ToString();
+  s = Compressor::CreateFromString(
+      config_options,
+      "id=com.intel.iaa_compressor_rocksdb;execution_path=sw;"
+      "controller=throughput;controller_window_ms=5",
+      &compressor);
+  ASSERT_TRUE(s.ok()) << s.ToString();
+
+  // Two threads compressing back to back are a backlog
+  std::atomic<int> failures{0};
+  std::vector<std::thread> threads;
+  for (int t = 0; t < 2; t++) {
+    threads.emplace_back([&]() {
+      CompressionInfo compr_info(CompressionDict::GetEmptyDict());
+      UncompressionInfo uncompr_info(UncompressionDict::GetEmptyDict());
+      uint64_t end = NowNanos() + 200000000;
+      while (NowNanos() < end) {
+        std::string compressed;
+        char* uncompressed = nullptr;
+        size_t uncompressed_length = 0;
+        Status status = compressor->Compress(
+            compr_info, Slice(input, input_length), &compressed);
+        if (status.ok()) {
+          status = compressor->Uncompress(uncompr_info, compressed.c_str(),
+                                          compressed.length(), &uncompressed,
+                                          &uncompressed_length);
+        }
+        if (!status.ok() || uncompressed_length != input_length ||
+            memcmp(uncompressed, input, input_length) != 0) {
+          failures++;
+        }
+        delete[] uncompressed;
+      }
+    });
+  }
+  for (std::thread& thread : threads) {
+    thread.join();
+  }
+  ASSERT_EQ(failures.load(), 0);
+  auto stats = GetStats(compressor.get());
+  ASSERT_NE(stats["controller_to_speed"], "0");
+  ASSERT_NE(stats["controller_fixed_blocks"], "0");
+
+  // After an idle period, blocks move toward ratio
+  std::this_thread::sleep_for(std::chrono::milliseconds(20));
+  CompressionInfo compr_info(CompressionDict::GetEmptyDict());
+  std::string compressed;
+  s = compressor->Compress(compr_info, Slice(input, input_length),
+                           &compressed);
+  ASSERT_TRUE(s.ok()) << s.ToString();
+  ASSERT_NE(GetStats(compressor.get())["controller_to_ratio"], "0");
+
+  DestroyBlock(input);
+}
+
+TEST(Policies, OutputLevels) {
+  ConfigOptions config_options;
+  std::shared_ptr<Compressor> compressor;
+  for (const char* policies :
+       {"L0", "0:sw:fixed", "L2-1:sw:fixed", "L0:sw:canned", "L0:sw:fixed:x",
+        "L0-:sw:fixed:0:1"}) {
+    Status s = Compressor::CreateFromString(
+        config_options,
+        std::string("id=com.intel.iaa_compressor_rocksdb;policies=") +
+            policies,
+        &compressor);
+    ASSERT_TRUE(s.IsInvalidArgument()) << policies << ": " << s.ToString();
+  }
+  Status s = Compressor::CreateFromString(
+      config_options,
+      "id=com.intel.iaa_compressor_rocksdb;execution_path=sw;"
+      "policies=L0-1:sw:fixed,L2-:sw:dynamic:1",
+      &compressor);
+  ASSERT_TRUE(s.ok()) << s.ToString();
+
+  size_t input_length = 65536;
+  char* input = GenerateBlock(input_length);
+  ASSERT_NE(input, nullptr);
+  CompressionInfo compr_info(CompressionDict::GetEmptyDict());
+  auto compress = [&](const std::string& options) {
+    std::shared_ptr<Compressor> reference;
+    EXPECT_TRUE(Compressor::CreateFromString(
+                    config_options,
+                    "id=com.intel.iaa_compressor_rocksdb;execution_path=sw;" +
+                        options,
+                    &reference)
+                    .ok());
+    std::string compressed;
+    EXPECT_TRUE(
+        reference->Compress(compr_info, Slice(input, input_length), &compressed)
+            .ok());
+    return compressed;
+  };
+
+  // Each block is compressed like with the options of the policy of its
+  // output level, or with the compressor options if the level is unknown
+  for (auto level_options : std::vector<std::pair<int, std::string>>{
+           {1, "compression_mode=fixed"},
+           {6, "level=1"},
+           {-1, "compression_mode=dynamic"}}) {
+    SetIAAThreadOutputLevel(level_options.first);
+    std::string compressed;
+    s = compressor->Compress(compr_info, Slice(input, input_length),
+                             &compressed);
+    ASSERT_TRUE(s.ok()) << s.ToString();
+    SetIAAThreadOutputLevel(-1);
+    ASSERT_EQ(compressed, compress(level_options.second))
+        << level_options.first;
+  }
+  ASSERT_EQ(GetStats(compressor.get())["policy_blocks"], "2");
+
+  // The output level listener sets the level of the job started on the
+  // thread, until it completes
+  std::shared_ptr<EventListener> listener = NewIAAOutputLevelListener();
+  FlushJobInfo flush_info;
+  CompactionJobInfo compaction_info;
+  compaction_info.output_level = 6;
+  std::string compressed;
+  listener->OnCompactionBegin(nullptr, compaction_info);
+  s = compressor->Compress(compr_info, Slice(input, input_length),
+                           &compressed);
+  ASSERT_TRUE(s.ok()) << s.ToString();
+  listener->OnCompactionCompleted(nullptr, compaction_info);
+  ASSERT_EQ(compressed, compress("level=1"));
+  compressed.clear();
+  listener->OnFlushBegin(nullptr, flush_info);
+  s = compressor->Compress(compr_info, Slice(input, input_length),
+                           &compressed);
+  ASSERT_TRUE(s.ok()) << s.ToString();
+  listener->OnFlushCompleted(nullptr, flush_info);
+  ASSERT_EQ(compressed, compress("compression_mode=fixed"));
+  compressed.clear();
+  s = compressor->Compress(compr_info, Slice(input, input_length),
+                           &compressed);
+  ASSERT_TRUE(s.ok()) << s.ToString();
+  ASSERT_EQ(GetStats(compressor.get())["policy_blocks"], "4");
+
+  DestroyBlock(input);
+}
+
+// Blocks compressed with a policy are left out of the controller's windows
+TEST(Policies, Controller) {
+  std::shared_ptr<Compressor> compressor;
+  ConfigOptions config_options;
+  Status s = Compressor::CreateFromString(
+      config_options,
+      "id=com.intel.iaa_compressor_rocksdb;execution_path=sw;"
+      "controller=throughput;controller_window_ms=1;policies=L1-:sw:fixed",
+      &compressor);
+  ASSERT_TRUE(s.ok()) << s.ToString();
+
+  size_t input_length = 65536;
+  char* input = GenerateBlock(input_length);
+  ASSERT_NE(input, nullptr);
+  CompressionInfo compr_info(CompressionDict::GetEmptyDict());
+  SetIAAThreadOutputLevel(1);
+  for (int i = 0; i < 100; i++) {
+    std::string compressed;
+    s = compressor->Compress(compr_info, Slice(input, input_length),
+                             &compressed);
+    ASSERT_TRUE(s.ok()) << s.ToString();
+  }
+  SetIAAThreadOutputLevel(-1);
+  auto stats = GetStats(compressor.get());
+  ASSERT_EQ(stats["policy_blocks"], "100");
+  for (const char* ticker :
+       {"controller_fixed_blocks", "controller_dynamic_blocks",
+        "controller_high_level_blocks", "controller_to_speed",
+        "controller_to_ratio"}) {
+    ASSERT_EQ(stats[ticker], "0") << ticker;
+  }
+
+  // Blocks of other levels are controlled
+  std::string compressed;
+  s = compressor->Compress(compr_info, Slice(input, input_length),
+                           &compressed);
+  ASSERT_TRUE(s.ok()) << s.ToString();
+  ASSERT_EQ(GetStats(compressor.get())["controller_dynamic_blocks"], "1");
+
+  DestroyBlock(input);
+}
+
+TEST(Controller, StallListener) {
+  std::shared_ptr<Compressor> compressor;
+  ConfigOptions config_options;
+  Status s = Compressor::CreateFromString(
+      config_options, "id=com.intel.iaa_compressor_rocksdb;execution_path=sw",
+      &compressor);
+  ASSERT_TRUE(s.ok()) << s.ToString();
+
+  std::shared_ptr<EventListener> listener;
+  IAAStallListenerOptions options;
+  s = NewIAAStallListener(nullptr, options, &listener);
+  ASSERT_TRUE(s.IsInvalidArgument()) << s.ToString();
+  options.backlog_options = "compression_mode=fixed;unknown=1";
+  s = NewIAAStallListener(compressor, options, &listener);
+  ASSERT_FALSE(s.ok());
+  options.backlog_options = "compression_mode=fixed;level=0";
+  s = NewIAAStallListener(compressor, options, &listener);
+  ASSERT_TRUE(s.ok()) << s.ToString();
+
+  auto stall = [&](const std::string& cf_name, WriteStallCondition cur) {
+    WriteStallInfo info;
+    info.cf_name = cf_name;
+    info.condition.cur = cur;
+    info.condition.prev = WriteStallCondition::kNormal;
+    listener->OnStallConditionsChanged(info);
+  };
+  auto mode = [&]() {
+    std::string value;
+    EXPECT_TRUE(
+        compressor->GetOption(config_options, "compression_mode", &value).ok());
+    return value;
+  };
+
+  // The backlog lasts until no column family is stalled
+  stall("default", WriteStallCondition::kDelayed);
+  ASSERT_EQ(mode(), "fixed");
+  stall("cf1", WriteStallCondition::kStopped);
+  stall("default", WriteStallCondition::kNormal);
+  ASSERT_EQ(mode(), "fixed");
+  stall("cf1", WriteStallCondition::kNormal);
+  ASSERT_EQ(mode(), "dynamic");
+  ASSERT_EQ(GetStats(compressor.get())["backlogs"], "1");
+
+  // Blocks compressed during the backlog use the backlog options
+  size_t input_length = 4096;
+  char* input = GenerateBlock(input_length);
+  ASSERT_NE(input, nullptr);
+  stall("default", WriteStallCondition::kDelayed);
+  CompressionInfo compr_info(CompressionDict::GetEmptyDict());
+  UncompressionInfo uncompr_info(UncompressionDict::GetEmptyDict());
+  std::string compressed;
+  s = compressor->Compress(compr_info, Slice(input, input_length),
+                           &compressed);
+  ASSERT_TRUE(s.ok()) << s.ToString();
+  stall("default", WriteStallCondition::kNormal);
+  char* uncompressed = nullptr;
+  size_t uncompressed_length = 0;
+  s = compressor->Uncompress(uncompr_info, compressed.c_str(),
+                             compressed.length(), &uncompressed,
+                             &uncompressed_length);
+  ASSERT_TRUE(s.ok()) << s.ToString();
+  ASSERT_EQ(uncompressed_length, input_length);
+  ASSERT_EQ(memcmp(uncompressed, input, input_length), 0);
+  ASSERT_EQ(GetStats(compressor.get())["backlogs"], "2");
+  ASSERT_EQ(mode(), "dynamic");
+
+  // Options changed during the backlog keep their new value
+  stall("default", WriteStallCondition::kDelayed);
+  s = compressor->ConfigureFromString(config_options, "level=1;verify=true");
+  ASSERT_TRUE(s.ok()) << s.ToString();
+  stall("default", WriteStallCondition::kNormal);
+  ASSERT_EQ(mode(), "dynamic");
+  std::string value;
+  s = compressor->GetOption(config_options, "level", &value);
+  ASSERT_TRUE(s.ok()) << s.ToString();
+  ASSERT_EQ(value, "1");
+  s = compressor->GetOption(config_options, "verify", &value);
+  ASSERT_TRUE(s.ok()) << s.ToString();
+  ASSERT_EQ(value, "true");
+
+  delete[] uncompressed;
+  DestroyBlock(input);
+}
+
+TEST(WarmUp, CanaryJobs) {
+  std::shared_ptr<Compressor> compressor;
+  ConfigOptions config_options;
+  Status s = Compressor::CreateFromString(
+      config_options,
+      "id=com.intel.iaa_compressor_rocksdb;execution_path=sw;warm_up_jobs=4",
+      &compressor);
+  ASSERT_TRUE(s.ok()) << s.ToString();
+  auto stats = GetStats(compressor.get());
+  ASSERT_EQ(stats["warm_up_jobs"], "4");
+  ASSERT_EQ(stats["warm_up_errors"], "0");
+  // A compression and a decompression job per canary
+  ASSERT_EQ(stats["sw_path_jobs"], "8");
+
+  // Threads pick up warmed jobs
+  size_t input_length = 4096;
+  char* input = GenerateBlock(input_length);
+  ASSERT_NE(input, nullptr);
+  std::thread thread([&]() {
+    CompressionInfo compr_info(CompressionDict::GetEmptyDict());
+    std::string compressed;
+    s = compressor->Compress(compr_info, Slice(input, input_length),
+                             &compressed);
+  });
+  thread.join();
+  ASSERT_TRUE(s.ok()) << s.ToString();
+
+  DestroyBlock(input);
+}
+
+TEST(WarmUp, Async) {
+  std::shared_ptr<Compressor> compressor;
+  ConfigOptions config_options;
+  Status s = Compressor::CreateFromString(
+      config_options,
+      "id=com.intel.iaa_compressor_rocksdb;execution_path=hw;"
+      "executor={id=emulator;latency_us=1000};warm_up_jobs=2;"
+      "warm_up_async=true",
+      &compressor);
+  ASSERT_TRUE(s.ok()) << s.ToString();
+  for (int i = 0; i < 1000 && GetStats(compressor.get())["warm_up_jobs"] != "2";
+       i++) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+  }
+  ASSERT_EQ(GetStats(compressor.get())["warm_up_jobs"], "2");
+}
+
+// Synchronous warm-up reports a failing canary when the compressor is prepared
+TEST(WarmUp, CanaryFailure) {
+  std::shared_ptr<Compressor> compressor;
+  ConfigOptions config_options;
+  Status s = Compressor::CreateFromString(
+      config_options,
+      "id=com.intel.iaa_compressor_rocksdb;execution_path=hw;"
+      "executor={id=emulator;fault_one_in=1};warm_up_jobs=2",
+      &compressor);
+  ASSERT_TRUE(s.IsCorruption()) << s.ToString();
+}
+
+// Compresses and uncompresses a 4KB block on the auto path with a profile
+std::unordered_map<std::string, std::string> RunWithProfile(
+    const IAACalibrationProfile& profile) {
+  std::string path = "/tmp/iaa_calibration_test.txt";
+  Status s = profile.Save(path, "test profile");
+  EXPECT_TRUE(s.ok()) << s.ToString();
+
+  std::shared_ptr<Compressor> compressor;
+  ConfigOptions config_options;
+  s = Compressor::CreateFromString(config_options,
+                                   "id=com.intel.iaa_compressor_rocksdb;"
+                                   "execution_path=auto;calibration_profile=" +
+                                       path,
+                                   &compressor);
+  EXPECT_TRUE(s.ok()) << s.ToString();
+  size_t input_length = 4096;
+  char* input = GenerateBlock(input_length);
+  CompressionInfo compr_info(CompressionDict::GetEmptyDict());
+  UncompressionInfo uncompr_info(UncompressionDict::GetEmptyDict());
+  std::string compressed;
+  char* uncompressed = nullptr;
+  size_t uncompressed_length = 0;
+  s = compressor->Compress(compr_info, Slice(input, input_length),
+                           &compressed);
+  EXPECT_TRUE(s.ok()) << s.ToString();
+  s = compressor->Uncompress(uncompr_info, compressed.c_str(),
+                             compressed.length(), &uncompressed,
+                             &uncompressed_length);
+  EXPECT_TRUE(s.ok()) << s.ToString();
+  EXPECT_EQ(uncompressed_length, input_length);
+  delete[] uncompressed;
+  DestroyBlock(input);
+  remove(path.c_str());
+  return GetStats(compressor.get());
+}
+
+TEST(Calibration, Thresholds) {
+  IAACalibrationProfile profile;
+  profile.fingerprint = GetIAAHardwareFingerprint();
+  profile.compress_hw_min_size[0] = 8192;
+  profile.uncompress_hw_min_size = 4096;
+  // Compression below the threshold moves to the software path
+  auto stats = RunWithProfile(profile);
+  ASSERT_EQ(stats["sw_path_jobs"], "1");
+  ASSERT_EQ(stats["auto_path_jobs"], "1");
+
+  // Profiles for other machine configurations are ignored
+  profile.fingerprint = "other";
+  stats = RunWithProfile(profile);
+  ASSERT_EQ(stats["sw_path_jobs"], "0");
+  ASSERT_EQ(stats["auto_path_jobs"], "2");
+}
+
+TEST(Calibration, InvalidProfile) {
+  std::string path = "/tmp/iaa_calibration_test.txt";
+  std::ofstream(path) << "fingerprint=x\nuncompress_hw_min_size=abc\n";
+  std::shared_ptr<Compressor> compressor;
+  ConfigOptions config_options;
+  Status s = Compressor::CreateFromString(
+      config_options,
+      "id=com.intel.iaa_compressor_rocksdb;calibration_profile=" + path,
+      &compressor);
+  ASSERT_TRUE(s.IsCorruption()) << s.ToString();
+  remove(path.c_str());
+
+  // A missing profile is ignored
+  s = Compressor::CreateFromString(
+      config_options,
+      "id=com.intel.iaa_compressor_rocksdb;calibration_profile=" + path,
+      &compressor);
+  ASSERT_TRUE(s.ok()) << s.ToString();
+}
+
+// The profile is read again only when calibration_profile changes
+TEST(Calibration, ProfileReload) {
+  std::string path = "/tmp/iaa_calibration_test.txt";
+  IAACalibrationProfile profile;
+  profile.fingerprint = GetIAAHardwareFingerprint();
+  profile.compress_hw_min_size[0] = 8192;
+  Status s = profile.Save(path, "test profile");
+  ASSERT_TRUE(s.ok()) << s.ToString();
+  std::shared_ptr<Compressor> compressor;
+  ConfigOptions config_options;
+  s = Compressor::CreateFromString(
+      config_options,
+      "id=com.intel.iaa_compressor_rocksdb;execution_path=auto;"
+      "calibration_profile=" +
+          path,
+      &compressor);
+  ASSERT_TRUE(s.ok()) << s.ToString();
+
+  // Other option changes keep the loaded profile
+  remove(path.c_str());
+  s = compressor->ConfigureFromString(config_options, "verify=true");
+  ASSERT_TRUE(s.ok()) << s.ToString();
+  size_t input_length = 4096;
+  char* input = GenerateBlock(input_length);
+  CompressionInfo compr_info(CompressionDict::GetEmptyDict());
+  std::string compressed;
+  s = compressor->Compress(compr_info, Slice(input, input_length),
+                           &compressed);
+  ASSERT_TRUE(s.ok()) << s.ToString();
+  ASSERT_EQ(GetStats(compressor.get())["sw_path_jobs"], "1");
+  DestroyBlock(input);
+
+  // A new profile is read
+  std::string other_path = "/tmp/iaa_calibration_test_other.txt";
+  std::ofstream(other_path) << "fingerprint=x\nuncompress_hw_min_size=abc\n";
+  s = compressor->ConfigureFromString(config_options,
+                                      "calibration_profile=" + other_path);
+  ASSERT_TRUE(s.IsCorruption()) << s.ToString();
+  remove(other_path.c_str());
+}
+
+// The emulated hardware path is much slower than the software path at all
+// block sizes
+TEST(Calibration, Emulator) {
+  std::string path = "/tmp/iaa_calibration_test.txt";
+  std::string report;
+  Status s = CalibrateIAA(path, "executor={id=emulator;throughput_mbps=10}",
+                          2, &report);
+  ASSERT_TRUE(s.ok()) << s.ToString();
+  ASSERT_FALSE(report.empty());
+  IAACalibrationProfile profile;
+  s = profile.Load(path);
+  ASSERT_TRUE(s.ok()) << s.ToString();
+  ASSERT_EQ(profile.fingerprint, GetIAAHardwareFingerprint());
+  ASSERT_EQ(profile.compress_hw_min_size[0], IAACalibrationProfile::kNever);
+  ASSERT_EQ(profile.compress_hw_min_size[1], IAACalibrationProfile::kNever);
+  ASSERT_EQ(profile.uncompress_hw_min_size, IAACalibrationProfile::kNever);
+  remove(path.c_str());
+}
+
+// Without a working hardware path, the profile keeps jobs on the software path
+TEST(Calibration, NoHardware) {
+  std::string path = "/tmp/iaa_calibration_test.txt";
+  std::string report;
+  Status s = CalibrateIAA(path, "executor={id=emulator;fault_one_in=1}", 2,
+                          &report);
+  ASSERT_TRUE(s.ok()) << s.ToString();
+  ASSERT_NE(report.find("software path only"), std::string::npos) << report;
+  IAACalibrationProfile profile;
+  s = profile.Load(path);
+  ASSERT_TRUE(s.ok()) << s.ToString();
+  ASSERT_EQ(profile.fingerprint, GetIAAHardwareFingerprint());
+  ASSERT_EQ(profile.compress_hw_min_size[0], IAACalibrationProfile::kNever);
+  ASSERT_EQ(profile.compress_hw_min_size[1], IAACalibrationProfile::kNever);
+  ASSERT_EQ(profile.uncompress_hw_min_size, IAACalibrationProfile::kNever);
+  remove(path.c_str());
+}
+
+TEST(Stats, PerfContext) {
+  size_t input_length = 65536;
+  char* input = GenerateBlock(input_length);
+  ASSERT_NE(input, nullptr);
+
+  std::shared_ptr<Compressor> compressor;
+  ConfigOptions config_options;
+  Status s = Compressor::CreateFromString(
+      config_options, "id=com.intel.iaa_compressor_rocksdb;execution_path=sw",
+      &compressor);
+  ASSERT_TRUE(s.ok()) << s.ToString();
+
+  CompressionInfo compr_info(CompressionDict::GetEmptyDict());
+  UncompressionInfo uncompr_info(UncompressionDict::GetEmptyDict());
+  Slice data(input, input_length);
+  IAAPerfContext* context = GetIAAPerfContext();
+  for (PerfLevel level : {PerfLevel::kDisable, PerfLevel::kEnableTime}) {
+    SetPerfLevel(level);
+    context->Reset();
+    std::string compressed;
+    s = compressor->Compress(compr_info, data, &compressed);
+    ASSERT_TRUE(s.ok()) << s.ToString();
+    char* uncompressed;
+    size_t uncompressed_length;
+    s = compressor->Uncompress(uncompr_info, compressed.c_str(),
+                               compressed.length(), &uncompressed,
+                               &uncompressed_length);
+    ASSERT_TRUE(s.ok()) << s.ToString();
+    delete[] uncompressed;
+
+    if (level == PerfLevel::kDisable) {
+      ASSERT_EQ(context->compress_count, 0);
+      ASSERT_EQ(context->uncompress_count, 0);
+    } else {
+      ASSERT_EQ(context->compress_count, 1);
+      ASSERT_GT(context->compress_execute_nanos, 0);
+      ASSERT_EQ(context->uncompress_count, 1);
+      ASSERT_GT(context->uncompress_execute_nanos, 0);
+      ASSERT_NE(context->ToString().find("uncompress_count = 1"),
+                std::string::npos);
+    }
+  }
+  SetPerfLevel(PerfLevel::kEnableCount);
+
+  // Phase histograms are always recorded
+  std::string value;
+  s = compressor->GetOption(config_options, "stats", &value);
+  ASSERT_TRUE(s.ok()) << s.ToString();
+  std::unordered_map<std::string, std::string> stats;
+  s = StringToMap(value, &stats);
+  ASSERT_TRUE(s.ok()) << s.ToString();
+  for (std::string phase : {"setup", "submit", "execute", "completion"}) {
+    ASSERT_EQ(stats["compress_" + phase + "_count"], "2");
+    ASSERT_EQ(stats["uncompress_" + phase + "_count"], "2");
+  }
+
+  DestroyBlock(input);
+}
+
+class ScanTest : public testing::TestWithParam<std::string> {
+ public:
+  void SetUp() override {
+    ConfigOptions config_options;
+    Status s = Compressor::CreateFromString(
+        config_options,
+        "id=com.intel.iaa_compressor_rocksdb;execution_path=sw;" + GetParam(),
+        &compressor);
+    ASSERT_TRUE(s.ok()) << s.ToString();
+
+    for (uint32_t i = 0; i < kNumValues; i++) {
+      values.push_back(i % 8 == 0 ? i : 0);
+    }
+    CompressionInfo compr_info(CompressionDict::GetEmptyDict());
+    Slice data(reinterpret_cast<const char*>(values.data()),
+               values.size() * sizeof(uint32_t));
+    s = compressor->Compress(compr_info, data, &compressed);
+    ASSERT_TRUE(s.ok()) << s.ToString();
+  }
+
+  static constexpr uint32_t kNumValues = 16384;
+  std::shared_ptr<Compressor> compressor;
+  std::vector<uint32_t> values;
+  std::string compressed;
+};
+
+TEST_P(ScanTest, BitVector) {
+  IAAColumnLayout layout;
+  IAAScanPredicate predicate;
+  predicate.op = IAAScanOp::kRange;
+  predicate.low = 100;
+  predicate.high = 1000;
+
+  std::string result;
+  uint32_t count = 0;
+  Status s = UncompressAndScan(compressor.get(), compressed.c_str(),
+                               compressed.length(), layout, predicate,
+                               IAAScanOutput::kBitVector, &result, &count);
+  ASSERT_TRUE(s.ok()) << s.ToString();
+  ASSERT_EQ(count, kNumValues);
+  ASSERT_EQ(result.size(), kNumValues / 8);
+  for (uint32_t i = 0; i < kNumValues; i++) {
+    bool expected = values[i] >= predicate.low && values[i] <= predicate.high;
+    bool actual = (result[i / 8] >> (i % 8)) & 1;
+    ASSERT_EQ(actual, expected) << i;
+  }
+}
+
+TEST_P(ScanTest, Values) {
+  IAAColumnLayout layout;
+  IAAScanPredicate predicate;
+  predicate.op = IAAScanOp::kGt;
+  predicate.low = 8000;
+
+  std::string result;
+  uint32_t count = 0;
+  Status s = UncompressAndScan(compressor.get(), compressed.c_str(),
+                               compressed.length(), layout, predicate,
+                               IAAScanOutput::kValues, &result, &count);
+  ASSERT_TRUE(s.ok()) << s.ToString();
+
+  std::vector<uint32_t> expected;
+  for (uint32_t value : values) {
+    if (value > predicate.low) {
+      expected.push_back(value);
+    }
+  }
+  ASSERT_EQ(count, expected.size());
+  ASSERT_EQ(result.size(), expected.size() * sizeof(uint32_t));
+  ASSERT_TRUE(memcmp(result.data(), expected.data(), result.size()) == 0);
+}
+
+TEST_P(ScanTest, InvalidLayout) {
+  IAAColumnLayout layout;
+  layout.bit_width = 33;
+  IAAScanPredicate predicate;
+  std::string result;
+  uint32_t count = 0;
+  Status s = UncompressAndScan(compressor.get(), compressed.c_str(),
+                               compressed.length(), layout, predicate,
+                               IAAScanOutput::kBitVector, &result, &count);
+  ASSERT_TRUE(s.IsInvalidArgument());
+
+  layout.bit_width = 32;
+  layout.num_values = kNumValues + 1;
+  s = UncompressAndScan(compressor.get(), compressed.c_str(),
+                        compressed.length(), layout, predicate,
+                        IAAScanOutput::kBitVector, &result, &count);
+  ASSERT_TRUE(s.IsInvalidArgument());
+}
+
+// Zero-compressed blocks are uncompressed before the scan
+INSTANTIATE_TEST_SUITE_P(Scan, ScanTest,
+                         testing::Values("compression_mode=dynamic",
+                                         "compression_mode=fixed",
+                                         "zero_compress=z32", "integrity=crc"));
+
+struct TestParam {
+  TestParam(std::string _execution_path, std::string _compression_mode,
+            std::string _other_opts, size_t _block_size,
+            unsigned int _num_blocks = 1)
+      : execution_path(_execution_path),
+        compression_mode(_compression_mode),
+        other_opts(_other_opts),
+        block_size(_block_size),
+        num_blocks(_num_blocks) {}
+
+  std::string execution_path;
+  std::string compression_mode;
+  std::string other_opts;
+  size_t block_size;
+  unsigned int num_blocks;
+
+  std::string GetOpts() {
+    return "execution_path=" + execution_path +
+           ";compression_mode=" + compression_mode + ";" + other_opts;
+  }
+};
+
+class IAACompressorTest
+    : public testing::TestWithParam<std::tuple<
+          std::string, std::string, std::string, size_t, unsigned int>> {
+ public:
+  static void SetUpTestSuite() {
+    ObjectLibrary::Default()->AddFactory<Compressor>(
+        "com.intel.iaa_compressor_rocksdb",
+        [](const std::string& /* uri */, std::unique_ptr<Compressor>* c,
+           std::string* /* errmsg */) {
+          c->reset(NewIAACompressor().get());
+          return c->get();
+        });
+  }
+
+  void SetUp() override {
+    TestParam test_param(std::get<0>(GetParam()), std::get<1>(GetParam()),
+                         std::get<2>(GetParam()), std::get<3>(GetParam()),
+                         std::get<4>(GetParam()));
+    ;
+    ConfigOptions config_options;
+    Compressor::CreateFromString(
+        config_options,
+        "id=com.intel.iaa_compressor_rocksdb;" + test_param.GetOpts(),
+        &compressor);
+  }
+
+  std::shared_ptr<Compressor> compressor;
+};
+
+TEST_P(IAACompressorTest, CompressDecompress) {
+  TestParam test_param(std::get<0>(GetParam()), std::get<1>(GetParam()),
+                       std::get<2>(GetParam()), std::get<3>(GetParam()),
+                       std::get<4>(GetParam()));
+
+  size_t input_length = test_param.block_size;
+  char* input = GenerateBlock(input_length);
+  ASSERT_NE(input, nullptr);
+
+  CompressionInfo compr_info(CompressionDict::GetEmptyDict());
+  std::string compressed;
+  Slice data(input, input_length);
+  Status s = compressor->Compress(compr_info, data, &compressed);
+  ASSERT_TRUE(s.ok()) << s.ToString();
+
+  UncompressionInfo uncompr_info(UncompressionDict::GetEmptyDict());
+  char* uncompressed;
+  size_t uncompressed_length;
+  s = compressor->Uncompress(uncompr_info, compressed.c_str(),
+                             compressed.length(), &uncompressed,
+                             &uncompressed_length);
+  ASSERT_TRUE(s.ok()) << s.ToString();
+  ASSERT_EQ(uncompressed_length, input_length);
+  ASSERT_TRUE(memcmp(uncompressed, input, input_length) == 0);
+  delete[] uncompressed;
+
+  DestroyBlock(input);
+}
+
+#define BLOCK_SIZES                                                       \
+  100, 1 << 8, 1000, 1 << 10, 1 << 12, 1 << 14, 1 << 16, 100000, 1000000, \
+      1 << 20
+
+INSTANTIATE_TEST_SUITE_P(CompressSWDecompressSW, IAACompressorTest,
+                         testing::Combine(testing::Values("sw"),
+                                          testing::Values("dynamic", "fixed"),
+                                          testing::Values("level=0", "level=1"),
+                                          testing::Values(BLOCK_SIZES),
+                                          testing::Values(1)));
+
+INSTANTIATE_TEST_SUITE_P(
+    ZeroCompressSW, IAACompressorTest,
+    testing::Combine(testing::Values("sw"), testing::Values("dynamic", "fixed"),
+                     testing::Values("zero_compress=z16", "zero_compress=z32",
+                                     "zero_compress=auto",
+                                     "zero_compress=z32;"
+                                     "zero_compress_deflate=true"),
+                     testing::Values(BLOCK_SIZES), testing::Values(1)));
+
+INSTANTIATE_TEST_SUITE_P(
+    IntegritySW, IAACompressorTest,
+    testing::Combine(testing::Values("sw"), testing::Values("dynamic", "fixed"),
+                     testing::Values("integrity=crc",
+                                     "integrity=crc;verify_one_in=4",
+                                     "integrity=crc;zero_compress=auto",
+                                     "integrity=crc;output_buffer=resize"),
+                     testing::Values(BLOCK_SIZES), testing::Values(1)));
+
+// Hardware and auto paths on the emulator, which runs on any machine
+INSTANTIATE_TEST_SUITE_P(
+    EmulatedHW, IAACompressorTest,
+    testing::Combine(
+        testing::Values("hw", "auto"), testing::Values("dynamic", "fixed"),
+        testing::Values("executor={id=emulator}",
+                        "executor={id=emulator;devices=2;wqs=2;wq_depth=1;"
+                        "busy_one_in=3}",
+                        "verify=true;executor={id=emulator;latency_us=2;"
+                        "distribution=exponential;throughput_mbps=2000}"),
+        testing::Values(BLOCK_SIZES), testing::Values(1)));
 
 #ifndef EXCLUDE_HW_TESTS
 INSTANTIATE_TEST_SUITE_P(
@@ -0,0 +1,233 @@
+// Copyright (C) 2022 Intel Corporation
+
+// SPDX-License-Identifier: Apache-2.0
+
+#include "../iaa_memory_allocator.h"
+
+#include <gtest/gtest.h>
+
+#include <cstring>
+#include <thread>
+#include <vector>
+
+#include "../iaa_compressor.h"
+#include "rocksdb/convenience.h"
+
+namespace ROCKSDB_NAMESPACE {
+
+TEST(Options, DefaultOptions) {
+  std::shared_ptr<MemoryAllocator> allocator;
+  ConfigOptions config_options;
+  Status s = MemoryAllocator::CreateFromString(
+      config_options, "id=com.intel.iaa_allocator_rocksdb", &allocator);
+  ASSERT_TRUE(s.ok()) << s.ToString();
+
+  std::string value;
+  s = allocator->GetOption(config_options, "arena_size", &value);
+  ASSERT_TRUE(s.ok());
+  ASSERT_EQ(value, std::to_string(64 << 20));
+  s = allocator->GetOption(config_options, "huge_pages", &value);
+  ASSERT_TRUE(s.ok());
+  ASSERT_EQ(value, "true");
+  s = allocator->GetOption(config_options, "prefault", &value);
+  ASSERT_TRUE(s.ok());
+  ASSERT_EQ(value, "true");
+  s = allocator->GetOption(config_options, "numa_local", &value);
+  ASSERT_TRUE(s.ok());
+  ASSERT_EQ(value, "true");
+}
+
+TEST(Options, InvalidOptions) {
+  std::shared_ptr<MemoryAllocator> allocator;
+  ConfigOptions config_options;
+  Status s = MemoryAllocator::CreateFromString(
+      config_options, "id=com.intel.iaa_allocator_rocksdb;arena_size=0",
+      &allocator);
+  ASSERT_TRUE(s.IsInvalidArgument());
+}
+
+class IAAMemoryAllocatorTest : public testing::TestWithParam<std::string> {
+ public:
+  void SetUp() override {
+    ConfigOptions config_options;
+    Status s = MemoryAllocator::CreateFromString(
+        config_options,
+        "id=com.intel.iaa_allocator_rocksdb;arena_size=4194304;" + GetParam(),
+        &allocator);
+    ASSERT_TRUE(s.ok()) << s.ToString();
+  }
+
+  std::shared_ptr<MemoryAllocator> allocator;
+};
+
+TEST_P(IAAMemoryAllocatorTest, AllocateDeallocate) {
+  // Sizes below, within and above the arena size
+  for (size_t size : {1, 100, 4096, 65536, 1000000, 3 << 20, 10 << 20}) {
+    char* p = static_cast<char*>(allocator->Allocate(size));
+    ASSERT_NE(p, nullptr) << size;
+    ASSERT_EQ(reinterpret_cast<uintptr_t>(p) % 64, 0) << size;
+    ASSERT_GE(allocator->UsableSize(p, size), size);
+    memset(p, 0xab, size);
+    allocator->Deallocate(p);
+  }
+}
+
+TEST_P(IAAMemoryAllocatorTest, ReuseFreedBlocks) {
+  void* p = allocator->Allocate(3000);
+  ASSERT_NE(p, nullptr);
+  allocator->Deallocate(p);
+  // Same size class
+  void* q = allocator->Allocate(3008);
+  ASSERT_EQ(p, q);
+  allocator->Deallocate(q);
+}
+
+TEST_P(IAAMemoryAllocatorTest, SizeClasses) {
+  // The header of a block must not double the size of typical blocks
+  for (size_t size : {4096, 16384, 65536}) {
+    void* p = allocator->Allocate(size);
+    ASSERT_NE(p, nullptr) << size;
+    ASSERT_LT(allocator->UsableSize(p, size), 2 * size) << size;
+    allocator->Deallocate(p);
+  }
+}
+
+TEST_P(IAAMemoryAllocatorTest, MultiThreaded) {
+  std::vector<std::thread> threads;
+  for (int t = 0; t < 8; t++) {
+    threads.emplace_back([this, t] {
+      std::vector<std::pair<char*, size_t>> live;
+      for (int i = 0; i < 2000; i++) {
+        size_t size = (i * 7919 + t) % (1 << 18) + 1;
+        char* p = static_cast<char*>(allocator->Allocate(size));
+        ASSERT_NE(p, nullptr);
+        memset(p, t, size);
+        live.emplace_back(p, size);
+        if (live.size() > 32) {
+          auto block = live.front();
+          live.erase(live.begin());
+          for (size_t k = 0; k < block.second; k += 512) {
+            ASSERT_EQ(block.first[k], static_cast<char>(t));
+          }
+          allocator->Deallocate(block.first);
+        }
+      }
+      for (auto& block : live) {
+        allocator->Deallocate(block.first);
+      }
+    });
+  }
+  for (auto& thread : threads) {
+    thread.join();
+  }
+}
+
+// Blocks freed by another thread than the one that allocated them
+TEST_P(IAAMemoryAllocatorTest, CrossThreadDeallocate) {
+  std::vector<char*> blocks;
+  std::thread producer([&] {
+    for (int i = 0; i < 4096; i++) {
+      char* p = static_cast<char*>(allocator->Allocate(4000));
+      ASSERT_NE(p, nullptr);
+      memset(p, 1, 4000);
+      blocks.push_back(p);
+    }
+  });
+  producer.join();
+  std::thread consumer([&] {
+    for (char* p : blocks) {
+      allocator->Deallocate(p);
+    }
+  });
+  consumer.join();
+  for (int i = 0; i < 4096; i++) {
+    char* p = static_cast<char*>(allocator->Allocate(4000));
+    ASSERT_NE(p, nullptr);
+    memset(p, 2, 4000);
+    blocks[i] = p;
+  }
+  for (char* p : blocks) {
+    allocator->Deallocate(p);
+  }
+}
+
+TEST_P(IAAMemoryAllocatorTest, Trim) {
+  size_t released = 0;
+  ASSERT_TRUE(TrimIAAMemoryAllocator(nullptr).IsInvalidArgument());
+
+  // A freed large mapping is reused, then unmapped by trimming
+  char* large = static_cast<char*>(allocator->Allocate(10 << 20));
+  ASSERT_NE(large, nullptr);
+  allocator->Deallocate(large);
+  char* reused = static_cast<char*>(allocator->Allocate(9 << 20));
+  ASSERT_NE(reused, nullptr);
+  if (GetParam().find("numa_local=false") != std::string::npos) {
+    // Otherwise, the thread may have moved to another node
+    ASSERT_EQ(reused, large);
+  }
+  allocator->Deallocate(reused);
+  Status s = TrimIAAMemoryAllocator(allocator.get(), &released);
+  ASSERT_TRUE(s.ok()) << s.ToString();
+  ASSERT_GE(released, size_t{10} << 20);
+
+  // Free blocks of large size classes (not cached by threads) are released,
+  // and usable afterwards
+  std::vector<char*> blocks;
+  for (int i = 0; i < 64; i++) {
+    char* p = static_cast<char*>(allocator->Allocate(1 << 20));
+    ASSERT_NE(p, nullptr);
+    memset(p, 1, 1 << 20);
+    blocks.push_back(p);
+  }
+  for (char* p : blocks) {
+    allocator->Deallocate(p);
+  }
+  s = TrimIAAMemoryAllocator(allocator.get(), &released);
+  ASSERT_TRUE(s.ok()) << s.ToString();
+  ASSERT_GT(released, 0);
+  char* p = static_cast<char*>(allocator->Allocate(1 << 20));
+  ASSERT_NE(p, nullptr);
+  memset(p, 2, 1 << 20);
+  allocator->Deallocate(p);
+}
+
+TEST_P(IAAMemoryAllocatorTest, UncompressOutput) {
+  std::shared_ptr<Compressor> compressor;
+  ConfigOptions config_options;
+  Status s = Compressor::CreateFromString(
+      config_options, "id=com.intel.iaa_compressor_rocksdb;execution_path=sw",
+      &compressor);
+  ASSERT_TRUE(s.ok()) << s.ToString();
+
+  std::string input(65536, 'a');
+  for (size_t i = 0; i < input.size(); i++) {
+    input[i] += i % 26;
+  }
+  CompressionInfo compr_info(CompressionDict::GetEmptyDict());
+  std::string compressed;
+  s = compressor->Compress(compr_info, input, &compressed);
+  ASSERT_TRUE(s.ok()) << s.ToString();
+
+  UncompressionInfo uncompr_info(UncompressionDict::GetEmptyDict(), 2,
+                                 allocator.get());
+  char* uncompressed;
+  size_t uncompressed_length;
+  s = compressor->Uncompress(uncompr_info, compressed.c_str(),
+                             compressed.length(), &uncompressed,
+                             &uncompressed_length);
+  ASSERT_TRUE(s.ok()) << s.ToString();
+  ASSERT_EQ(uncompressed_length, input.size());
+  ASSERT_TRUE(memcmp(uncompressed, input.data(), input.size()) == 0);
+  allocator->Deallocate(uncompressed);
+}
+
+INSTANTIATE_TEST_SUITE_P(
+    IAAMemoryAllocator, IAAMemoryAllocatorTest,
+    testing::Values("", "huge_pages=false;prefault=false;numa_local=false"));
+
+}  // namespace ROCKSDB_NAMESPACE
+
+int main(int argc, char* argv[]) {
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
@@ -0,0 +1,221 @@
+// Copyright (C) 2022 Intel Corporation
+
+// SPDX-License-Identifier: Apache-2.0
+
+// Replays a corpus captured by com.intel.iaa_capture_rocksdb through the IAA
+// compressor, for each combination of compression mode, level and zero
+// compression on the selected execution paths, and through RocksDB's built-in
+// compressors. For each, it reports compression ratio, throughput and latency
+// percentiles of Compress and Uncompress on the same blocks.
+//
+// Usage: iaa_replay_bench --corpus=<file> [--paths=sw] [--baselines=LZ4,ZSTD,
+//            Zlib] [--configs=<options>|<options>...] [--timing]
+//
+// --configs replaces the option combinations of the IAA compressor with the
+// given option strings. With --timing, calls are issued at the times they
+// were captured instead of back to back.
+
+#include <chrono>
+#include <cinttypes>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "../iaa_compressor.h"
+#include "../iaa_corpus.h"
+#include "../iaa_stats.h"
+#include "rocksdb/convenience.h"
+
+namespace ROCKSDB_NAMESPACE {
+
+struct ReplayResult {
+  uint64_t bytes_in = 0;
+  uint64_t bytes_out = 0;
+  uint64_t compress_nanos = 0;
+  uint64_t uncompress_nanos = 0;
+  HistogramData compress_latency;
+  HistogramData uncompress_latency;
+};
+
+// Waits until offset nanoseconds after start, if pacing
+static void Pace(bool timing, uint64_t start, uint64_t offset) {
+  if (timing) {
+    uint64_t now = NowNanos();
+    if (now - start < offset) {
+      std::this_thread::sleep_for(
+          std::chrono::nanoseconds(offset - (now - start)));
+    }
+  }
+}
+
+Status Replay(Compressor* compressor, const std::vector<CorpusRecord>& corpus,
+              bool timing, ReplayResult* result) {
+  CompressionInfo compr_info(CompressionDict::GetEmptyDict());
+  UncompressionInfo uncompr_info(UncompressionDict::GetEmptyDict());
+  std::vector<std::string> compressed(corpus.size());
+  uint64_t start = NowNanos();
+  for (size_t i = 0; i < corpus.size(); i++) {
+    Pace(timing, start, corpus[i].time_nanos);
+    uint64_t call_start = NowNanos();
+    Status s = compressor->Compress(compr_info, corpus[i].data, &compressed[i]);
+    uint64_t latency = NowNanos() - call_start;
+    if (!s.ok()) {
+      return s;
+    }
+    result->compress_latency.Add(latency);
+    result->compress_nanos += latency;
+    result->bytes_in += corpus[i].data.size();
+    result->bytes_out += compressed[i].size();
+  }
+
+  start = NowNanos();
+  for (size_t i = 0; i < corpus.size(); i++) {
+    Pace(timing, start, corpus[i].time_nanos);
+    char* uncompressed = nullptr;
+    size_t uncompressed_length = 0;
+    uint64_t call_start = NowNanos();
+    Status s = compressor->Uncompress(uncompr_info, compressed[i].data(),
+                                      compressed[i].size(), &uncompressed,
+                                      &uncompressed_length);
+    uint64_t latency = NowNanos() - call_start;
+    std::unique_ptr<char[]> output(uncompressed);
+    if (!s.ok()) {
+      return s;
+    }
+    if (uncompressed_length != corpus[i].data.size() ||
+        memcmp(uncompressed, corpus[i].data.data(), uncompressed_length) != 0) {
+      return Status::Corruption("uncompressed block does not match corpus");
+    }
+    result->uncompress_latency.Add(latency);
+    result->uncompress_nanos += latency;
+  }
+  return Status::OK();
+}
+
+static void PrintHeader() {
+  printf("%-60s %7s %9s %9s %9s %9s %9s %9s\n", "compressor", "ratio",
+         "c_MB/s", "u_MB/s", "c_p50", "c_p99", "u_p50", "u_p99");
+}
+
+static void PrintResult(const std::string& name, const ReplayResult& result) {
+  auto mbps = [&](uint64_t nanos) {
+    return nanos > 0 ? result.bytes_in * 1e3 / nanos : 0.0;
+  };
+  auto us = [](const HistogramData& data, double percentile) {
+    return data.Count() > 0 ? data.Percentile(percentile) / 1e3 : 0.0;
+  };
+  printf("%-60s %7.3f %9.1f %9.1f %9.1f %9.1f %9.1f %9.1f\n", name.c_str(),
+         result.bytes_out > 0
+             ? static_cast<double>(result.bytes_in) / result.bytes_out
+             : 0.0,
+         mbps(result.compress_nanos), mbps(result.uncompress_nanos),
+         us(result.compress_latency, 50), us(result.compress_latency, 99),
+         us(result.uncompress_latency, 50), us(result.uncompress_latency, 99));
+  fflush(stdout);
+}
+
+static void RunCompressor(const std::string& name,
+                          const std::string& id_and_options,
+                          const std::vector<CorpusRecord>& corpus,
+                          bool timing) {
+  std::shared_ptr<Compressor> compressor;
+  ConfigOptions config_options;
+  Status s =
+      Compressor::CreateFromString(config_options, id_and_options, &compressor);
+  ReplayResult result;
+  if (s.ok()) {
+    s = Replay(compressor.get(), corpus, timing, &result);
+  }
+  if (!s.ok()) {
+    printf("%-60s skipped: %s\n", name.c_str(), s.ToString().c_str());
+    return;
+  }
+  PrintResult(name, result);
+}
+
+static std::vector<std::string> Split(const std::string& list, char delimiter) {
+  std::vector<std::string> items;
+  std::stringstream stream(list);
+  std::string item;
+  while (std::getline(stream, item, delimiter)) {
+    if (!item.empty()) {
+      items.push_back(item);
+    }
+  }
+  return items;
+}
+
+}  // namespace ROCKSDB_NAMESPACE
+
+int main(int argc, char** argv) {
+  using namespace ROCKSDB_NAMESPACE;
+
+  std::string corpus_path;
+  std::vector<std::string> paths = {"sw"};
+  std::vector<std::string> baselines = {"LZ4", "ZSTD", "Zlib"};
+  std::vector<std::string> configs;
+  bool timing = false;
+  for (int i = 1; i < argc; i++) {
+    if (strncmp(argv[i], "--corpus=", 9) == 0) {
+      corpus_path = argv[i] + 9;
+    } else if (strncmp(argv[i], "--paths=", 8) == 0) {
+      paths = Split(argv[i] + 8, ',');
+    } else if (strncmp(argv[i], "--baselines=", 12) == 0) {
+      baselines = Split(argv[i] + 12, ',');
+    } else if (strncmp(argv[i], "--configs=", 10) == 0) {
+      configs = Split(argv[i] + 10, '|');
+    } else if (strcmp(argv[i], "--timing") == 0) {
+      timing = true;
+    } else {
+      fprintf(stderr, "Unknown argument: %s\n", argv[i]);
+      return 1;
+    }
+  }
+  if (corpus_path.empty()) {
+    fprintf(stderr, "--corpus is required\n");
+    return 1;
+  }
+
+  std::vector<CorpusRecord> corpus;
+  Status s = ReadCorpus(corpus_path, &corpus);
+  if (!s.ok()) {
+    fprintf(stderr, "Cannot read corpus: %s\n", s.ToString().c_str());
+    return 1;
+  }
+  uint64_t bytes = 0;
+  for (const CorpusRecord& record : corpus) {
+    bytes += record.data.size();
+  }
+  printf("corpus=%s blocks=%zu bytes=%" PRIu64 " timing=%s\n",
+         corpus_path.c_str(), corpus.size(), bytes,
+         timing ? "captured" : "none");
+  printf("Latencies in microseconds (c: Compress, u: Uncompress)\n");
+  PrintHeader();
+
+  if (configs.empty()) {
+    for (const std::string& path : paths) {
+      for (const char* mode : {"dynamic", "fixed"}) {
+        for (const char* level : {"0", "1"}) {
+          for (const char* zero_compress : {"none", "auto"}) {
+            configs.push_back(std::string("execution_path=") + path +
+                              ";compression_mode=" + mode + ";level=" + level +
+                              ";zero_compress=" + zero_compress);
+          }
+        }
+      }
+    }
+  }
+  for (const std::string& config : configs) {
+    RunCompressor("iaa:" + config,
+                  "id=com.intel.iaa_compressor_rocksdb;" + config, corpus,
+                  timing);
+  }
+  for (const std::string& baseline : baselines) {
+    RunCompressor(baseline, baseline, corpus, timing);
+  }
+  return 0;
+}
@@ -0,0 +1,282 @@
+// Copyright (C) 2022 Intel Corporation
+
+// SPDX-License-Identifier: Apache-2.0
+
+// Multi-threaded scaling benchmark. Each of --threads workers runs a mix of
+// Compress (writes) and Uncompress (reads) calls on a shared compressor for
+// --duration seconds. With --churn=N, a worker thread exits after N calls and
+// is replaced by a new thread, so that the cost of setting up per-thread
+// state (QPL jobs, buffers) is part of the measurement. For each thread count,
+// it reports aggregate throughput, per-thread fairness, latency percentiles
+// and busy retries.
+//
+// Usage: iaa_scaling_bench [--threads=1,8,32,64,128] [--read_ratio=0.8]
+//            [--block_size=16384] [--duration=5] [--churn=0]
+//            [--options=execution_path=sw]
+
+#include <algorithm>
+#include <atomic>
+#include <cinttypes>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <random>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include "../iaa_compressor.h"
+#include "../iaa_sample_data.h"
+#include "../iaa_stats.h"
+#include "rocksdb/convenience.h"
+
+namespace ROCKSDB_NAMESPACE {
+
+struct ScalingOptions {
+  std::vector<uint32_t> threads = {1, 8, 32, 64, 128};
+  double read_ratio = 0.8;
+  size_t block_size = 16384;
+  double duration = 5;
+  uint64_t churn = 0;
+  std::string options = "execution_path=sw";
+};
+
+// Results of one worker slot, across the threads that ran in it
+struct WorkerResult {
+  uint64_t ops = 0;
+  uint64_t bytes = 0;
+  uint64_t errors = 0;
+  uint64_t threads = 0;
+  HistogramData compress_latency;
+  HistogramData uncompress_latency;
+  // Latency of the first call of each thread
+  HistogramData first_call_latency;
+};
+
+class ScalingBench {
+ public:
+  ScalingBench(const ScalingOptions& options,
+               std::shared_ptr<Compressor> compressor)
+      : options_(options), compressor_(compressor) {}
+
+  Status Prepare() {
+    CompressionInfo compr_info(CompressionDict::GetEmptyDict());
+    for (uint32_t i = 0; i < kNumBlocks; i++) {
+      blocks_.push_back(GenerateIAASampleText(options_.block_size, 301 + i));
+      std::string compressed;
+      Status s = compressor_->Compress(compr_info, blocks_.back(), &compressed);
+      if (!s.ok()) {
+        return s;
+      }
+      compressed_.push_back(std::move(compressed));
+    }
+    return Status::OK();
+  }
+
+  void Run(uint32_t num_threads) {
+    uint64_t busy_before = std::stoull(GetStat("busy_retries"));
+    std::vector<WorkerResult> results(num_threads);
+    std::atomic<bool> stop{false};
+    std::vector<std::thread> slots;
+    uint64_t start = NowNanos();
+    for (uint32_t i = 0; i < num_threads; i++) {
+      slots.emplace_back([this, i, &stop, &results]() {
+        // Without churn, a single worker thread runs until stopped
+        uint32_t generation = 0;
+        while (!stop.load(std::memory_order_relaxed)) {
+          std::thread worker(&ScalingBench::Work, this, i, generation++,
+                             std::ref(stop), &results[i]);
+          worker.join();
+        }
+      });
+    }
+    std::this_thread::sleep_for(
+        std::chrono::duration<double>(options_.duration));
+    stop.store(true, std::memory_order_relaxed);
+    for (std::thread& slot : slots) {
+      slot.join();
+    }
+    double seconds = (NowNanos() - start) / 1e9;
+    Report(num_threads, results, seconds,
+           std::stoull(GetStat("busy_retries")) - busy_before);
+  }
+
+  static void PrintHeader() {
+    printf("%7s %12s %10s %8s %8s %8s %9s %9s %9s %9s %9s %9s %9s %9s\n",
+           "threads", "ops/s", "MB/s", "jain", "min/max", "errors", "c_p50",
+           "c_p99", "c_p99.9", "u_p50", "u_p99", "u_p99.9", "first_p99",
+           "busy");
+  }
+
+ private:
+  static constexpr uint32_t kNumBlocks = 16;
+
+  void Work(uint32_t slot, uint32_t generation, std::atomic<bool>& stop,
+            WorkerResult* result) {
+    std::mt19937_64 rng(uint64_t{slot} << 32 | generation);
+    std::uniform_real_distribution<double> coin(0, 1);
+    CompressionInfo compr_info(CompressionDict::GetEmptyDict());
+    UncompressionInfo uncompr_info(UncompressionDict::GetEmptyDict());
+    std::string compressed;
+    result->threads++;
+    for (uint64_t n = 0; options_.churn == 0 || n < options_.churn; n++) {
+      if (stop.load(std::memory_order_relaxed)) {
+        break;
+      }
+      uint32_t block = rng() % kNumBlocks;
+      bool read = coin(rng) < options_.read_ratio;
+      Status s;
+      uint64_t call_start = NowNanos();
+      if (read) {
+        char* uncompressed = nullptr;
+        size_t uncompressed_length = 0;
+        s = compressor_->Uncompress(uncompr_info, compressed_[block].data(),
+                                    compressed_[block].size(), &uncompressed,
+                                    &uncompressed_length);
+        delete[] uncompressed;
+      } else {
+        compressed.clear();
+        s = compressor_->Compress(compr_info, blocks_[block], &compressed);
+      }
+      uint64_t latency = NowNanos() - call_start;
+      if (!s.ok()) {
+        result->errors++;
+        continue;
+      }
+      (read ? result->uncompress_latency : result->compress_latency)
+          .Add(latency);
+      if (n == 0) {
+        result->first_call_latency.Add(latency);
+      }
+      result->ops++;
+      result->bytes += options_.block_size;
+    }
+  }
+
+  std::string GetStat(const std::string& name) {
+    std::string value;
+    ConfigOptions config_options;
+    Status s = compressor_->GetOption(config_options, "stats", &value);
+    std::unordered_map<std::string, std::string> stats;
+    if (s.ok()) {
+      s = StringToMap(value, &stats);
+    }
+    return s.ok() && stats.count(name) ? stats[name] : "0";
+  }
+
+  void Report(uint32_t num_threads, const std::vector<WorkerResult>& results,
+              double seconds, uint64_t busy_retries) {
+    WorkerResult total;
+    double sum = 0;
+    double sum_squares = 0;
+    uint64_t min_ops = UINT64_MAX;
+    uint64_t max_ops = 0;
+    for (const WorkerResult& result : results) {
+      total.ops += result.ops;
+      total.bytes += result.bytes;
+      total.errors += result.errors;
+      total.compress_latency.Merge(result.compress_latency);
+      total.uncompress_latency.Merge(result.uncompress_latency);
+      total.first_call_latency.Merge(result.first_call_latency);
+      sum += result.ops;
+      sum_squares += static_cast<double>(result.ops) * result.ops;
+      min_ops = std::min(min_ops, result.ops);
+      max_ops = std::max(max_ops, result.ops);
+    }
+    // Jain's fairness index: 1 if all workers completed the same number of
+    // calls, 1/threads if a single worker did all of them
+    double jain = sum_squares > 0 ? sum * sum / (num_threads * sum_squares) : 0;
+    double min_max = max_ops > 0 ? static_cast<double>(min_ops) / max_ops : 0;
+    auto us = [](const HistogramData& data, double percentile) {
+      return data.Count() > 0 ? data.Percentile(percentile) / 1e3 : 0.0;
+    };
+    printf(
+        "%7u %12.0f %10.1f %8.3f %8.3f %8" PRIu64
+        " %9.1f %9.1f %9.1f %9.1f %9.1f %9.1f %9.1f %9" PRIu64 "\n",
+        num_threads, total.ops / seconds, total.bytes / seconds / 1e6, jain,
+        min_max, total.errors, us(total.compress_latency, 50),
+        us(total.compress_latency, 99), us(total.compress_latency, 99.9),
+        us(total.uncompress_latency, 50), us(total.uncompress_latency, 99),
+        us(total.uncompress_latency, 99.9),
+        us(total.first_call_latency, 99), busy_retries);
+    fflush(stdout);
+  }
+
+  const ScalingOptions& options_;
+  std::shared_ptr<Compressor> compressor_;
+  std::vector<std::string> blocks_;
+  std::vector<std::string> compressed_;
+};
+
+}  // namespace ROCKSDB_NAMESPACE
+
+using ROCKSDB_NAMESPACE::ScalingOptions;
+
+static bool ParseFlag(const char* arg, const char* name, std::string* value) {
+  size_t length = strlen(name);
+  if (strncmp(arg, name, length) != 0 || arg[length] != '=') {
+    return false;
+  }
+  *value = arg + length + 1;
+  return true;
+}
+
+int main(int argc, char** argv) {
+  ScalingOptions options;
+  for (int i = 1; i < argc; i++) {
+    std::string value;
+    if (ParseFlag(argv[i], "--threads", &value)) {
+      options.threads.clear();
+      std::stringstream list(value);
+      std::string count;
+      while (std::getline(list, count, ',')) {
+        options.threads.push_back(static_cast<uint32_t>(std::stoul(count)));
+      }
+    } else if (ParseFlag(argv[i], "--read_ratio", &value)) {
+      options.read_ratio = std::stod(value);
+    } else if (ParseFlag(argv[i], "--block_size", &value)) {
+      options.block_size = std::stoull(value);
+    } else if (ParseFlag(argv[i], "--duration", &value)) {
+      options.duration = std::stod(value);
+    } else if (ParseFlag(argv[i], "--churn", &value)) {
+      options.churn = std::stoull(value);
+    } else if (ParseFlag(argv[i], "--options", &value)) {
+      options.options = value;
+    } else {
+      fprintf(stderr, "Unknown argument: %s\n", argv[i]);
+      return 1;
+    }
+  }
+
+  std::shared_ptr<ROCKSDB_NAMESPACE::Compressor> compressor;
+  ROCKSDB_NAMESPACE::ConfigOptions config_options;
+  ROCKSDB_NAMESPACE::Status s =
+      ROCKSDB_NAMESPACE::Compressor::CreateFromString(
+          config_options,
+          "id=com.intel.iaa_compressor_rocksdb;" + options.options,
+          &compressor);
+  if (!s.ok()) {
+    fprintf(stderr, "Cannot create compressor: %s\n", s.ToString().c_str());
+    return 1;
+  }
+  ROCKSDB_NAMESPACE::ScalingBench bench(options, compressor);
+  s = bench.Prepare();
+  if (!s.ok()) {
+    fprintf(stderr, "Cannot compress input: %s\n", s.ToString().c_str());
+    return 1;
+  }
+
+  printf("options=%s read_ratio=%.2f block_size=%zu duration=%.1fs churn=%"
+         PRIu64 "\n",
+         options.options.c_str(), options.read_ratio, options.block_size,
+         options.duration, options.churn);
+  printf("Latencies in microseconds (c: Compress, u: Uncompress)\n");
+  ROCKSDB_NAMESPACE::ScalingBench::PrintHeader();
+  for (uint32_t threads : options.threads) {
+    bench.Run(threads);
+  }
+  return 0;
+}
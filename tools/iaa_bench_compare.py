@@ -0,0 +1,193 @@
+#!/usr/bin/env python3
+# Copyright (C) 2022 Intel Corporation
+
+# SPDX-License-Identifier: Apache-2.0
+
+"""Performance regression tracking for the IAA compressor benchmarks.
+
+Runs a Google Benchmark target (iaa_compressor_bench by default, on the
+software path unless --paths is passed through) with repetitions, saves the
+results as the baseline of the machine profile, and compares later runs
+against it. A benchmark regresses if its mean throughput drops by more than
+--threshold percent and the drop is statistically significant (Welch's t-test
+over the repetitions).
+
+Examples:
+  tools/iaa_bench_compare.py run --bench=./iaa_compressor_bench --out=new.json
+  tools/iaa_bench_compare.py save new.json
+  tools/iaa_bench_compare.py compare new.json
+  tools/iaa_bench_compare.py check --bench=./iaa_compressor_bench -- \\
+      --paths=sw,hw
+
+Baselines are stored as <baseline_dir>/<profile>.json. The profile defaults
+to the host name, CPU model and CPU count, so results from different machines
+are never compared.
+"""
+
+import argparse
+import json
+import math
+import os
+import re
+import socket
+import statistics
+import subprocess
+import sys
+
+
+def machine_profile():
+    model = "unknown"
+    try:
+        with open("/proc/cpuinfo") as f:
+            for line in f:
+                if line.startswith("model name"):
+                    model = line.split(":", 1)[1].strip()
+                    break
+    except OSError:
+        pass
+    profile = f"{socket.gethostname()}-{model}-{os.cpu_count()}cpu"
+    return re.sub(r"[^A-Za-z0-9.=-]+", "_", profile)
+
+
+def run_benchmark(bench, repetitions, extra, out):
+    command = [bench, f"--benchmark_repetitions={repetitions}",
+               "--benchmark_out_format=json", f"--benchmark_out={out}",
+               "--benchmark_report_aggregates_only=false"] + extra
+    print(" ".join(command), flush=True)
+    subprocess.run(command, check=True)
+
+
+def load_samples(path):
+    """Returns {benchmark name: [bytes_per_second of each repetition]}."""
+    with open(path) as f:
+        results = json.load(f)
+    samples = {}
+    for benchmark in results["benchmarks"]:
+        if benchmark.get("run_type", "iteration") != "iteration":
+            continue
+        if "error_occurred" in benchmark or "bytes_per_second" not in benchmark:
+            continue
+        name = benchmark.get("run_name", benchmark["name"])
+        samples.setdefault(name, []).append(benchmark["bytes_per_second"])
+    return samples
+
+
+def welch_t(a, b):
+    """Welch's t statistic of mean(a) - mean(b), and its degrees of freedom."""
+    if len(a) < 2 or len(b) < 2:
+        return None, None
+    va = statistics.variance(a) / len(a)
+    vb = statistics.variance(b) / len(b)
+    if va + vb == 0:
+        return math.inf if statistics.mean(a) != statistics.mean(b) else 0, 1
+    t = (statistics.mean(a) - statistics.mean(b)) / math.sqrt(va + vb)
+    df = (va + vb) ** 2 / (va ** 2 / (len(a) - 1) + vb ** 2 / (len(b) - 1))
+    return t, df
+
+
+def t_critical(df):
+    """Two-sided critical value of Student's t for p = 0.01."""
+    table = [(1, 63.66), (2, 9.92), (3, 5.84), (4, 4.60), (5, 4.03),
+             (6, 3.71), (8, 3.36), (10, 3.17), (15, 2.95), (20, 2.85),
+             (30, 2.75), (60, 2.66)]
+    for limit, value in table:
+        if df <= limit:
+            return value
+    return 2.58
+
+
+def compare(baseline, current, threshold):
+    """Returns a row per benchmark in both runs:
+    (name, baseline mean, current mean, change %, t, verdict)."""
+    rows = []
+    for name in sorted(set(baseline) & set(current)):
+        base_mean = statistics.mean(baseline[name])
+        mean = statistics.mean(current[name])
+        change = (mean - base_mean) / base_mean * 100
+        t, df = welch_t(current[name], baseline[name])
+        significant = t is not None and abs(t) > t_critical(df)
+        if change < -threshold and significant:
+            verdict = "REGRESSION"
+        elif change > threshold and significant:
+            verdict = "improvement"
+        else:
+            verdict = "ok"
+        rows.append((name, base_mean, mean, change, t, verdict))
+    return rows
+
+
+def print_comparison(rows, baseline, current):
+    print(f"{'benchmark':<64} {'base MB/s':>10} {'new MB/s':>10} "
+          f"{'change':>8} {'t':>7}  verdict")
+    for name, base_mean, mean, change, t, verdict in rows:
+        t_text = f"{t:7.2f}" if t is not None and math.isfinite(t) else \
+            f"{'-':>7}"
+        print(f"{name:<64} {base_mean / 1e6:10.1f} {mean / 1e6:10.1f} "
+              f"{change:7.1f}% {t_text}  {verdict}")
+    for name in sorted(set(baseline) - set(current)):
+        print(f"{name:<64} missing from the current run")
+    regressions = [row[0] for row in rows if row[5] == "REGRESSION"]
+    if regressions:
+        print(f"\n{len(regressions)} regression(s):")
+        for name in regressions:
+            print(f"  {name}")
+    else:
+        print("\nNo regressions")
+    return regressions
+
+
+def baseline_path(args):
+    return os.path.join(args.baseline_dir,
+                        (args.profile or machine_profile()) + ".json")
+
+
+def main():
+    parser = argparse.ArgumentParser(
+        description=__doc__.split("\n\n", maxsplit=1)[0],
+        formatter_class=argparse.RawDescriptionHelpFormatter, epilog=__doc__)
+    parser.add_argument("command", choices=["run", "save", "compare", "check"])
+    parser.add_argument("results", nargs="?",
+                        help="results JSON (save and compare)")
+    parser.add_argument("--bench", default="./iaa_compressor_bench")
+    parser.add_argument("--repetitions", type=int, default=10)
+    parser.add_argument("--out", default="iaa_compressor_bench.json")
+    parser.add_argument("--baseline_dir", default="baselines")
+    parser.add_argument("--profile", help="machine profile of the baseline")
+    parser.add_argument("--threshold", type=float, default=5.0,
+                        help="minimum throughput drop, in percent")
+    # Flags after -- are passed to the benchmark
+    argv = sys.argv[1:]
+    extra = []
+    if "--" in argv:
+        extra = argv[argv.index("--") + 1:]
+        argv = argv[:argv.index("--")]
+    args = parser.parse_args(argv)
+
+    if args.command in ("run", "check"):
+        run_benchmark(args.bench, args.repetitions, extra, args.out)
+        args.results = args.results or args.out
+    if args.results is None:
+        parser.error(f"{args.command} requires a results file")
+
+    path = baseline_path(args)
+    if args.command == "save":
+        os.makedirs(args.baseline_dir, exist_ok=True)
+        with open(args.results) as f:
+            results = json.load(f)
+        with open(path, "w") as f:
+            json.dump(results, f, indent=2)
+        print(f"Saved baseline {path}")
+    elif args.command in ("compare", "check"):
+        if not os.path.exists(path):
+            print(f"No baseline {path}; create one with save", file=sys.stderr)
+            return 2
+        baseline = load_samples(path)
+        current = load_samples(args.results)
+        rows = compare(baseline, current, args.threshold)
+        if print_comparison(rows, baseline, current):
+            return 1
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
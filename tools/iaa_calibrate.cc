@@ -0,0 +1,50 @@
+// Copyright (C) 2022 Intel Corporation
+
+// SPDX-License-Identifier: Apache-2.0
+
+// Calibrates the offload thresholds of the IAA compressor on this machine and
+// writes a calibration profile, to be loaded with the calibration_profile
+// option.
+//
+// Usage: iaa_calibrate --profile=<file> [--iterations=200]
+//            [--options=<compressor options>]
+
+#include <cstdio>
+#include <cstring>
+#include <string>
+
+#include "../iaa_compressor.h"
+
+int main(int argc, char** argv) {
+  std::string profile;
+  std::string options;
+  uint32_t iterations = 200;
+  for (int i = 1; i < argc; i++) {
+    if (strncmp(argv[i], "--profile=", 10) == 0) {
+      profile = argv[i] + 10;
+    } else if (strncmp(argv[i], "--iterations=", 13) == 0) {
+      iterations = static_cast<uint32_t>(std::stoul(argv[i] + 13));
+    } else if (strncmp(argv[i], "--options=", 10) == 0) {
+      options = argv[i] + 10;
+    } else {
+      fprintf(stderr, "Unknown argument: %s\n", argv[i]);
+      return 1;
+    }
+  }
+  if (profile.empty()) {
+    fprintf(stderr, "--profile is required\n");
+    return 1;
+  }
+
+  printf("fingerprint=%s\n",
+         ROCKSDB_NAMESPACE::GetIAAHardwareFingerprint().c_str());
+  std::string report;
+  ROCKSDB_NAMESPACE::Status s =
+      ROCKSDB_NAMESPACE::CalibrateIAA(profile, options, iterations, &report);
+  if (!s.ok()) {
+    fprintf(stderr, "Calibration failed: %s\n", s.ToString().c_str());
+    return 1;
+  }
+  printf("%sProfile written to %s\n", report.c_str(), profile.c_str());
+  return 0;
+}
@@ -0,0 +1,207 @@
+#!/usr/bin/env python3
+# Copyright (C) 2022 Intel Corporation
+
+# SPDX-License-Identifier: Apache-2.0
+
+"""End-to-end RocksDB workload suite for the IAA compressor.
+
+Runs db_bench workloads (fillrandom, overwrite, readrandom, seekrandom, a
+read/write mix and a compaction-heavy fill) with the IAA compressor on each
+execution path and compression mode, and with RocksDB's LZ4, ZSTD and no
+compression. Writes a CSV and a Markdown report with ops/s, p99 latency,
+write amplification, CPU time per operation, compression ratio and stall time.
+
+Example:
+  tools/iaa_db_bench_suite.py --db_bench=./db_bench --db=/mnt/nvme/iaa \\
+      --paths=sw --num=1000000 --report=iaa_suite
+"""
+
+import argparse
+import csv
+import os
+import re
+import resource
+import shutil
+import subprocess
+import sys
+import time
+
+IAA_ID = "com.intel.iaa_compressor_rocksdb"
+
+# Workloads run in order on the same database, except those with fresh=True,
+# which start from an empty database. Each entry: name, db_bench benchmarks,
+# extra flags, fresh.
+WORKLOADS = [
+    ("fillrandom", "fillrandom", [], True),
+    ("overwrite", "overwrite", [], False),
+    ("readrandom", "readrandom", [], False),
+    ("seekrandom", "seekrandom", ["--seek_nexts=10"], False),
+    ("mixed", "readrandomwriterandom", ["--readwritepercent=80"], False),
+    # Small memtables and levels, so that most of the time goes to compaction
+    ("compaction", "fillrandom",
+     ["--write_buffer_size=4194304", "--target_file_size_base=4194304",
+      "--max_bytes_for_level_base=16777216",
+      "--level0_file_num_compaction_trigger=2"], True),
+]
+
+COLUMNS = ["compressor", "workload", "ops_per_sec", "p99_us", "write_amp",
+           "cpu_us_per_op", "sst_bytes", "compression_ratio", "stall_sec",
+           "status"]
+
+
+def compressors(paths, baselines):
+    """Returns (name, db_bench flags) of each compressor to run."""
+    result = []
+    for path in paths:
+        for mode in ("dynamic", "fixed"):
+            result.append((f"iaa-{path}-{mode}", [
+                f"--compression_type={IAA_ID}",
+                f"--compressor_options=execution_path={path};"
+                f"compression_mode={mode}"]))
+    for baseline in baselines:
+        result.append((baseline, [f"--compression_type={baseline}"]))
+    return result
+
+
+def parse_output(benchmark, output):
+    """Extracts metrics from db_bench output run with --statistics and
+    --histogram."""
+    metrics = {}
+    match = re.search(rf"^{benchmark}\s*:\s*([\d.]+) micros/op (\d+) ops/sec",
+                      output, re.MULTILINE)
+    if match:
+        metrics["ops_per_sec"] = int(match.group(2))
+    match = re.search(r"^Count:\s*(\d+)", output, re.MULTILINE)
+    if match:
+        metrics["ops"] = int(match.group(1))
+    match = re.search(r"P99:\s*([\d.]+)", output)
+    if match:
+        metrics["p99_us"] = float(match.group(1))
+
+    def ticker(name):
+        match = re.search(rf"^{re.escape(name)} COUNT : (\d+)", output,
+                          re.MULTILINE)
+        return int(match.group(1)) if match else 0
+
+    written = ticker("rocksdb.bytes.written")
+    flushed = ticker("rocksdb.flush.write.bytes")
+    compacted = ticker("rocksdb.compact.write.bytes")
+    if written > 0:
+        metrics["write_amp"] = round((flushed + compacted) / written, 3)
+    metrics["stall_sec"] = ticker("rocksdb.stall.micros") / 1e6
+    return metrics
+
+
+def sst_bytes(db):
+    total = 0
+    for entry in os.scandir(db):
+        if entry.name.endswith(".sst"):
+            total += entry.stat().st_size
+    return total
+
+
+def run_workload(args, compressor_flags, workload, db):
+    name, benchmark, flags, _ = workload
+    command = [args.db_bench, f"--benchmarks={benchmark}", f"--db={db}",
+               f"--num={args.num}", f"--value_size={args.value_size}",
+               f"--threads={args.threads}", "--statistics", "--histogram",
+               "--use_existing_db=" + ("0" if workload[3] else "1")]
+    if benchmark != "fillrandom" and args.duration > 0:
+        command.append(f"--duration={args.duration}")
+    command += compressor_flags + flags + args.extra
+    before = resource.getrusage(resource.RUSAGE_CHILDREN)
+    start = time.time()
+    result = subprocess.run(command, stdout=subprocess.PIPE,
+                            stderr=subprocess.STDOUT, text=True, check=False)
+    elapsed = time.time() - start
+    after = resource.getrusage(resource.RUSAGE_CHILDREN)
+    if args.verbose:
+        print(result.stdout)
+    if result.returncode != 0:
+        tail = result.stdout.strip().splitlines()[-1:] or ["no output"]
+        return {"status": f"failed ({result.returncode}): {tail[0]}"}
+
+    metrics = parse_output(benchmark, result.stdout)
+    cpu = (after.ru_utime - before.ru_utime) + (after.ru_stime -
+                                                before.ru_stime)
+    ops = metrics.pop("ops", 0) or int(metrics.get("ops_per_sec", 0) *
+                                       elapsed)
+    if ops > 0:
+        metrics["cpu_us_per_op"] = round(cpu * 1e6 / ops, 3)
+    metrics["sst_bytes"] = sst_bytes(db)
+    metrics["status"] = "ok"
+    print(f"  {name}: {metrics.get('ops_per_sec', '?')} ops/s", flush=True)
+    return metrics
+
+
+def write_reports(rows, prefix):
+    with open(prefix + ".csv", "w", newline="") as f:
+        writer = csv.DictWriter(f, fieldnames=COLUMNS)
+        writer.writeheader()
+        for row in rows:
+            writer.writerow({column: row.get(column, "") for column in COLUMNS})
+    with open(prefix + ".md", "w") as f:
+        f.write("| " + " | ".join(COLUMNS) + " |\n")
+        f.write("|" + "---|" * len(COLUMNS) + "\n")
+        for row in rows:
+            f.write("| " + " | ".join(str(row.get(column, ""))
+                                      for column in COLUMNS) + " |\n")
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument("--db_bench", default="./db_bench")
+    parser.add_argument("--db", default="/tmp/iaa_db_bench_suite")
+    parser.add_argument("--paths", default="sw,hw,auto",
+                        help="IAA execution paths, comma-separated")
+    parser.add_argument("--baselines", default="lz4,zstd,none",
+                        help="db_bench compression types, comma-separated")
+    parser.add_argument("--workloads", default=",".join(w[0] for w in
+                                                         WORKLOADS))
+    parser.add_argument("--num", type=int, default=1000000)
+    parser.add_argument("--value_size", type=int, default=400)
+    parser.add_argument("--threads", type=int, default=1)
+    parser.add_argument("--duration", type=int, default=0,
+                        help="seconds per workload after fillrandom "
+                        "(0: --num operations)")
+    parser.add_argument("--report", default="iaa_db_bench_suite",
+                        help="prefix of the .csv and .md reports")
+    parser.add_argument("--verbose", action="store_true")
+    parser.add_argument("extra", nargs="*",
+                        help="flags passed to db_bench (after --)")
+    args = parser.parse_args()
+
+    selected = args.workloads.split(",")
+    workloads = [w for w in WORKLOADS if w[0] in selected]
+    rows = []
+    for name, flags in compressors(
+            [p for p in args.paths.split(",") if p],
+            [b for b in args.baselines.split(",") if b]):
+        print(f"{name}", flush=True)
+        shutil.rmtree(args.db, ignore_errors=True)
+        if workloads and not workloads[0][3]:
+            # Workloads on an existing database need one to be loaded first
+            run_workload(args, flags, WORKLOADS[0], args.db)
+        for workload in workloads:
+            if workload[3]:
+                shutil.rmtree(args.db, ignore_errors=True)
+            row = {"compressor": name, "workload": workload[0]}
+            row.update(run_workload(args, flags, workload, args.db))
+            rows.append(row)
+    shutil.rmtree(args.db, ignore_errors=True)
+
+    # Compression ratio relative to the same workload without compression
+    uncompressed = {row["workload"]: row.get("sst_bytes", 0)
+                    for row in rows if row["compressor"] == "none"}
+    for row in rows:
+        base = uncompressed.get(row["workload"], 0)
+        if base and row.get("sst_bytes"):
+            row["compression_ratio"] = round(base / row["sst_bytes"], 3)
+
+    write_reports(rows, args.report)
+    print(f"Reports written to {args.report}.csv and {args.report}.md")
+    return 0 if all(row.get("status") == "ok" for row in rows) else 1
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -0,0 +1,353 @@
+// Copyright (C) 2022 Intel Corporation
+
+// SPDX-License-Identifier: Apache-2.0
+
+// Rewrites existing SST files (e.g., compressed with LZ4, Zlib or ZSTD) with
+// the IAA compressor, without waiting for compaction to rewrite them. Each
+// input file is checked, read and written to the output directory under the
+// same name as a file that can be ingested with IngestExternalFile. The
+// output is then read back and compared with the input.
+//
+// Usage: iaa_recompress --input=<file or directory> --output_dir=<directory>
+//            [--compressor=<options>] [--threads=1] [--block_size=4096]
+//            [--rate_mb=0] [--output_level=-1] [--verify=true]
+//
+// --threads files are rewritten concurrently. parallel_threads in
+// --compressor compresses several blocks of each file at once, which keeps
+// more jobs in flight on the hardware path. --rate_mb limits the input read
+// by all threads, in MB/s (0 = unlimited). --output_level selects the entry
+// of the policies option applied to the output, for files to be ingested at
+// that level.
+
+#include <algorithm>
+#include <atomic>
+#include <cinttypes>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "../iaa_compressor.h"
+#include "../iaa_stats.h"
+#include "rocksdb/comparator.h"
+#include "rocksdb/convenience.h"
+#include "rocksdb/rate_limiter.h"
+#include "rocksdb/sst_file_reader.h"
+#include "rocksdb/sst_file_writer.h"
+#include "rocksdb/table.h"
+#include "rocksdb/table_properties.h"
+#include "util/defer.h"
+
+namespace ROCKSDB_NAMESPACE {
+
+struct RecompressOptions {
+  std::string output_dir;
+  std::string compressor = "execution_path=auto";
+  size_t block_size = 4096;
+  uint64_t rate_mb = 0;
+  int output_level = -1;
+  bool verify = true;
+};
+
+struct RecompressResult {
+  uint64_t bytes_in = 0;
+  uint64_t bytes_out = 0;
+  uint64_t entries = 0;
+  uint64_t nanos = 0;
+};
+
+class Recompressor {
+ public:
+  explicit Recompressor(const RecompressOptions& options)
+      : options_(options) {}
+
+  Status Prepare() {
+    ConfigOptions config_options;
+    Status s = Compressor::CreateFromString(
+        config_options, "id=com.intel.iaa_compressor_rocksdb;" +
+                            options_.compressor,
+        &compressor_);
+    if (!s.ok()) {
+      return s;
+    }
+    if (options_.rate_mb > 0) {
+      rate_limiter_.reset(NewGenericRateLimiter(
+          static_cast<int64_t>(options_.rate_mb) * 1000000));
+    }
+    BlockBasedTableOptions table_options;
+    table_options.block_size = options_.block_size;
+    read_options_.compressor = compressor_;
+    write_options_.compressor = compressor_;
+    write_options_.table_factory.reset(
+        NewBlockBasedTableFactory(table_options));
+    return Env::Default()->CreateDirIfMissing(options_.output_dir);
+  }
+
+  // Rewrites input into the output directory. Files that cannot be rewritten
+  // as ingestible files without changing their contents are reported as
+  // NotSupported.
+  Status Recompress(const std::string& input, RecompressResult* result) {
+    uint64_t start = NowNanos();
+    std::string output =
+        options_.output_dir + "/" + input.substr(input.rfind('/') + 1);
+    if (output == input) {
+      return Status::InvalidArgument("output would overwrite input", input);
+    }
+
+    SstFileReader reader(read_options_);
+    Status s = reader.Open(input);
+    if (s.ok()) {
+      s = reader.VerifyChecksum();
+    }
+    if (!s.ok()) {
+      return s;
+    }
+    // The reader returns the latest value of each key, so tombstones and
+    // merge operands would be lost
+    std::shared_ptr<const TableProperties> properties =
+        reader.GetTableProperties();
+    if (properties->num_deletions > 0 || properties->num_merge_operands > 0 ||
+        properties->num_range_deletions > 0) {
+      return Status::NotSupported("file has deletions or merge operands");
+    }
+    if (properties->comparator_name != BytewiseComparator()->Name()) {
+      return Status::NotSupported("comparator",
+                                  properties->comparator_name);
+    }
+    s = Env::Default()->GetFileSize(input, &result->bytes_in);
+    if (!s.ok()) {
+      return s;
+    }
+
+    SetIAAThreadOutputLevel(options_.output_level);
+    // Reset on every return, so that the next file of the thread starts clean
+    Defer reset_output_level([]() { SetIAAThreadOutputLevel(-1); });
+    SstFileWriter writer(EnvOptions(), write_options_);
+    s = writer.Open(output);
+    if (!s.ok()) {
+      return s;
+    }
+    ReadOptions read_options;
+    read_options.fill_cache = false;
+    std::unique_ptr<Iterator> it(reader.NewIterator(read_options));
+    uint64_t unthrottled = 0;
+    for (it->SeekToFirst(); it->Valid() && s.ok(); it->Next()) {
+      s = writer.Put(it->key(), it->value());
+      result->entries++;
+      unthrottled += it->key().size() + it->value().size();
+      if (unthrottled >= (1 << 20)) {
+        Throttle(unthrottled);
+        unthrottled = 0;
+      }
+    }
+    Throttle(unthrottled);
+    if (s.ok()) {
+      s = it->status();
+    }
+    ExternalSstFileInfo info;
+    if (s.ok()) {
+      s = writer.Finish(&info);
+    }
+    if (!s.ok()) {
+      return s;
+    }
+    result->bytes_out = info.file_size;
+    if (options_.verify) {
+      s = Verify(input, output);
+    }
+    result->nanos = NowNanos() - start;
+    return s;
+  }
+
+ private:
+  // Waits until bytes of input may be processed
+  void Throttle(uint64_t bytes) {
+    if (rate_limiter_ == nullptr) {
+      return;
+    }
+    int64_t burst = rate_limiter_->GetSingleBurstBytes();
+    int64_t remaining = static_cast<int64_t>(bytes);
+    while (remaining > 0) {
+      int64_t request = std::min(remaining, burst);
+      rate_limiter_->Request(request, Env::IO_LOW, nullptr);
+      remaining -= request;
+    }
+  }
+
+  // Checks the block checksums of the output and that it decompresses to the
+  // entries of the input
+  Status Verify(const std::string& input, const std::string& output) {
+    SstFileReader input_reader(read_options_);
+    SstFileReader output_reader(read_options_);
+    Status s = input_reader.Open(input);
+    if (s.ok()) {
+      s = output_reader.Open(output);
+    }
+    if (s.ok()) {
+      s = output_reader.VerifyChecksum();
+    }
+    if (!s.ok()) {
+      return s;
+    }
+    ReadOptions read_options;
+    read_options.fill_cache = false;
+    std::unique_ptr<Iterator> expected(input_reader.NewIterator(read_options));
+    std::unique_ptr<Iterator> actual(output_reader.NewIterator(read_options));
+    expected->SeekToFirst();
+    actual->SeekToFirst();
+    while (expected->Valid() && actual->Valid()) {
+      if (expected->key() != actual->key() ||
+          expected->value() != actual->value()) {
+        return Status::Corruption("output differs from input", output);
+      }
+      expected->Next();
+      actual->Next();
+    }
+    if (expected->Valid() || actual->Valid()) {
+      return Status::Corruption("output differs from input", output);
+    }
+    s = expected->status();
+    return s.ok() ? actual->status() : s;
+  }
+
+  RecompressOptions options_;
+  std::shared_ptr<Compressor> compressor_;
+  std::shared_ptr<RateLimiter> rate_limiter_;
+  Options read_options_;
+  Options write_options_;
+};
+
+static Status ListInputs(const std::string& input,
+                         std::vector<std::string>* files) {
+  bool is_dir = false;
+  Status s = Env::Default()->IsDirectory(input, &is_dir);
+  if (!s.ok()) {
+    return s;
+  }
+  if (!is_dir) {
+    files->push_back(input);
+    return Status::OK();
+  }
+  std::vector<std::string> children;
+  s = Env::Default()->GetChildren(input, &children);
+  if (!s.ok()) {
+    return s;
+  }
+  for (const std::string& child : children) {
+    if (child.size() > 4 && child.compare(child.size() - 4, 4, ".sst") == 0) {
+      files->push_back(input + "/" + child);
+    }
+  }
+  return Status::OK();
+}
+
+static void PrintResult(const std::string& name,
+                        const RecompressResult& result) {
+  double seconds = result.nanos / 1e9;
+  double gb = result.bytes_in / 1e9;
+  printf("%-40s %12" PRIu64 " %12" PRIu64 " %7.3f %9.2f %9.1f %9.2f\n",
+         name.c_str(), result.bytes_in, result.bytes_out,
+         result.bytes_out > 0
+             ? static_cast<double>(result.bytes_in) / result.bytes_out
+             : 0.0,
+         seconds, seconds > 0 ? result.bytes_in / 1e6 / seconds : 0.0,
+         gb > 0 ? seconds / gb : 0.0);
+  fflush(stdout);
+}
+
+}  // namespace ROCKSDB_NAMESPACE
+
+int main(int argc, char** argv) {
+  using namespace ROCKSDB_NAMESPACE;
+
+  std::string input;
+  RecompressOptions options;
+  uint32_t threads = 1;
+  for (int i = 1; i < argc; i++) {
+    if (strncmp(argv[i], "--input=", 8) == 0) {
+      input = argv[i] + 8;
+    } else if (strncmp(argv[i], "--output_dir=", 13) == 0) {
+      options.output_dir = argv[i] + 13;
+    } else if (strncmp(argv[i], "--compressor=", 13) == 0) {
+      options.compressor = argv[i] + 13;
+    } else if (strncmp(argv[i], "--threads=", 10) == 0) {
+      threads = static_cast<uint32_t>(std::stoul(argv[i] + 10));
+    } else if (strncmp(argv[i], "--block_size=", 13) == 0) {
+      options.block_size = std::stoul(argv[i] + 13);
+    } else if (strncmp(argv[i], "--rate_mb=", 10) == 0) {
+      options.rate_mb = std::stoull(argv[i] + 10);
+    } else if (strncmp(argv[i], "--output_level=", 15) == 0) {
+      options.output_level = std::stoi(argv[i] + 15);
+    } else if (strncmp(argv[i], "--verify=", 9) == 0) {
+      options.verify = strcmp(argv[i] + 9, "true") == 0;
+    } else {
+      fprintf(stderr, "Unknown argument: %s\n", argv[i]);
+      return 1;
+    }
+  }
+  if (input.empty() || options.output_dir.empty()) {
+    fprintf(stderr, "--input and --output_dir are required\n");
+    return 1;
+  }
+  if (threads == 0) {
+    threads = 1;
+  }
+
+  std::vector<std::string> files;
+  Status s = ListInputs(input, &files);
+  Recompressor recompressor(options);
+  if (s.ok()) {
+    s = recompressor.Prepare();
+  }
+  if (!s.ok()) {
+    fprintf(stderr, "Cannot start: %s\n", s.ToString().c_str());
+    return 1;
+  }
+  printf("files=%zu threads=%u compressor=%s block_size=%zu\n", files.size(),
+         threads, options.compressor.c_str(), options.block_size);
+  printf("%-40s %12s %12s %7s %9s %9s %9s\n", "file", "bytes_in", "bytes_out",
+         "ratio", "seconds", "MB/s", "s/GB");
+
+  std::atomic<size_t> next{0};
+  std::mutex mutex;
+  RecompressResult total;
+  size_t skipped = 0;
+  size_t failed = 0;
+  uint64_t start = NowNanos();
+  std::vector<std::thread> workers;
+  for (uint32_t t = 0; t < threads; t++) {
+    workers.emplace_back([&]() {
+      for (size_t i = next++; i < files.size(); i = next++) {
+        RecompressResult result;
+        Status status = recompressor.Recompress(files[i], &result);
+        std::lock_guard<std::mutex> lock(mutex);
+        std::string name = files[i].substr(files[i].rfind('/') + 1);
+        if (status.IsNotSupported()) {
+          printf("%-40s skipped: %s\n", name.c_str(),
+                 status.ToString().c_str());
+          skipped++;
+        } else if (!status.ok()) {
+          printf("%-40s failed: %s\n", name.c_str(),
+                 status.ToString().c_str());
+          failed++;
+        } else {
+          PrintResult(name, result);
+          total.bytes_in += result.bytes_in;
+          total.bytes_out += result.bytes_out;
+          total.entries += result.entries;
+        }
+      }
+    });
+  }
+  for (std::thread& worker : workers) {
+    worker.join();
+  }
+  total.nanos = NowNanos() - start;
+  PrintResult("total", total);
+  printf("recompressed=%zu skipped=%zu failed=%zu entries=%" PRIu64 "\n",
+         files.size() - skipped - failed, skipped, failed, total.entries);
+  return failed > 0 ? 1 : 0;
+}
@@ -0,0 +1,481 @@
+// Copyright (C) 2022 Intel Corporation
+
+// SPDX-License-Identifier: Apache-2.0
+
+// Measures how the data of existing SST files (or of a corpus captured by
+// com.intel.iaa_capture_rocksdb) compresses with the IAA compressor, for each
+// combination of compression mode, level and zero compression on the selected
+// execution paths and for each block size, and with RocksDB's built-in
+// compressors. For each column family, it reports the distribution of the
+// compression ratio of blocks, throughput and latency percentiles, and
+// recommends compressor options and a block size.
+//
+// Usage: iaa_sst_analyzer (--input=<file or directory> | --corpus=<file>)
+//            [--paths=sw] [--baselines=LZ4,ZSTD,Zlib]
+//            [--block_sizes=4096,16384,65536] [--threads=<cores>]
+//            [--sample_mb=1024] [--min_mbps=200]
+//
+// Data blocks are rebuilt from the entries of the SST files, in the format of
+// the block-based table, for each block size. Blocks of a corpus are used as
+// captured. --sample_mb bounds the input read per column family. The
+// recommendation is the configuration with the highest compression ratio among
+// those compressing and uncompressing at --min_mbps MB/s or more, per thread.
+// Configurations are measured concurrently by --threads workers, so
+// throughput is measured under that load.
+
+#include <algorithm>
+#include <atomic>
+#include <cinttypes>
+#include <cstdio>
+#include <cstring>
+#include <iterator>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "../iaa_compressor.h"
+#include "../iaa_corpus.h"
+#include "../iaa_stats.h"
+#include "rocksdb/convenience.h"
+#include "rocksdb/sst_file_reader.h"
+#include "rocksdb/table_properties.h"
+#include "util/coding.h"
+
+namespace ROCKSDB_NAMESPACE {
+
+constexpr char kIAAId[] = "id=com.intel.iaa_compressor_rocksdb;";
+
+// Builds blocks of the given size from sorted entries, with the key prefix
+// compression and restart points of the block-based table format
+class BlockChunker {
+ public:
+  explicit BlockChunker(size_t block_size) : block_size_(block_size) {}
+
+  void Add(const Slice& key, const Slice& value,
+           std::vector<std::string>* blocks) {
+    size_t shared = 0;
+    if (counter_ < kRestartInterval) {
+      size_t limit = std::min(last_key_.size(), key.size());
+      while (shared < limit && last_key_[shared] == key[shared]) {
+        shared++;
+      }
+    } else {
+      restarts_.push_back(static_cast<uint32_t>(block_.size()));
+      counter_ = 0;
+    }
+    PutVarint32(&block_, static_cast<uint32_t>(shared));
+    PutVarint32(&block_, static_cast<uint32_t>(key.size() - shared));
+    PutVarint32(&block_, static_cast<uint32_t>(value.size()));
+    block_.append(key.data() + shared, key.size() - shared);
+    block_.append(value.data(), value.size());
+    last_key_.assign(key.data(), key.size());
+    counter_++;
+    if (block_.size() >= block_size_) {
+      Finish(blocks);
+    }
+  }
+
+  void Finish(std::vector<std::string>* blocks) {
+    if (block_.empty()) {
+      return;
+    }
+    for (uint32_t restart : restarts_) {
+      PutFixed32(&block_, restart);
+    }
+    PutFixed32(&block_, static_cast<uint32_t>(restarts_.size()));
+    blocks->push_back(std::move(block_));
+    block_.clear();
+    restarts_.assign(1, 0);
+    last_key_.clear();
+    counter_ = 0;
+  }
+
+ private:
+  static constexpr uint32_t kRestartInterval = 16;
+
+  size_t block_size_;
+  std::string block_;
+  std::string last_key_;
+  std::vector<uint32_t> restarts_{0};
+  uint32_t counter_ = 0;
+};
+
+// Blocks of a column family at one block size (0 = as captured)
+using SampleKey = std::pair<std::string, size_t>;
+
+struct Samples {
+  std::mutex mutex;
+  std::map<SampleKey, std::vector<std::string>> blocks;
+  std::map<std::string, uint64_t> bytes;
+};
+
+static Status ReadFile(const std::string& path,
+                       const std::vector<size_t>& block_sizes,
+                       uint64_t max_bytes, Samples* samples) {
+  Options options;
+  ConfigOptions config_options;
+  // Reads files written with the IAA compressor
+  Status s = Compressor::CreateFromString(config_options, kIAAId,
+                                          &options.compressor);
+  SstFileReader reader(options);
+  if (s.ok()) {
+    s = reader.Open(path);
+  }
+  if (!s.ok()) {
+    return s;
+  }
+  std::string column_family = reader.GetTableProperties()->column_family_name;
+  {
+    std::lock_guard<std::mutex> lock(samples->mutex);
+    if (max_bytes > 0 && samples->bytes[column_family] >= max_bytes) {
+      return Status::OK();
+    }
+  }
+
+  std::vector<BlockChunker> chunkers(block_sizes.begin(), block_sizes.end());
+  std::vector<std::vector<std::string>> blocks(block_sizes.size());
+  uint64_t bytes = 0;
+  ReadOptions read_options;
+  read_options.fill_cache = false;
+  std::unique_ptr<Iterator> it(reader.NewIterator(read_options));
+  for (it->SeekToFirst(); it->Valid(); it->Next()) {
+    for (size_t i = 0; i < chunkers.size(); i++) {
+      chunkers[i].Add(it->key(), it->value(), &blocks[i]);
+    }
+    bytes += it->key().size() + it->value().size();
+  }
+  if (!it->status().ok()) {
+    return it->status();
+  }
+  for (size_t i = 0; i < chunkers.size(); i++) {
+    chunkers[i].Finish(&blocks[i]);
+  }
+
+  std::lock_guard<std::mutex> lock(samples->mutex);
+  samples->bytes[column_family] += bytes;
+  for (size_t i = 0; i < block_sizes.size(); i++) {
+    std::vector<std::string>& sample =
+        samples->blocks[SampleKey(column_family, block_sizes[i])];
+    std::move(blocks[i].begin(), blocks[i].end(), std::back_inserter(sample));
+  }
+  return Status::OK();
+}
+
+struct AnalyzeResult {
+  uint64_t bytes_in = 0;
+  uint64_t bytes_out = 0;
+  uint64_t compress_nanos = 0;
+  uint64_t uncompress_nanos = 0;
+  // Compression ratio of each block, in hundredths
+  HistogramData ratio;
+  HistogramData compress_latency;
+  HistogramData uncompress_latency;
+
+  double Ratio() const {
+    return bytes_out > 0 ? static_cast<double>(bytes_in) / bytes_out : 0.0;
+  }
+  double CompressMBps() const {
+    return compress_nanos > 0 ? bytes_in * 1e3 / compress_nanos : 0.0;
+  }
+  double UncompressMBps() const {
+    return uncompress_nanos > 0 ? bytes_in * 1e3 / uncompress_nanos : 0.0;
+  }
+};
+
+// One configuration measured on the blocks of a sample
+struct Task {
+  SampleKey sample;
+  std::string name;
+  std::string id_and_options;
+  bool iaa = false;
+  Status status;
+  AnalyzeResult result;
+};
+
+static Status Analyze(const std::string& id_and_options,
+                      const std::vector<std::string>& blocks,
+                      AnalyzeResult* result) {
+  std::shared_ptr<Compressor> compressor;
+  ConfigOptions config_options;
+  Status s =
+      Compressor::CreateFromString(config_options, id_and_options, &compressor);
+  if (!s.ok()) {
+    return s;
+  }
+  CompressionInfo compr_info(CompressionDict::GetEmptyDict());
+  UncompressionInfo uncompr_info(UncompressionDict::GetEmptyDict());
+  std::string compressed;
+  for (const std::string& block : blocks) {
+    compressed.clear();
+    uint64_t start = NowNanos();
+    s = compressor->Compress(compr_info, block, &compressed);
+    uint64_t compress_latency = NowNanos() - start;
+    if (!s.ok()) {
+      return s;
+    }
+
+    char* uncompressed = nullptr;
+    size_t uncompressed_length = 0;
+    start = NowNanos();
+    s = compressor->Uncompress(uncompr_info, compressed.data(),
+                               compressed.size(), &uncompressed,
+                               &uncompressed_length);
+    uint64_t uncompress_latency = NowNanos() - start;
+    std::unique_ptr<char[]> output(uncompressed);
+    if (!s.ok()) {
+      return s;
+    }
+    if (uncompressed_length != block.size() ||
+        memcmp(uncompressed, block.data(), uncompressed_length) != 0) {
+      return Status::Corruption("uncompressed block does not match input");
+    }
+
+    result->bytes_in += block.size();
+    result->bytes_out += compressed.size();
+    result->compress_nanos += compress_latency;
+    result->uncompress_nanos += uncompress_latency;
+    result->compress_latency.Add(compress_latency);
+    result->uncompress_latency.Add(uncompress_latency);
+    result->ratio.Add(compressed.empty() ? 0
+                                         : block.size() * 100 /
+                                               compressed.size());
+  }
+  return Status::OK();
+}
+
+static void PrintHeader() {
+  printf("  %-56s %7s %6s %6s %6s %9s %9s %9s %9s\n", "compressor", "ratio",
+         "r_p10", "r_p50", "r_p90", "c_MB/s", "u_MB/s", "c_p99", "u_p99");
+}
+
+static void PrintTask(const Task& task) {
+  if (!task.status.ok()) {
+    printf("  %-56s skipped: %s\n", task.name.c_str(),
+           task.status.ToString().c_str());
+    return;
+  }
+  const AnalyzeResult& result = task.result;
+  auto ratio = [&](double percentile) {
+    return result.ratio.Percentile(percentile) / 100.0;
+  };
+  auto us = [](const HistogramData& data, double percentile) {
+    return data.Count() > 0 ? data.Percentile(percentile) / 1e3 : 0.0;
+  };
+  printf("  %-56s %7.3f %6.2f %6.2f %6.2f %9.1f %9.1f %9.1f %9.1f\n",
+         task.name.c_str(), result.Ratio(), ratio(10), ratio(50), ratio(90),
+         result.CompressMBps(), result.UncompressMBps(),
+         us(result.compress_latency, 99), us(result.uncompress_latency, 99));
+}
+
+static std::vector<std::string> Split(const std::string& list, char delimiter) {
+  std::vector<std::string> items;
+  std::stringstream stream(list);
+  std::string item;
+  while (std::getline(stream, item, delimiter)) {
+    if (!item.empty()) {
+      items.push_back(item);
+    }
+  }
+  return items;
+}
+
+static Status ListInputs(const std::string& input,
+                         std::vector<std::string>* files) {
+  bool is_dir = false;
+  Status s = Env::Default()->IsDirectory(input, &is_dir);
+  if (!s.ok()) {
+    return s;
+  }
+  if (!is_dir) {
+    files->push_back(input);
+    return Status::OK();
+  }
+  std::vector<std::string> children;
+  s = Env::Default()->GetChildren(input, &children);
+  if (!s.ok()) {
+    return s;
+  }
+  for (const std::string& child : children) {
+    if (child.size() > 4 && child.compare(child.size() - 4, 4, ".sst") == 0) {
+      files->push_back(input + "/" + child);
+    }
+  }
+  return Status::OK();
+}
+
+// Runs fn(i) for i in [0, count) on threads workers
+template <typename Fn>
+static void RunParallel(size_t count, uint32_t threads, Fn fn) {
+  std::atomic<size_t> next{0};
+  std::vector<std::thread> workers;
+  for (uint32_t t = 0; t < threads; t++) {
+    workers.emplace_back([&]() {
+      for (size_t i = next++; i < count; i = next++) {
+        fn(i);
+      }
+    });
+  }
+  for (std::thread& worker : workers) {
+    worker.join();
+  }
+}
+
+}  // namespace ROCKSDB_NAMESPACE
+
+int main(int argc, char** argv) {
+  using namespace ROCKSDB_NAMESPACE;
+
+  std::string input;
+  std::string corpus_path;
+  std::vector<std::string> paths = {"sw"};
+  std::vector<std::string> baselines = {"LZ4", "ZSTD", "Zlib"};
+  std::vector<size_t> block_sizes = {4096, 16384, 65536};
+  uint32_t threads = std::max(1u, std::thread::hardware_concurrency());
+  uint64_t sample_mb = 1024;
+  double min_mbps = 200;
+  for (int i = 1; i < argc; i++) {
+    if (strncmp(argv[i], "--input=", 8) == 0) {
+      input = argv[i] + 8;
+    } else if (strncmp(argv[i], "--corpus=", 9) == 0) {
+      corpus_path = argv[i] + 9;
+    } else if (strncmp(argv[i], "--paths=", 8) == 0) {
+      paths = Split(argv[i] + 8, ',');
+    } else if (strncmp(argv[i], "--baselines=", 12) == 0) {
+      baselines = Split(argv[i] + 12, ',');
+    } else if (strncmp(argv[i], "--block_sizes=", 14) == 0) {
+      block_sizes.clear();
+      for (const std::string& size : Split(argv[i] + 14, ',')) {
+        block_sizes.push_back(std::stoul(size));
+      }
+    } else if (strncmp(argv[i], "--threads=", 10) == 0) {
+      threads = std::max(1u, static_cast<uint32_t>(std::stoul(argv[i] + 10)));
+    } else if (strncmp(argv[i], "--sample_mb=", 12) == 0) {
+      sample_mb = std::stoull(argv[i] + 12);
+    } else if (strncmp(argv[i], "--min_mbps=", 11) == 0) {
+      min_mbps = std::stod(argv[i] + 11);
+    } else {
+      fprintf(stderr, "Unknown argument: %s\n", argv[i]);
+      return 1;
+    }
+  }
+  if (input.empty() == corpus_path.empty()) {
+    fprintf(stderr, "One of --input and --corpus is required\n");
+    return 1;
+  }
+
+  Samples samples;
+  Status s;
+  if (!corpus_path.empty()) {
+    std::vector<CorpusRecord> corpus;
+    s = ReadCorpus(corpus_path, &corpus);
+    std::vector<std::string>& blocks = samples.blocks[SampleKey("corpus", 0)];
+    for (CorpusRecord& record : corpus) {
+      blocks.push_back(std::move(record.data));
+    }
+  } else {
+    std::vector<std::string> files;
+    s = ListInputs(input, &files);
+    std::mutex mutex;
+    RunParallel(files.size(), threads, [&](size_t i) {
+      Status read = ReadFile(files[i], block_sizes, sample_mb << 20, &samples);
+      std::lock_guard<std::mutex> lock(mutex);
+      if (!read.ok()) {
+        fprintf(stderr, "Skipping %s: %s\n", files[i].c_str(),
+                read.ToString().c_str());
+      }
+    });
+  }
+  if (!s.ok() || samples.blocks.empty()) {
+    fprintf(stderr, "No blocks to analyze: %s\n", s.ToString().c_str());
+    return 1;
+  }
+
+  std::vector<std::string> configs;
+  for (const std::string& path : paths) {
+    for (const char* mode : {"dynamic", "fixed"}) {
+      for (const char* level : {"0", "1"}) {
+        for (const char* zero_compress : {"none", "auto"}) {
+          configs.push_back(std::string("execution_path=") + path +
+                            ";compression_mode=" + mode + ";level=" + level +
+                            ";zero_compress=" + zero_compress);
+        }
+      }
+    }
+  }
+  std::vector<Task> tasks;
+  for (const auto& sample : samples.blocks) {
+    for (const std::string& config : configs) {
+      Task task;
+      task.sample = sample.first;
+      task.name = "iaa:" + config;
+      task.id_and_options = kIAAId + config;
+      task.iaa = true;
+      tasks.push_back(task);
+    }
+    for (const std::string& baseline : baselines) {
+      Task task;
+      task.sample = sample.first;
+      task.name = baseline;
+      task.id_and_options = baseline;
+      tasks.push_back(task);
+    }
+  }
+  RunParallel(tasks.size(), threads, [&](size_t i) {
+    tasks[i].status = Analyze(tasks[i].id_and_options,
+                              samples.blocks.at(tasks[i].sample),
+                              &tasks[i].result);
+  });
+
+  printf("threads=%u min_mbps=%.0f\n", threads, min_mbps);
+  printf("Ratio percentiles over blocks (r), latencies in microseconds "
+         "(c: Compress, u: Uncompress)\n");
+  std::string column_family;
+  const Task* best = nullptr;
+  auto recommend = [&]() {
+    if (best == nullptr) {
+      printf("%s: no configuration reaches %.0f MB/s\n\n",
+             column_family.c_str(), min_mbps);
+      return;
+    }
+    printf("%s: recommended compressor={%s}", column_family.c_str(),
+           best->id_and_options.c_str());
+    if (best->sample.second > 0) {
+      printf(" block_size=%zu", best->sample.second);
+    }
+    printf(" (ratio %.3f)\n\n", best->result.Ratio());
+  };
+  for (size_t i = 0; i < tasks.size(); i++) {
+    const Task& task = tasks[i];
+    if (task.sample.first != column_family) {
+      if (i > 0) {
+        recommend();
+      }
+      column_family = task.sample.first;
+      best = nullptr;
+    }
+    if (i == 0 || task.sample != tasks[i - 1].sample) {
+      const std::vector<std::string>& blocks = samples.blocks.at(task.sample);
+      uint64_t bytes = 0;
+      for (const std::string& block : blocks) {
+        bytes += block.size();
+      }
+      printf("column_family=%s block_size=%zu blocks=%zu bytes=%" PRIu64 "\n",
+             column_family.c_str(), task.sample.second, blocks.size(), bytes);
+      PrintHeader();
+    }
+    PrintTask(task);
+    if (task.iaa && task.status.ok() &&
+        task.result.CompressMBps() >= min_mbps &&
+        task.result.UncompressMBps() >= min_mbps &&
+        (best == nullptr || task.result.Ratio() > best->result.Ratio())) {
+      best = &task;
+    }
+  }
+  recommend();
+  return 0;
+}